@@ -28,6 +28,8 @@ public class CustomLensFlare : ModuleRules
 			{
 				"CoreUObject",
 				"Engine",
+				"ImageCore",
+				"Json",
 				"RenderCore",
 				"Projects",
 				"RHICore",
@@ -41,6 +41,17 @@ void FCustomLensFlareModule::DestroyCustomLensFlares()
 	SceneViewExtensionInstance.Reset();
 }
 
+FCustomLensFlareModule* FCustomLensFlareModule::Get()
+{
+	return FModuleManager::GetModulePtr<FCustomLensFlareModule>("CustomLensFlare");
+}
+
+TSharedPtr<FCustomLensFlareSceneViewExtension> FCustomLensFlareModule::GetSceneViewExtension()
+{
+	const FCustomLensFlareModule* CustomLensFlareModule = Get();
+	return CustomLensFlareModule ? CustomLensFlareModule->SceneViewExtensionInstance : nullptr;
+}
+
 #undef LOCTEXT_NAMESPACE
 	
 IMPLEMENT_MODULE(FCustomLensFlareModule, CustomLensFlare)
\ No newline at end of file
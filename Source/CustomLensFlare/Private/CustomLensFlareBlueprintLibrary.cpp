@@ -0,0 +1,78 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+
+#include "CustomLensFlareBlueprintLibrary.h"
+
+#include "CustomLensFlare.h"
+#include "CustomLensFlareSceneViewExtension.h"
+
+void UCustomLensFlareBlueprintLibrary::SetLensFlareBaseConfig(UCustomLensFlareConfig* Config)
+{
+	if (const TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtension = FCustomLensFlareModule::GetSceneViewExtension())
+	{
+		SceneViewExtension->SetBaseConfig(Config);
+	}
+}
+
+void UCustomLensFlareBlueprintLibrary::RequestLensFlareBaseConfig(TSoftObjectPtr<UCustomLensFlareConfig> Config)
+{
+	if (Config.IsNull())
+		return;
+
+	if (const TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtension = FCustomLensFlareModule::GetSceneViewExtension())
+	{
+		SceneViewExtension->RequestBaseConfig(Config.ToSoftObjectPath());
+	}
+}
+
+void UCustomLensFlareBlueprintLibrary::ResetLensFlareBaseConfig()
+{
+	if (const TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtension = FCustomLensFlareModule::GetSceneViewExtension())
+	{
+		SceneViewExtension->ResetBaseConfig();
+	}
+}
+
+UCustomLensFlareConfig* UCustomLensFlareBlueprintLibrary::GetLensFlareBaseConfig()
+{
+	const TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtension = FCustomLensFlareModule::GetSceneViewExtension();
+	return SceneViewExtension ? SceneViewExtension->GetConfig() : nullptr;
+}
+
+void UCustomLensFlareBlueprintLibrary::SetLensFlarePipeline(ECustomLensFlarePipeline Pipeline)
+{
+	if (const TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtension = FCustomLensFlareModule::GetSceneViewExtension())
+	{
+		SceneViewExtension->SetPipeline(Pipeline);
+	}
+}
+
+ECustomLensFlarePipeline UCustomLensFlareBlueprintLibrary::GetLensFlarePipeline()
+{
+	const TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtension = FCustomLensFlareModule::GetSceneViewExtension();
+	return SceneViewExtension ? SceneViewExtension->GetPipeline() : ECustomLensFlarePipeline::Full;
+}
+
+void UCustomLensFlareBlueprintLibrary::SetLensFlareParameterOverride(int32 PlayerIndex, ECustomLensFlareParameter Parameter, ECustomLensFlareOverrideMode Mode, float Value)
+{
+	if (const TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtension = FCustomLensFlareModule::GetSceneViewExtension())
+	{
+		SceneViewExtension->SetParameterOverride(PlayerIndex, Parameter, Mode, Value);
+	}
+}
+
+void UCustomLensFlareBlueprintLibrary::ClearLensFlareParameterOverride(int32 PlayerIndex, ECustomLensFlareParameter Parameter)
+{
+	if (const TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtension = FCustomLensFlareModule::GetSceneViewExtension())
+	{
+		SceneViewExtension->ClearParameterOverride(PlayerIndex, Parameter);
+	}
+}
+
+void UCustomLensFlareBlueprintLibrary::ClearLensFlareParameterOverrides(int32 PlayerIndex)
+{
+	if (const TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtension = FCustomLensFlareModule::GetSceneViewExtension())
+	{
+		SceneViewExtension->ClearParameterOverrides(PlayerIndex);
+	}
+}
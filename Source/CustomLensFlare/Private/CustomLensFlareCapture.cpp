@@ -0,0 +1,703 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#include "CustomLensFlareCapture.h"
+
+#include "DynamicRHI.h"
+#include "ImageUtils.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "RenderingThread.h"
+#include "RHIGPUReadback.h"
+#include "SceneRendering.h"
+#include "ScenePrivate.h"
+#include "TextureResource.h"
+#include "Dom/JsonObject.h"
+#include "Engine/Texture2D.h"
+#include "HAL/FileManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+#include "Tasks/Task.h"
+#include "UObject/StrongObjectPtr.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogCustomLensFlareCapture, Log, All);
+
+namespace
+{
+	using FPerViewExtensionData = FCustomLensFlareSceneViewExtensionData::FPerViewExtensionData;
+
+	const TCHAR* const FrameFileName = TEXT("Frame.json");
+	const TCHAR* const SceneColorFileName = TEXT("SceneColor.exr");
+	const TCHAR* const ReplayTimingsFileName = TEXT("Replay.csv");
+	const TCHAR* const BeginStageName = TEXT("Begin");
+
+	FString GetCaptureDirectory(const FString& Name)
+	{
+		if (FPaths::IsRelative(Name))
+		{
+			return FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir() / TEXT("LensFlareCaptures") / Name);
+		}
+		return Name;
+	}
+
+	// Everything FPerViewExtensionData holds apart from the ghosts and the textures, by name
+	template<typename FDataType, typename FVisitor>
+	void VisitParameters(FDataType& Data, FVisitor&& Visit)
+	{
+		Visit(TEXT("Intensity"), Data.Intensity);
+		Visit(TEXT("Tint"), Data.Tint);
+		Visit(TEXT("ThresholdLevel"), Data.ThresholdLevel);
+		Visit(TEXT("ThresholdRange"), Data.ThresholdRange);
+		Visit(TEXT("GhostIntensity"), Data.GhostIntensity);
+		Visit(TEXT("GhostChromaShift"), Data.GhostChromaShift);
+		Visit(TEXT("GhostSpriteSize"), Data.GhostSpriteSize);
+		Visit(TEXT("HaloIntensity"), Data.HaloIntensity);
+		Visit(TEXT("HaloWidth"), Data.HaloWidth);
+		Visit(TEXT("HaloMask"), Data.HaloMask);
+		Visit(TEXT("HaloCompression"), Data.HaloCompression);
+		Visit(TEXT("HaloChromaShift"), Data.HaloChromaShift);
+		Visit(TEXT("GlareIntensity"), Data.GlareIntensity);
+		Visit(TEXT("GlareDivider"), Data.GlareDivider);
+		Visit(TEXT("GlareScale"), Data.GlareScale);
+		Visit(TEXT("GlareAngles"), Data.GlareAngles);
+		Visit(TEXT("GlareTint"), Data.GlareTint);
+		Visit(TEXT("StreakStretch"), Data.StreakStretch);
+		Visit(TEXT("FlareTint"), Data.FlareTint);
+		Visit(TEXT("FlareIntensity"), Data.FlareIntensity);
+	}
+
+	TSharedRef<FJsonValue> ToJson(float Value)
+	{
+		return MakeShared<FJsonValueNumber>(Value);
+	}
+
+	TSharedRef<FJsonValue> ToJson(const FLinearColor& Value)
+	{
+		return MakeShared<FJsonValueArray>(TArray<TSharedPtr<FJsonValue>>{ ToJson(Value.R), ToJson(Value.G), ToJson(Value.B), ToJson(Value.A) });
+	}
+
+	TSharedRef<FJsonValue> ToJson(const FVector& Value)
+	{
+		return MakeShared<FJsonValueArray>(TArray<TSharedPtr<FJsonValue>>{ ToJson(Value.X), ToJson(Value.Y), ToJson(Value.Z) });
+	}
+
+	void FromJson(const FJsonValue& Json, float& OutValue)
+	{
+		OutValue = float(Json.AsNumber());
+	}
+
+	void FromJson(const FJsonValue& Json, FLinearColor& OutValue)
+	{
+		const TArray<TSharedPtr<FJsonValue>>& Values = Json.AsArray();
+		for (int32 Index = 0; Index < FMath::Min(Values.Num(), 4); ++Index)
+		{
+			OutValue.Component(Index) = float(Values[Index]->AsNumber());
+		}
+	}
+
+	void FromJson(const FJsonValue& Json, FVector& OutValue)
+	{
+		const TArray<TSharedPtr<FJsonValue>>& Values = Json.AsArray();
+		for (int32 Index = 0; Index < FMath::Min(Values.Num(), 3); ++Index)
+		{
+			OutValue[Index] = Values[Index]->AsNumber();
+		}
+	}
+
+	template<typename EnumType>
+	FString EnumToString(EnumType Value)
+	{
+		return StaticEnum<EnumType>()->GetNameStringByValue(int64(Value));
+	}
+
+	template<typename EnumType>
+	EnumType EnumFromString(const FString& Name, EnumType Default)
+	{
+		const int64 Value = StaticEnum<EnumType>()->GetValueByNameString(Name);
+		return Value == INDEX_NONE ? Default : EnumType(Value);
+	}
+
+	// Keeps the default for captures from before the field existed
+	template<typename EnumType>
+	EnumType EnumFromJson(const FJsonObject& Json, const TCHAR* Name, EnumType Default)
+	{
+		FString Value;
+		return Json.TryGetStringField(Name, Value) ? EnumFromString(Value, Default) : Default;
+	}
+
+	// The render proxy only has the resources, their owner is the texture asset
+	FString GetTexturePath(const FTextureResource* Resource)
+	{
+#if !UE_BUILD_SHIPPING
+		if (Resource)
+		{
+			return Resource->GetOwnerName().ToString();
+		}
+#endif
+		return FString();
+	}
+
+	TSharedRef<FJsonObject> ParametersToJson(const FCustomLensFlareCapture::FRenderProxy& RenderProxy)
+	{
+		TSharedRef<FJsonObject> Json = MakeShared<FJsonObject>();
+		VisitParameters(RenderProxy, [&Json](const TCHAR* Name, const auto& Value)
+		{
+			Json->SetField(Name, ToJson(Value));
+		});
+
+		TArray<TSharedPtr<FJsonValue>> Ghosts;
+		for (const FLensFlareGhostSettings& Ghost : RenderProxy.Ghosts)
+		{
+			TSharedRef<FJsonObject> GhostJson = MakeShared<FJsonObject>();
+			GhostJson->SetField(TEXT("Color"), ToJson(Ghost.Color));
+			GhostJson->SetField(TEXT("Scale"), ToJson(Ghost.Scale));
+			Ghosts.Add(MakeShared<FJsonValueObject>(GhostJson));
+		}
+		Json->SetArrayField(TEXT("Ghosts"), Ghosts);
+		Json->SetStringField(TEXT("GhostMode"), EnumToString(RenderProxy.GhostMode));
+		Json->SetStringField(TEXT("GlareMode"), EnumToString(RenderProxy.GlareMode));
+		Json->SetStringField(TEXT("StreakAxis"), EnumToString(RenderProxy.StreakAxis));
+
+		Json->SetStringField(TEXT("Gradient"), GetTexturePath(RenderProxy.GradientResource));
+		Json->SetStringField(TEXT("GlareLineMask"), GetTexturePath(RenderProxy.GlareLineMaskResource));
+		Json->SetStringField(TEXT("GhostSpriteTexture"), GetTexturePath(RenderProxy.GhostSpriteTextureResource));
+		return Json;
+	}
+
+	// Textures of replays stay loaded until the next replay command, so the render proxies can hold on to their resources
+	TArray<TStrongObjectPtr<UTexture2D>> GReplayTextures;
+
+	UTexture2D* LoadReplayTexture(const FJsonObject& Json, const TCHAR* Name)
+	{
+		const FString Path = Json.GetStringField(Name);
+		if (Path.IsEmpty())
+			return nullptr;
+
+		UTexture2D* Texture = LoadObject<UTexture2D>(nullptr, *Path);
+		UE_CLOG(!Texture, LogCustomLensFlareCapture, Warning, TEXT("Replay texture %s could not be loaded"), *Path);
+		if (Texture)
+		{
+			GReplayTextures.Emplace(Texture);
+		}
+		return Texture;
+	}
+
+	// Fails on malformed ghosts, the frame would not be reproduced with some of them left out
+	bool ParametersFromJson(const FJsonObject& Json, FPerViewExtensionData& Data)
+	{
+		VisitParameters(Data, [&Json](const TCHAR* Name, auto& Value)
+		{
+			if (const TSharedPtr<FJsonValue> Field = Json.TryGetField(Name))
+			{
+				FromJson(*Field, Value);
+			}
+		});
+
+		const TArray<TSharedPtr<FJsonValue>>* Ghosts = nullptr;
+		if (Json.TryGetArrayField(TEXT("Ghosts"), Ghosts))
+		{
+			Data.Ghosts.Reset();
+			for (const TSharedPtr<FJsonValue>& GhostValue : *Ghosts)
+			{
+				const TSharedPtr<FJsonObject>* GhostJson = nullptr;
+				const TArray<TSharedPtr<FJsonValue>>* Color = nullptr;
+				double Scale = 0.0;
+				if (!GhostValue.IsValid()
+					|| !GhostValue->TryGetObject(GhostJson)
+					|| !(*GhostJson)->TryGetArrayField(TEXT("Color"), Color)
+					|| !(*GhostJson)->TryGetNumberField(TEXT("Scale"), Scale))
+					return false;
+
+				FLensFlareGhostSettings& Ghost = Data.Ghosts.AddDefaulted_GetRef();
+				FromJson(FJsonValueArray(*Color), Ghost.Color);
+				Ghost.Scale = float(Scale);
+			}
+		}
+		Data.GhostMode = EnumFromJson(Json, TEXT("GhostMode"), Data.GhostMode);
+		Data.GlareMode = EnumFromJson(Json, TEXT("GlareMode"), Data.GlareMode);
+		Data.StreakAxis = EnumFromJson(Json, TEXT("StreakAxis"), Data.StreakAxis);
+
+		Data.Gradient = LoadReplayTexture(Json, TEXT("Gradient"));
+		Data.GlareLineMask = LoadReplayTexture(Json, TEXT("GlareLineMask"));
+		Data.GhostSpriteTexture = LoadReplayTexture(Json, TEXT("GhostSpriteTexture"));
+		return true;
+	}
+
+	TSharedPtr<FCustomLensFlareCapture::FReplayFrame> LoadReplayFrame(const FString& FrameDirectory, const FString& ReplayDirectory, int32 Iterations)
+	{
+		FString JsonText;
+		TSharedPtr<FJsonObject> Json;
+		if (!FFileHelper::LoadFileToString(JsonText, *(FrameDirectory / FrameFileName))
+			|| !FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(JsonText), Json)
+			|| !Json.IsValid())
+		{
+			UE_LOG(LogCustomLensFlareCapture, Warning, TEXT("%s has no readable %s"), *FrameDirectory, FrameFileName);
+			return nullptr;
+		}
+
+		TSharedPtr<FCustomLensFlareCapture::FReplayFrame> Frame = MakeShared<FCustomLensFlareCapture::FReplayFrame>();
+		if (!FImageUtils::LoadImage(*(FrameDirectory / SceneColorFileName), Frame->SceneColor))
+		{
+			UE_LOG(LogCustomLensFlareCapture, Warning, TEXT("%s has no readable %s"), *FrameDirectory, SceneColorFileName);
+			return nullptr;
+		}
+		Frame->SceneColor.ChangeFormat(ERawImageFormat::RGBA16F, EGammaSpace::Linear);
+
+		Frame->Name = FPaths::GetCleanFilename(FrameDirectory);
+		Frame->Directory = ReplayDirectory;
+		Frame->Iterations = FMath::Max(Iterations, 1);
+
+		const TArray<TSharedPtr<FJsonValue>>& ViewRect = Json->GetArrayField(TEXT("ViewRect"));
+		if (ViewRect.Num() == 4)
+		{
+			Frame->ViewRect = FIntRect(int32(ViewRect[0]->AsNumber()), int32(ViewRect[1]->AsNumber()), int32(ViewRect[2]->AsNumber()), int32(ViewRect[3]->AsNumber()));
+		}
+		Frame->Pipeline = EnumFromString(Json->GetStringField(TEXT("Pipeline")), ECustomLensFlarePipeline::Full);
+
+		const TSharedPtr<FJsonObject>* Parameters = nullptr;
+		FPerViewExtensionData Data = FPerViewExtensionData::MakeNeutral();
+		if (Json->TryGetObjectField(TEXT("Parameters"), Parameters) && !ParametersFromJson(**Parameters, Data))
+		{
+			UE_LOG(LogCustomLensFlareCapture, Warning, TEXT("%s has malformed ghosts in %s, skipping the frame"), *FrameDirectory, FrameFileName);
+			return nullptr;
+		}
+		Frame->RenderProxy = MakeUnique<FCustomLensFlareCapture::FRenderProxy>(Data);
+		return Frame;
+	}
+
+	// Unsigned float with a 5 bit exponent as in PF_FloatR11G11B10
+	float DecodeSmallFloat(uint32 Bits, uint32 MantissaBits)
+	{
+		const uint32 Exponent = Bits >> MantissaBits;
+		const float Mantissa = float(Bits & ((1u << MantissaBits) - 1)) / float(1u << MantissaBits);
+		if (Exponent == 0)
+			return Mantissa * FMath::Exp2(-14.0f);
+		if (Exponent == 31)
+			return Mantissa > 0.0f ? 0.0f : MAX_flt;
+		return (1.0f + Mantissa) * FMath::Exp2(float(Exponent) - 15.0f);
+	}
+
+	bool IsSupportedCaptureFormat(EPixelFormat Format)
+	{
+		return Format == PF_FloatRGBA || Format == PF_A32B32G32R32F || Format == PF_FloatRGB || Format == PF_FloatR11G11B10;
+	}
+
+	FLinearColor DecodePixel(EPixelFormat Format, const uint8* Pixel)
+	{
+		switch (Format)
+		{
+		case PF_FloatRGBA:
+			return FLinearColor(*reinterpret_cast<const FFloat16Color*>(Pixel));
+		case PF_A32B32G32R32F:
+			return *reinterpret_cast<const FLinearColor*>(Pixel);
+		case PF_FloatRGB:
+		case PF_FloatR11G11B10:
+		{
+			uint32 Packed = 0;
+			FMemory::Memcpy(&Packed, Pixel, sizeof(Packed));
+			return FLinearColor(DecodeSmallFloat(Packed & 0x7FF, 6), DecodeSmallFloat((Packed >> 11) & 0x7FF, 6), DecodeSmallFloat(Packed >> 22, 5), 1.0f);
+		}
+		default:
+			return FLinearColor::Black;
+		}
+	}
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FLensFlareReplayUploadParameters,)
+		RDG_TEXTURE_ACCESS(Texture, ERHIAccess::CopyDest)
+	END_SHADER_PARAMETER_STRUCT()
+
+	FAutoConsoleCommand LensFlareCaptureCommand(
+		TEXT("r.LensFlare.Capture"),
+		TEXT("r.LensFlare.Capture <Frames> [Directory]\n")
+		TEXT("Writes scene color, the bloom downsamples and the blended parameters of every view of the next frames to disk.\n")
+		TEXT("Relative directories are in Saved/LensFlareCaptures, the default is named after the current time."),
+		FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+		{
+			const int32 FrameCount = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 1;
+			const FString Directory = GetCaptureDirectory(Args.Num() > 1 ? Args[1] : FDateTime::Now().ToString());
+
+			ENQUEUE_RENDER_COMMAND(StartCustomLensFlareCapture)([FrameCount, Directory](FRHICommandListImmediate&)
+			{
+				FCustomLensFlareCapture::Get().StartCapture(FrameCount, Directory);
+			});
+		})
+		);
+
+	FAutoConsoleCommand LensFlareReplayCommand(
+		TEXT("r.LensFlare.Replay"),
+		TEXT("r.LensFlare.Replay <Directory> [Iterations]\n")
+		TEXT("Renders every frame of a capture Iterations times (default 100) in place of the next hook calls and logs the GPU time of each stage.\n")
+		TEXT("The timings are appended to Replay.csv in the directory. Replay at the resolution of the capture for comparable numbers."),
+		FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+		{
+			if (Args.IsEmpty())
+			{
+				UE_LOG(LogCustomLensFlareCapture, Display, TEXT("Usage: r.LensFlare.Replay <Directory> [Iterations]"));
+				return;
+			}
+
+			const FString Directory = GetCaptureDirectory(Args[0]);
+			const int32 Iterations = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 100;
+
+			// A single frame or a whole capture
+			TArray<FString> FrameDirectories;
+			if (FPaths::FileExists(Directory / FrameFileName))
+			{
+				FrameDirectories.Add(Directory);
+			}
+			else
+			{
+				IFileManager::Get().FindFiles(FrameDirectories, *(Directory / TEXT("*")), false, true);
+				FrameDirectories.Sort();
+				for (FString& FrameDirectory : FrameDirectories)
+				{
+					FrameDirectory = Directory / FrameDirectory;
+				}
+			}
+
+			// Replays that haven't run yet are dropped, then nothing refers to the textures of previous ones anymore
+			ENQUEUE_RENDER_COMMAND(ClearCustomLensFlareReplays)([](FRHICommandListImmediate&)
+			{
+				FCustomLensFlareCapture::Get().QueueReplay({});
+			});
+			FlushRenderingCommands();
+			GReplayTextures.Reset();
+
+			TArray<TSharedPtr<FCustomLensFlareCapture::FReplayFrame>> Frames;
+			for (const FString& FrameDirectory : FrameDirectories)
+			{
+				if (TSharedPtr<FCustomLensFlareCapture::FReplayFrame> Frame = LoadReplayFrame(FrameDirectory, Directory, Iterations))
+				{
+					Frames.Add(MoveTemp(Frame));
+				}
+			}
+
+			UE_LOG(LogCustomLensFlareCapture, Display, TEXT("Replaying %d frames from %s"), Frames.Num(), *Directory);
+			ENQUEUE_RENDER_COMMAND(QueueCustomLensFlareReplay)([Frames = MoveTemp(Frames)](FRHICommandListImmediate&) mutable
+			{
+				FCustomLensFlareCapture::Get().QueueReplay(MoveTemp(Frames));
+			});
+		})
+		);
+}
+
+FCustomLensFlareCapture& FCustomLensFlareCapture::Get()
+{
+	check(IsInRenderingThread());
+	static FCustomLensFlareCapture Capture;
+	return Capture;
+}
+
+void FCustomLensFlareCapture::StartCapture(int32 FrameCount, const FString& Directory)
+{
+	CaptureFramesLeft = FrameCount;
+	CapturedFrames = 0;
+	CaptureFrameNumber = 0;
+	CaptureDirectory = Directory;
+	UE_LOG(LogCustomLensFlareCapture, Display, TEXT("Capturing %d frames to %s"), FrameCount, *Directory);
+}
+
+void FCustomLensFlareCapture::QueueReplay(TArray<TSharedPtr<FReplayFrame>>&& Frames)
+{
+	PendingReplays = MoveTemp(Frames);
+}
+
+void FCustomLensFlareCapture::Tick()
+{
+	WritePendingImages();
+	ReportReplayTimings();
+
+	if (!IsReplaying())
+	{
+		ReplayOutput.SafeRelease();
+	}
+}
+
+void FCustomLensFlareCapture::CaptureView(FRDGBuilder& GraphBuilder, const FViewInfo& View, const FRenderProxy& RenderProxy, ECustomLensFlarePipeline Pipeline, TConstArrayView<FScreenPassTextureSlice> Mips)
+{
+	if (Mips.IsEmpty())
+		return;
+
+	// All views of a frame go into the same capture frame
+	if (CaptureFrameNumber != GFrameCounterRenderThread)
+	{
+		if (CaptureFramesLeft <= 0)
+			return;
+
+		--CaptureFramesLeft;
+		++CapturedFrames;
+		CapturedViews = 0;
+		CaptureFrameNumber = GFrameCounterRenderThread;
+	}
+
+	// Nothing touches the disk here, the frame is written by WriteFrame() once its readbacks are in
+	TSharedPtr<FPendingFrame> Frame = MakeShared<FPendingFrame>();
+	Frame->Directory = CaptureDirectory / FString::Printf(TEXT("Frame%04d_View%d"), CapturedFrames - 1, CapturedViews++);
+
+	RDG_EVENT_SCOPE(GraphBuilder, "LensFlareCapture");
+
+	TArray<TSharedPtr<FJsonValue>> MipFiles;
+	for (int32 MipIndex = 0; MipIndex < Mips.Num(); ++MipIndex)
+	{
+		const FScreenPassTextureSlice& Mip = Mips[MipIndex];
+		FRDGTextureRef SourceTexture = Mip.TextureSRV->Desc.Texture;
+		if (!IsSupportedCaptureFormat(SourceTexture->Desc.Format))
+		{
+			UE_LOG(LogCustomLensFlareCapture, Warning, TEXT("Can't capture %s in %s"), SourceTexture->Name, GetPixelFormatString(SourceTexture->Desc.Format));
+			continue;
+		}
+
+		// Only the viewport, at the origin of a texture of its own
+		const FIntPoint Size = Mip.ViewRect.Size();
+		FRDGTextureRef CopyTexture = GraphBuilder.CreateTexture(
+			FRDGTextureDesc::Create2D(Size, SourceTexture->Desc.Format, FClearValueBinding::None, TexCreate_ShaderResource),
+			TEXT("LensFlareCapture"));
+
+		FRHICopyTextureInfo CopyInfo;
+		CopyInfo.SourceMipIndex = Mip.TextureSRV->Desc.MipLevel;
+		CopyInfo.SourceSliceIndex = Mip.TextureSRV->Desc.FirstArraySlice;
+		CopyInfo.SourcePosition = FIntVector(Mip.ViewRect.Min.X, Mip.ViewRect.Min.Y, 0);
+		CopyInfo.Size = FIntVector(Size.X, Size.Y, 1);
+		AddCopyTexturePass(GraphBuilder, SourceTexture, CopyTexture, CopyInfo);
+
+		FPendingImage& Pending = PendingImages.AddDefaulted_GetRef();
+		Pending.Frame = Frame;
+		Pending.Readback = MakeUnique<FRHIGPUTextureReadback>(TEXT("LensFlareCapture"));
+		Pending.FileName = MipIndex == 0 ? FString(SceneColorFileName) : FString::Printf(TEXT("Mip%d.exr"), MipIndex);
+		Pending.Size = Size;
+		Pending.Format = SourceTexture->Desc.Format;
+		AddEnqueueCopyPass(GraphBuilder, Pending.Readback.Get(), CopyTexture);
+		++Frame->ImagesLeft;
+
+		MipFiles.Add(MakeShared<FJsonValueString>(Pending.FileName));
+	}
+
+	TSharedRef<FJsonObject> Json = MakeShared<FJsonObject>();
+	Json->SetNumberField(TEXT("Frame"), double(GFrameCounterRenderThread));
+	Json->SetArrayField(TEXT("ViewRect"), {
+		MakeShared<FJsonValueNumber>(View.ViewRect.Min.X),
+		MakeShared<FJsonValueNumber>(View.ViewRect.Min.Y),
+		MakeShared<FJsonValueNumber>(View.ViewRect.Max.X),
+		MakeShared<FJsonValueNumber>(View.ViewRect.Max.Y) });
+	Json->SetStringField(TEXT("Pipeline"), EnumToString(Pipeline));
+	// Come from the view and not from the capture when replaying, so only for reference
+	Json->SetNumberField(TEXT("BloomIntensity"), View.FinalPostProcessSettings.BloomIntensity);
+	Json->SetNumberField(TEXT("BloomThreshold"), View.FinalPostProcessSettings.BloomThreshold);
+	Json->SetNumberField(TEXT("PreExposure"), View.PreExposure);
+	Json->SetArrayField(TEXT("Mips"), MipFiles);
+	Json->SetObjectField(TEXT("Parameters"), ParametersToJson(RenderProxy));
+
+	FJsonSerializer::Serialize(Json, TJsonWriterFactory<>::Create(&Frame->JsonText));
+	if (Frame->ImagesLeft == 0)
+	{
+		WriteFrame(MoveTemp(Frame));
+	}
+}
+
+void FCustomLensFlareCapture::WriteFrame(TSharedPtr<FPendingFrame>&& Frame)
+{
+	UE::Tasks::Launch(UE_SOURCE_LOCATION, [Frame = MoveTemp(Frame)]()
+	{
+		if (!IFileManager::Get().MakeDirectory(*Frame->Directory, true))
+		{
+			UE_LOG(LogCustomLensFlareCapture, Warning, TEXT("Failed to create %s"), *Frame->Directory);
+			return;
+		}
+
+		for (const TPair<FString, FImage>& Image : Frame->Images)
+		{
+			const FString Path = Frame->Directory / Image.Key;
+			UE_CLOG(!FImageUtils::SaveImageByExtension(*Path, Image.Value), LogCustomLensFlareCapture, Warning, TEXT("Failed to write %s"), *Path);
+		}
+
+		const FString Path = Frame->Directory / FrameFileName;
+		UE_CLOG(!FFileHelper::SaveStringToFile(Frame->JsonText, *Path), LogCustomLensFlareCapture, Warning, TEXT("Failed to write %s"), *Path);
+	});
+}
+
+void FCustomLensFlareCapture::WritePendingImages()
+{
+	for (int32 Index = 0; Index < PendingImages.Num();)
+	{
+		FPendingImage& Pending = PendingImages[Index];
+		if (!Pending.Readback->IsReady())
+		{
+			++Index;
+			continue;
+		}
+
+		FImage Image(Pending.Size.X, Pending.Size.Y, ERawImageFormat::RGBA16F, EGammaSpace::Linear);
+		TArrayView64<FFloat16Color> Pixels = Image.AsRGBA16F();
+		const int32 BytesPerPixel = GPixelFormats[Pending.Format].BlockBytes;
+
+		int32 RowPitchInPixels = 0;
+		const uint8* Data = static_cast<const uint8*>(Pending.Readback->Lock(RowPitchInPixels));
+		for (int32 Y = 0; Y < Pending.Size.Y; ++Y)
+		{
+			for (int32 X = 0; X < Pending.Size.X; ++X)
+			{
+				const uint8* Pixel = Data + (int64(Y) * RowPitchInPixels + X) * BytesPerPixel;
+				Pixels[int64(Y) * Pending.Size.X + X] = FFloat16Color(DecodePixel(Pending.Format, Pixel));
+			}
+		}
+		Pending.Readback->Unlock();
+
+		Pending.Frame->Images.Emplace(MoveTemp(Pending.FileName), MoveTemp(Image));
+		if (--Pending.Frame->ImagesLeft == 0)
+		{
+			WriteFrame(MoveTemp(Pending.Frame));
+		}
+
+		PendingImages.RemoveAtSwap(Index, EAllowShrinking::No);
+	}
+}
+
+void FCustomLensFlareCapture::Replay(FRDGBuilder& GraphBuilder, const FViewInfo& View, TFunctionRef<FScreenPassTexture(const FScreenPassTextureSlice&)> RenderFunction)
+{
+	if (PendingReplays.IsEmpty() || IsReplaying())
+		return;
+
+	ActiveReplay = PendingReplays[0];
+	PendingReplays.RemoveAt(0);
+
+	const FIntPoint Size(int32(ActiveReplay->SceneColor.SizeX), int32(ActiveReplay->SceneColor.SizeY));
+	UE_CLOG(Size != View.ViewRect.Size(), LogCustomLensFlareCapture, Warning,
+		TEXT("Replaying %s captured at %dx%d in a %dx%d view. The stages that size themselves after the view won't match the capture."),
+		*ActiveReplay->Name, Size.X, Size.Y, View.ViewRect.Width(), View.ViewRect.Height());
+	UE_CLOG(!GSupportsTimestampRenderQueries, LogCustomLensFlareCapture, Warning, TEXT("This RHI has no timestamp queries, %s is replayed without timings"), *ActiveReplay->Name);
+
+	RDG_EVENT_SCOPE(GraphBuilder, "LensFlareReplay %s", *ActiveReplay->Name);
+
+	FRDGTextureRef SceneColor = GraphBuilder.CreateTexture(
+		FRDGTextureDesc::Create2D(Size, PF_FloatRGBA, FClearValueBinding::Black, TexCreate_ShaderResource),
+		TEXT("LensFlareReplaySceneColor"));
+
+	FLensFlareReplayUploadParameters* UploadParameters = GraphBuilder.AllocParameters<FLensFlareReplayUploadParameters>();
+	UploadParameters->Texture = SceneColor;
+	GraphBuilder.AddPass(
+		RDG_EVENT_NAME("LensFlareReplayUpload"),
+		UploadParameters,
+		ERDGPassFlags::Copy | ERDGPassFlags::NeverCull,
+		[UploadParameters, Frame = ActiveReplay, Size](FRHICommandListImmediate& RHICmdList)
+		{
+			const FUpdateTextureRegion2D Region(0, 0, 0, 0, Size.X, Size.Y);
+			RHICmdList.UpdateTexture2D(UploadParameters->Texture->GetRHI(), 0, Region, Size.X * sizeof(FFloat16Color), Frame->SceneColor.RawData.GetData());
+		});
+
+	const FScreenPassTextureSlice SceneColorSlice(GraphBuilder.CreateSRV(FRDGTextureSRVDesc(SceneColor)), FIntRect(FIntPoint::ZeroValue, Size));
+
+	ActiveTiming = FReplayTiming();
+	ActiveTiming.Name = ActiveReplay->Name;
+	ActiveTiming.Directory = ActiveReplay->Directory;
+	ActiveTiming.Iterations = ActiveReplay->Iterations;
+
+	FScreenPassTexture Output;
+	for (int32 Iteration = 0; Iteration < ActiveReplay->Iterations; ++Iteration)
+	{
+		MarkStage(GraphBuilder, BeginStageName);
+		Output = RenderFunction(SceneColorSlice);
+	}
+
+	if (Output.IsValid())
+	{
+		GraphBuilder.QueueTextureExtraction(Output.Texture, &ReplayOutput);
+	}
+
+	if (GSupportsTimestampRenderQueries)
+	{
+		PendingTimings.Add(MoveTemp(ActiveTiming));
+	}
+	ActiveReplay.Reset();
+}
+
+void FCustomLensFlareCapture::MarkStage(FRDGBuilder& GraphBuilder, const TCHAR* StageName)
+{
+	if (!IsReplaying() || !GSupportsTimestampRenderQueries)
+		return;
+
+	FRenderQueryRHIRef Query = RHICreateRenderQuery(RQT_AbsoluteTime);
+	ActiveTiming.Marks.Add({ StageName, Query });
+
+	GraphBuilder.AddPass(
+		RDG_EVENT_NAME("LensFlareReplayMark %s", StageName),
+		ERDGPassFlags::NeverCull,
+		[Query](FRHICommandListImmediate& RHICmdList)
+		{
+			RHICmdList.EndRenderQuery(Query);
+		});
+}
+
+void FCustomLensFlareCapture::ReportReplayTimings()
+{
+	for (int32 TimingIndex = 0; TimingIndex < PendingTimings.Num();)
+	{
+		const FReplayTiming& Timing = PendingTimings[TimingIndex];
+
+		TArray<uint64> Timestamps;
+		for (const FStageMark& Mark : Timing.Marks)
+		{
+			uint64 Timestamp = 0;
+			if (!RHIGetRenderQueryResult(Mark.Query, Timestamp, false))
+				break;
+			Timestamps.Add(Timestamp);
+		}
+
+		if (Timestamps.Num() < Timing.Marks.Num())
+		{
+			++TimingIndex;
+			continue;
+		}
+
+		struct FStageTime
+		{
+			const TCHAR* StageName = nullptr;
+			double TotalMs = 0.0;
+			double MinMs = MAX_dbl;
+			double MaxMs = 0.0;
+			int32 Count = 0;
+		};
+		TArray<FStageTime> StageTimes;
+		auto AddTime = [&StageTimes](const TCHAR* StageName, double Ms)
+		{
+			FStageTime* StageTime = StageTimes.FindByPredicate([StageName](const FStageTime& Candidate) { return FCString::Strcmp(Candidate.StageName, StageName) == 0; });
+			if (!StageTime)
+			{
+				StageTime = &StageTimes.AddDefaulted_GetRef();
+				StageTime->StageName = StageName;
+			}
+			StageTime->TotalMs += Ms;
+			StageTime->MinMs = FMath::Min(StageTime->MinMs, Ms);
+			StageTime->MaxMs = FMath::Max(StageTime->MaxMs, Ms);
+			++StageTime->Count;
+		};
+
+		// Timestamps are in microseconds
+		int32 BeginIndex = 0;
+		for (int32 MarkIndex = 1; MarkIndex <= Timing.Marks.Num(); ++MarkIndex)
+		{
+			const bool bIterationEnd = MarkIndex == Timing.Marks.Num() || Timing.Marks[MarkIndex].StageName == BeginStageName;
+			if (bIterationEnd)
+			{
+				AddTime(TEXT("Total"), double(Timestamps[MarkIndex - 1] - Timestamps[BeginIndex]) / 1000.0);
+				BeginIndex = MarkIndex;
+				continue;
+			}
+			AddTime(Timing.Marks[MarkIndex].StageName, double(Timestamps[MarkIndex] - Timestamps[MarkIndex - 1]) / 1000.0);
+		}
+
+		const FString TimingsPath = Timing.Directory / ReplayTimingsFileName;
+		FString Csv = FPaths::FileExists(TimingsPath) ? FString() : FString(TEXT("Frame,Stage,Iterations,AverageMs,MinMs,MaxMs\n"));
+
+		UE_LOG(LogCustomLensFlareCapture, Display, TEXT("Replay of %s, %d iterations:"), *Timing.Name, Timing.Iterations);
+		for (const FStageTime& StageTime : StageTimes)
+		{
+			const double AverageMs = StageTime.TotalMs / StageTime.Count;
+			UE_LOG(LogCustomLensFlareCapture, Display, TEXT("  %-8s %8.3f ms  (min %.3f, max %.3f)"), StageTime.StageName, AverageMs, StageTime.MinMs, StageTime.MaxMs);
+			Csv += FString::Printf(TEXT("%s,%s,%d,%.4f,%.4f,%.4f\n"), *Timing.Name, StageTime.StageName, StageTime.Count, AverageMs, StageTime.MinMs, StageTime.MaxMs);
+		}
+		FFileHelper::SaveStringToFile(Csv, *TimingsPath, FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), FILEWRITE_Append);
+
+		PendingTimings.RemoveAt(TimingIndex);
+	}
+}
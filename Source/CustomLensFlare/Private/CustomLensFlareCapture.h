@@ -0,0 +1,133 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ImageCore.h"
+#include "RenderGraphResources.h"
+#include "ScreenPass.h"
+#include "CustomLensFlareSceneViewExtensionData.h"
+
+class FRHIGPUTextureReadback;
+class FViewInfo;
+
+/**
+ * Records what the bloom and flare hook is given and plays it back to profile the chain away from the game.
+ *
+ * r.LensFlare.Capture <Frames> [Directory] writes, for every view of the next frames, the scene color and the bloom
+ * pyramid as EXR and the blended parameters, pipeline and view rect as JSON into Saved/LensFlareCaptures.
+ * r.LensFlare.Replay <Directory> [Iterations] renders the captured frames in place of the input of the next hook calls,
+ * in whatever map is open, and logs the GPU time of every stage. The timings are appended to Replay.csv in the directory.
+ *
+ * Only when the plugin renders the bloom itself, not in r.PostProcessing.CustomBloomFlareMode 2.
+ * Render thread only, apart from the console commands.
+ */
+class FCustomLensFlareCapture
+{
+public:
+	using FRenderProxy = FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy;
+
+	/** A captured frame loaded back from disk */
+	struct FReplayFrame
+	{
+		FString Name;
+		FString Directory;
+		int32 Iterations = 1;
+
+		// RGBA16F
+		FImage SceneColor;
+		FIntRect ViewRect;
+		ECustomLensFlarePipeline Pipeline = ECustomLensFlarePipeline::Full;
+		TUniquePtr<FRenderProxy> RenderProxy;
+	};
+
+	static FCustomLensFlareCapture& Get();
+
+	/** Called by the console commands through the render thread. A new replay replaces the frames that haven't been replayed yet. */
+	void StartCapture(int32 FrameCount, const FString& Directory);
+	void QueueReplay(TArray<TSharedPtr<FReplayFrame>>&& Frames);
+
+	/** Writes out the readbacks that have arrived and finishes replays whose timings are in. Once per hook call. */
+	void Tick();
+
+	bool IsCapturing() const { return CaptureFramesLeft > 0 || CaptureFrameNumber == GFrameCounterRenderThread; }
+
+	/** Queues the readback of a view. Mips[0] is scene color, the others the downsamples of the bloom. */
+	void CaptureView(
+		FRDGBuilder& GraphBuilder,
+		const FViewInfo& View,
+		const FRenderProxy& RenderProxy,
+		ECustomLensFlarePipeline Pipeline,
+		TConstArrayView<FScreenPassTextureSlice> Mips);
+
+	/**
+	 * Runs RenderFunction for every iteration of the next pending replay with the captured scene color, with the captured
+	 * parameters and pipeline in effect. RenderFunction has to call MarkStage() after every stage and return the output,
+	 * which is kept so the graph doesn't cull the replay. Does nothing without a pending replay.
+	 */
+	void Replay(FRDGBuilder& GraphBuilder, const FViewInfo& View, TFunctionRef<FScreenPassTexture(const FScreenPassTextureSlice&)> RenderFunction);
+
+	bool IsReplaying() const { return ActiveReplay.IsValid(); }
+
+	/** Replaces the blended parameters and pipeline of the view while replaying, null otherwise */
+	const FRenderProxy* GetReplayRenderProxy() const { return ActiveReplay ? ActiveReplay->RenderProxy.Get() : nullptr; }
+	ECustomLensFlarePipeline GetReplayPipeline(ECustomLensFlarePipeline Pipeline) const { return ActiveReplay ? ActiveReplay->Pipeline : Pipeline; }
+
+	/** Timestamps the end of a stage of the chain while replaying */
+	void MarkStage(FRDGBuilder& GraphBuilder, const TCHAR* StageName);
+
+private:
+	/** A captured view, written to disk from a task once all of its readbacks have arrived */
+	struct FPendingFrame
+	{
+		FString Directory;
+		FString JsonText;
+		TArray<TPair<FString, FImage>> Images;
+		int32 ImagesLeft = 0;
+	};
+
+	struct FPendingImage
+	{
+		TSharedPtr<FPendingFrame> Frame;
+		TUniquePtr<FRHIGPUTextureReadback> Readback;
+		FString FileName;
+		FIntPoint Size;
+		EPixelFormat Format = PF_Unknown;
+	};
+
+	struct FStageMark
+	{
+		const TCHAR* StageName = nullptr;
+		FRenderQueryRHIRef Query;
+	};
+
+	struct FReplayTiming
+	{
+		FString Name;
+		FString Directory;
+		int32 Iterations = 0;
+		// Every iteration starts with a mark named Begin
+		TArray<FStageMark> Marks;
+	};
+
+	void WritePendingImages();
+	static void WriteFrame(TSharedPtr<FPendingFrame>&& Frame);
+	void ReportReplayTimings();
+
+	// Frames left to capture and the one currently being captured
+	int32 CaptureFramesLeft = 0;
+	int32 CapturedFrames = 0;
+	int32 CapturedViews = 0;
+	uint64 CaptureFrameNumber = 0;
+	FString CaptureDirectory;
+
+	TArray<FPendingImage> PendingImages;
+
+	TArray<TSharedPtr<FReplayFrame>> PendingReplays;
+	TSharedPtr<FReplayFrame> ActiveReplay;
+	FReplayTiming ActiveTiming;
+	TArray<FReplayTiming> PendingTimings;
+
+	// Output of the last replay, only there so its passes aren't culled
+	TRefCountPtr<IPooledRenderTarget> ReplayOutput;
+};
@@ -3,7 +3,33 @@
 
 #include "CustomLensFlareConfig.h"
 
+#include "CustomLensFlare.h"
+#include "CustomLensFlareSceneViewExtension.h"
 #include "CustomLensFlareSceneViewExtensionData.h"
+#include "Serialization/CustomVersion.h"
+
+namespace
+{
+	struct FCustomLensFlareConfigVersion
+	{
+		enum Type
+		{
+			BeforeCustomVersionWasAdded = 0,
+
+			// Ghost1..Ghost8 were replaced by the Ghosts array
+			GhostArray,
+
+			VersionPlusOne,
+			LatestVersion = VersionPlusOne - 1
+		};
+
+		static const FGuid GUID;
+	};
+
+	const FGuid FCustomLensFlareConfigVersion::GUID(0x5B3E8C71, 0x2F4A4D19, 0x9C06A7E2, 0x41D8B35F);
+
+	FCustomVersionRegistration GRegisterCustomLensFlareConfigVersion(FCustomLensFlareConfigVersion::GUID, FCustomLensFlareConfigVersion::LatestVersion, TEXT("CustomLensFlareConfigVer"));
+}
 
 void UCustomLensFlareConfig::OverrideBlendableSettings(class FSceneView& View, float Weight) const
 {
@@ -29,29 +55,39 @@ void UCustomLensFlareConfig::OverrideBlendableSettings(class FSceneView& View, f
 
 	PerViewData->GhostChromaShift = FMath::Lerp(PerViewData->GhostChromaShift, GhostChromaShift, Weight);
 
-	PerViewData->Ghost1.Color = FMath::Lerp(PerViewData->Ghost1.Color, Ghost1.Color, Weight);
-	PerViewData->Ghost1.Scale = FMath::Lerp(PerViewData->Ghost1.Scale, Ghost1.Scale, Weight);
-
-	PerViewData->Ghost2.Color = FMath::Lerp(PerViewData->Ghost2.Color, Ghost2.Color, Weight);
-	PerViewData->Ghost2.Scale = FMath::Lerp(PerViewData->Ghost2.Scale, Ghost2.Scale, Weight);
-
-	PerViewData->Ghost3.Color = FMath::Lerp(PerViewData->Ghost3.Color, Ghost3.Color, Weight);
-	PerViewData->Ghost3.Scale = FMath::Lerp(PerViewData->Ghost3.Scale, Ghost3.Scale, Weight);
-
-	PerViewData->Ghost4.Color = FMath::Lerp(PerViewData->Ghost4.Color, Ghost4.Color, Weight);
-	PerViewData->Ghost4.Scale = FMath::Lerp(PerViewData->Ghost4.Scale, Ghost4.Scale, Weight);
-
-	PerViewData->Ghost5.Color = FMath::Lerp(PerViewData->Ghost5.Color, Ghost5.Color, Weight);
-	PerViewData->Ghost5.Scale = FMath::Lerp(PerViewData->Ghost5.Scale, Ghost5.Scale, Weight);
-
-	PerViewData->Ghost6.Color = FMath::Lerp(PerViewData->Ghost6.Color, Ghost6.Color, Weight);
-	PerViewData->Ghost6.Scale = FMath::Lerp(PerViewData->Ghost6.Scale, Ghost6.Scale, Weight);
-
-	PerViewData->Ghost7.Color = FMath::Lerp(PerViewData->Ghost7.Color, Ghost7.Color, Weight);
-	PerViewData->Ghost7.Scale = FMath::Lerp(PerViewData->Ghost7.Scale, Ghost7.Scale, Weight);
-
-	PerViewData->Ghost8.Color = FMath::Lerp(PerViewData->Ghost8.Color, Ghost8.Color, Weight);
-	PerViewData->Ghost8.Scale = FMath::Lerp(PerViewData->Ghost8.Scale, Ghost8.Scale, Weight);
+	// Ghosts that only one side has fade in or out through their alpha
+	const int32 NumGhosts = FMath::Max(PerViewData->Ghosts.Num(), Ghosts.Num());
+	for (int32 GhostIndex = PerViewData->Ghosts.Num(); GhostIndex < NumGhosts; ++GhostIndex)
+	{
+		FLensFlareGhostSettings& NewGhost = PerViewData->Ghosts.Add_GetRef(Ghosts[GhostIndex]);
+		NewGhost.Color.A = 0.0f;
+	}
+
+	for (int32 GhostIndex = 0; GhostIndex < NumGhosts; ++GhostIndex)
+	{
+		FLensFlareGhostSettings& Ghost = PerViewData->Ghosts[GhostIndex];
+		FLensFlareGhostSettings TargetGhost = Ghost;
+		if (Ghosts.IsValidIndex(GhostIndex))
+		{
+			TargetGhost = Ghosts[GhostIndex];
+		}
+		else
+		{
+			TargetGhost.Color.A = 0.0f;
+		}
+
+		Ghost.Color = FMath::Lerp(Ghost.Color, TargetGhost.Color, Weight);
+		Ghost.Scale = FMath::Lerp(Ghost.Scale, TargetGhost.Scale, Weight);
+	}
+
+	// Can't be blended, switches halfway through
+	if (Weight >= 0.5f)
+	{
+		PerViewData->GhostMode = GhostMode;
+		PerViewData->GhostSpriteTexture = GhostSpriteTexture;
+	}
+
+	PerViewData->GhostSpriteSize = FMath::Lerp(PerViewData->GhostSpriteSize, GhostSpriteSize, Weight);
 
 	PerViewData->HaloIntensity = FMath::Lerp(PerViewData->HaloIntensity, HaloIntensity, Weight);
 
@@ -63,6 +99,13 @@ void UCustomLensFlareConfig::OverrideBlendableSettings(class FSceneView& View, f
 
 	PerViewData->HaloChromaShift = FMath::Lerp(PerViewData->HaloChromaShift, HaloChromaShift, Weight);
 
+	// Can't be blended, switches halfway through
+	if (Weight >= 0.5f)
+	{
+		PerViewData->GlareMode = GlareMode;
+		PerViewData->StreakAxis = StreakAxis;
+	}
+
 	PerViewData->GlareIntensity = FMath::Lerp(PerViewData->GlareIntensity, GlareIntensity, Weight);
 
 	PerViewData->GlareDivider = FMath::Lerp(PerViewData->GlareDivider, GlareDivider, Weight);
@@ -75,7 +118,55 @@ void UCustomLensFlareConfig::OverrideBlendableSettings(class FSceneView& View, f
 
 	PerViewData->GlareLineMask = GlareLineMask; // todo: respect weight
 
+	PerViewData->StreakStretch = FMath::Lerp(PerViewData->StreakStretch, StreakStretch, Weight);
+
 	PerViewData->FlareTint = FMath::Lerp(PerViewData->FlareTint, FlareTint, Weight);
 
 	PerViewData->FlareIntensity = FMath::Lerp(PerViewData->FlareIntensity, FlareIntensity, Weight);
 }
+
+void UCustomLensFlareConfig::Serialize(FArchive& Ar)
+{
+	Ar.UsingCustomVersion(FCustomLensFlareConfigVersion::GUID);
+	Super::Serialize(Ar);
+}
+
+void UCustomLensFlareConfig::PostLoad()
+{
+	Super::PostLoad();
+
+#if WITH_EDITORONLY_DATA
+	if (GetLinkerCustomVersion(FCustomLensFlareConfigVersion::GUID) < FCustomLensFlareConfigVersion::GhostArray)
+	{
+		Ghosts = {Ghost1, Ghost2, Ghost3, Ghost4, Ghost5, Ghost6, Ghost7, Ghost8};
+	}
+#endif
+}
+
+#if WITH_EDITOR
+void UCustomLensFlareConfig::PostEditChangeProperty(struct FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+
+	if (const TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtension = FCustomLensFlareModule::GetSceneViewExtension())
+	{
+		SceneViewExtension->NotifyConfigChanged(this);
+	}
+}
+
+void UCustomLensFlareConfig::PreviewAsBaseConfig()
+{
+	if (const TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtension = FCustomLensFlareModule::GetSceneViewExtension())
+	{
+		SceneViewExtension->SetBaseConfig(this);
+	}
+}
+
+void UCustomLensFlareConfig::ResetBaseConfigPreview()
+{
+	if (const TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtension = FCustomLensFlareModule::GetSceneViewExtension())
+	{
+		SceneViewExtension->ResetBaseConfig();
+	}
+}
+#endif
@@ -0,0 +1,258 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#include "CustomLensFlareFrameCache.h"
+
+#include "CustomLensFlarePSOPrecache.h"
+#include "GlobalShader.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "RHIGPUReadback.h"
+#include "SceneRendering.h"
+#include "ShaderParameterStruct.h"
+
+TAutoConsoleVariable<int32> CVarLensFlareStaticReuse(
+	TEXT("r.LensFlare.StaticReuse"),
+	0,
+	TEXT(" 0: Render the bloom and flares every frame\n")
+	TEXT(" 1: Reuse the output of the previous frame while the scene color of a view doesn't change and the lens flare settings stay the same.\n")
+	TEXT("    Only for views with a view state and when the plugin renders the bloom itself.\n")
+	TEXT("    Changes are noticed a few frames late, so rather turn this on for pause menus, photo modes and the like than for gameplay."),
+	ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlareStaticReuseFrames(
+	TEXT("r.LensFlare.StaticReuse.Frames"),
+	2,
+	TEXT("Frames in a row that have to match before the output is reused."),
+	ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<float> CVarLensFlareStaticReuseTolerance(
+	TEXT("r.LensFlare.StaticReuse.Tolerance"),
+	0.01f,
+	TEXT("Relative luminance change of any part of the screen that still counts as the same frame."),
+	ECVF_RenderThreadSafe
+	);
+
+namespace
+{
+	// Cells per side of the signature, one group of SIGNATURE_TAPS x SIGNATURE_TAPS taps each
+	constexpr int32 SignatureSize = 32;
+
+	// Readbacks per view. If the GPU is further behind than that, frames aren't compared until one is free again.
+	constexpr int32 MaxPendingReadbacks = 4;
+
+	// Views that weren't rendered for this many frames are dropped
+	constexpr uint64 MaxIdleFrames = 60;
+
+	// Any console variable can change the look, so those are treated like a change of the parameters
+	std::atomic<uint32> GConsoleVariableGeneration = 0;
+
+	FAutoConsoleVariableSink LensFlareStaticReuseSink(FConsoleCommandDelegate::CreateLambda([]()
+	{
+		++GConsoleVariableGeneration;
+	}));
+
+	class FLensFlareFrameSignatureCS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareFrameSignatureCS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareFrameSignatureCS, FGlobalShader);
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, InputTexture)
+			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
+			SHADER_PARAMETER_STRUCT(FScreenPassTextureViewportParameters, Input)
+			SHADER_PARAMETER(FUintVector2, SignatureSize)
+			SHADER_PARAMETER(float, ThresholdLevel)
+			SHADER_PARAMETER(float, ThresholdRange)
+			SHADER_PARAMETER(float, MinLuminance)
+			SHADER_PARAMETER(uint32, UpdateSignature)
+			SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<float4>, EyeAdaptationBuffer)
+			SHADER_PARAMETER(float, ExposureScale)
+			SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<FVector2f>, RWSignature)
+			SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, RWDifference)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+		}
+	};
+
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareFrameSignatureCS, "/Plugin/CustomLensFlare/FrameSignature.usf", "FrameSignatureCS", SF_Compute);
+
+	void CollectFrameCachePSOs(ERHIFeatureLevel::Type FeatureLevel, FCustomLensFlarePSOCollection& OutCollection)
+	{
+		const FGlobalShaderMap* ShaderMap = GetGlobalShaderMap(FeatureLevel);
+		if (!ShaderMap || FeatureLevel < ERHIFeatureLevel::SM5)
+			return;
+
+		OutCollection.AddCompute(TEXT("LensFlareFrameSignature"), TShaderMapRef<FLensFlareFrameSignatureCS>(ShaderMap).GetComputeShader());
+	}
+
+	FCustomLensFlarePSOPrecache::FRegisterCollector RegisterFrameCachePSOCollector(&CollectFrameCachePSOs);
+}
+
+FCustomLensFlareFrameCache::FCustomLensFlareFrameCache() = default;
+
+FCustomLensFlareFrameCache::~FCustomLensFlareFrameCache() = default;
+
+bool FCustomLensFlareFrameCache::IsEnabled()
+{
+	return CVarLensFlareStaticReuse.GetValueOnRenderThread() != 0;
+}
+
+FScreenPassTexture FCustomLensFlareFrameCache::FindStaticOutput(FRDGBuilder& GraphBuilder, const FViewInfo& View, const FScreenPassTextureSlice& SceneColor, uint32 ParameterHash, float ThresholdRange, FRDGBufferSRVRef ExposureBuffer, float ExposureScale)
+{
+	check(IsInRenderingThread());
+
+	FViewEntry* Entry = FindOrAddEntry(View);
+	if (!Entry)
+		return {};
+
+	ParameterHash = HashCombine(ParameterHash, GConsoleVariableGeneration.load());
+	if (Entry->ParameterHash != ParameterHash || Entry->ViewRect != SceneColor.ViewRect)
+	{
+		ResetEntry(*Entry);
+		Entry->ParameterHash = ParameterHash;
+		Entry->ViewRect = SceneColor.ViewRect;
+	}
+
+	ReadDifferences(*Entry);
+
+	const bool bReuse = Entry->Output.IsValid() && Entry->StaticFrames >= FMath::Max(CVarLensFlareStaticReuseFrames.GetValueOnRenderThread(), 1);
+
+	// Compare this frame, unless the GPU is so far behind that all readbacks are still in flight
+	if (Entry->PendingReadbacks.Num() < MaxPendingReadbacks)
+	{
+		const bool bHasSignature = Entry->Signature.IsValid();
+		FRDGBufferRef SignatureBuffer = bHasSignature
+			? GraphBuilder.RegisterExternalBuffer(Entry->Signature)
+			: GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateStructuredDesc(sizeof(FVector2f), SignatureSize * SignatureSize), TEXT("LensFlareFrameSignature"));
+
+		FRDGBufferRef DifferenceBuffer = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateBufferDesc(sizeof(uint32), 1), TEXT("LensFlareFrameDifference"));
+		FRDGBufferUAVRef DifferenceUAV = GraphBuilder.CreateUAV(DifferenceBuffer, PF_R32_UINT);
+		// Without a previous signature the frame can't match
+		AddClearUAVPass(GraphBuilder, DifferenceUAV, bHasSignature ? 0u : 0x7F7FFFFFu);
+
+		FLensFlareFrameSignatureCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareFrameSignatureCS::FParameters>();
+		PassParameters->InputTexture = SceneColor.TextureSRV;
+		PassParameters->InputSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+		PassParameters->Input = GetScreenPassTextureViewportParameters(FScreenPassTextureViewport(SceneColor));
+		PassParameters->SignatureSize = FUintVector2(SignatureSize, SignatureSize);
+		PassParameters->ThresholdLevel = View.FinalPostProcessSettings.BloomThreshold;
+		PassParameters->ThresholdRange = ThresholdRange;
+		PassParameters->MinLuminance = 0.01f;
+		PassParameters->UpdateSignature = bReuse ? 0 : 1;
+		PassParameters->EyeAdaptationBuffer = ExposureBuffer;
+		PassParameters->ExposureScale = ExposureScale;
+		PassParameters->RWSignature = GraphBuilder.CreateUAV(SignatureBuffer);
+		PassParameters->RWDifference = DifferenceUAV;
+
+		TShaderMapRef<FLensFlareFrameSignatureCS> ComputeShader(View.ShaderMap);
+		FCustomLensFlarePSOPrecache::ValidatePrecached(ComputeShader.GetComputeShader(), TEXT("LensFlareFrameSignature"));
+
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("LensFlareFrameSignature %dx%d", SignatureSize, SignatureSize),
+			ComputeShader,
+			PassParameters,
+			FIntVector(SignatureSize, SignatureSize, 1));
+
+		TUniquePtr<FRHIGPUBufferReadback> Readback = Entry->FreeReadbacks.IsEmpty()
+			? MakeUnique<FRHIGPUBufferReadback>(TEXT("LensFlareFrameDifference"))
+			: Entry->FreeReadbacks.Pop(EAllowShrinking::No);
+		AddEnqueueCopyPass(GraphBuilder, Readback.Get(), DifferenceBuffer, sizeof(uint32));
+		Entry->PendingReadbacks.Add(MoveTemp(Readback));
+
+		if (!bHasSignature)
+		{
+			Entry->Signature = GraphBuilder.ConvertToExternalBuffer(SignatureBuffer);
+		}
+	}
+
+	if (bReuse)
+	{
+		return FScreenPassTexture(GraphBuilder.RegisterExternalTexture(Entry->Output), Entry->OutputRect);
+	}
+
+	return {};
+}
+
+void FCustomLensFlareFrameCache::StoreOutput(FRDGBuilder& GraphBuilder, const FViewInfo& View, const FScreenPassTexture& Output)
+{
+	check(IsInRenderingThread());
+
+	FViewEntry* Entry = FindOrAddEntry(View);
+	if (!Entry || !Output.IsValid())
+		return;
+
+	// While the view keeps changing, the output is dropped at the end of the frame like any other target
+	if (Entry->StaticFrames == 0)
+	{
+		Entry->Output.SafeRelease();
+		return;
+	}
+
+	Entry->Output = GraphBuilder.ConvertToExternalTexture(Output.Texture);
+	Entry->OutputRect = Output.ViewRect;
+}
+
+FCustomLensFlareFrameCache::FViewEntry* FCustomLensFlareFrameCache::FindOrAddEntry(const FViewInfo& View)
+{
+	// Views without a state can't be told apart from one frame to the next
+	if (!View.ViewState)
+		return nullptr;
+
+	const uint32 ViewKey = View.ViewState->GetViewKey();
+
+	// Closed viewports and finished captures
+	Entries.RemoveAllSwap([](const FViewEntry& Entry)
+	{
+		return Entry.LastUsedFrame + MaxIdleFrames < GFrameCounterRenderThread;
+	}, EAllowShrinking::No);
+
+	FViewEntry* Entry = Entries.FindByPredicate([ViewKey](const FViewEntry& Candidate) { return Candidate.ViewKey == ViewKey; });
+	if (!Entry)
+	{
+		Entry = &Entries.AddDefaulted_GetRef();
+		Entry->ViewKey = ViewKey;
+	}
+
+	Entry->LastUsedFrame = GFrameCounterRenderThread;
+	return Entry;
+}
+
+void FCustomLensFlareFrameCache::ReadDifferences(FViewEntry& Entry)
+{
+	const float Tolerance = FMath::Max(CVarLensFlareStaticReuseTolerance.GetValueOnRenderThread(), 0.0f);
+
+	while (!Entry.PendingReadbacks.IsEmpty() && Entry.PendingReadbacks[0]->IsReady())
+	{
+		TUniquePtr<FRHIGPUBufferReadback> Readback = MoveTemp(Entry.PendingReadbacks[0]);
+		Entry.PendingReadbacks.RemoveAt(0, EAllowShrinking::No);
+
+		const float Difference = *static_cast<const float*>(Readback->Lock(sizeof(float)));
+		Readback->Unlock();
+
+		if (Difference <= Tolerance)
+		{
+			++Entry.StaticFrames;
+		}
+		else
+		{
+			Entry.StaticFrames = 0;
+			Entry.Output.SafeRelease();
+		}
+
+		Entry.FreeReadbacks.Add(MoveTemp(Readback));
+	}
+}
+
+void FCustomLensFlareFrameCache::ResetEntry(FViewEntry& Entry)
+{
+	// The readbacks in flight still tell whether scene color changed, only the output is stale
+	Entry.StaticFrames = 0;
+	Entry.Output.SafeRelease();
+}
@@ -0,0 +1,75 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RenderGraphResources.h"
+#include "ScreenPass.h"
+
+class FRHIGPUBufferReadback;
+class FViewInfo;
+
+/**
+ * Output of the bloom and flare chain of views whose image doesn't change, e.g. pause menus, photo mode or cinematic holds.
+ * Every frame a coarse signature of the thresholded scene color is compared to the previous one on the GPU.
+ * The difference comes back through a readback, so a view is only considered static once a few frames in a row matched,
+ * and a change is noticed within the latency of the readback.
+ * Render thread only.
+ */
+class FCustomLensFlareFrameCache
+{
+public:
+	FCustomLensFlareFrameCache();
+	~FCustomLensFlareFrameCache();
+
+	/**
+	 * Queues the comparison of this frame and returns the cached output if the view has been static for long enough
+	 * and was rendered with the same ParameterHash. Invalid if the chain has to run, pass its output to StoreOutput() then.
+	 */
+	FScreenPassTexture FindStaticOutput(
+		FRDGBuilder& GraphBuilder,
+		const FViewInfo& View,
+		const FScreenPassTextureSlice& SceneColor,
+		uint32 ParameterHash,
+		float ThresholdRange,
+		FRDGBufferSRVRef ExposureBuffer,
+		float ExposureScale);
+
+	/** Keeps the output of a frame that was fully rendered, as long as the view looks like it is becoming static. */
+	void StoreOutput(FRDGBuilder& GraphBuilder, const FViewInfo& View, const FScreenPassTexture& Output);
+
+	/** See r.LensFlare.StaticReuse */
+	static bool IsEnabled();
+
+private:
+	struct FViewEntry
+	{
+		uint32 ViewKey = 0;
+		uint64 LastUsedFrame = 0;
+		uint32 ParameterHash = 0;
+		FIntRect ViewRect;
+
+		// Signature of the last compared frame
+		TRefCountPtr<FRDGPooledBuffer> Signature;
+
+		// Differences in flight, oldest first
+		TArray<TUniquePtr<FRHIGPUBufferReadback>> PendingReadbacks;
+		TArray<TUniquePtr<FRHIGPUBufferReadback>> FreeReadbacks;
+
+		// Frames in a row that were read back without a difference
+		int32 StaticFrames = 0;
+
+		TRefCountPtr<IPooledRenderTarget> Output;
+		FIntRect OutputRect;
+	};
+
+	FViewEntry* FindOrAddEntry(const FViewInfo& View);
+
+	/** Reads every difference that has arrived since the last frame */
+	static void ReadDifferences(FViewEntry& Entry);
+
+	/** Starts over after the parameters or the viewport changed */
+	static void ResetEntry(FViewEntry& Entry);
+
+	TArray<FViewEntry> Entries;
+};
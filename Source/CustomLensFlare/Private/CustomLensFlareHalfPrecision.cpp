@@ -0,0 +1,224 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#include "CustomLensFlareHalfPrecision.h"
+
+#include "DataDrivenShaderPlatformInfo.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "RHIGlobals.h"
+#include "RHIGPUReadback.h"
+#include "SceneRendering.h"
+#include "ShaderCompilerCore.h"
+#include "ShaderPlatformCachedIniValue.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogCustomLensFlareHalfPrecision, Log, All);
+
+TAutoConsoleVariable<int32> CVarLensFlareHalfPrecision(
+	TEXT("r.LensFlare.HalfPrecision"),
+	0,
+	TEXT(" 0: 32 bit math in all lens flare shaders\n")
+	TEXT(" 1: Colors, masks and weights of the bloom, flare, glare, blur and mix shaders in 16 bit where the platform supports it natively.\n")
+	TEXT("    Read per platform when compiling shaders, so set it in the [ConsoleVariables] of the platform's Engine.ini rather than at runtime."),
+	ECVF_RenderThreadSafe | ECVF_ReadOnly
+	);
+
+TAutoConsoleVariable<float> CVarLensFlareHalfPrecisionErrorBudget(
+	TEXT("r.LensFlare.HalfPrecision.ErrorBudget"),
+	0.01f,
+	TEXT("Mean relative difference of the 16 bit output to the 32 bit one that r.LensFlare.HalfPrecision.Check accepts."),
+	ECVF_RenderThreadSafe
+	);
+
+namespace
+{
+	// Differences are relative to at least this fraction of the brightest reference pixel, so near black noise doesn't count
+	constexpr float ErrorFloor = 1.0f / 256.0f;
+
+	const TCHAR* const CheckTextureName = TEXT("LensFlareHalfPrecisionCheck");
+
+	FAutoConsoleCommand LensFlareHalfPrecisionCheckCommand(
+		TEXT("r.LensFlare.HalfPrecision.Check"),
+		TEXT("Renders the next view with the 32 bit and the 16 bit lens flare shaders and logs how far the outputs are apart.\n")
+		TEXT("Fails if the mean relative difference is above r.LensFlare.HalfPrecision.ErrorBudget or any pixel isn't finite."),
+		FConsoleCommandDelegate::CreateLambda([]()
+		{
+			ENQUEUE_RENDER_COMMAND(CheckCustomLensFlareHalfPrecision)([](FRHICommandListImmediate&)
+			{
+				FCustomLensFlareHalfPrecision::Get().RequestCheck();
+			});
+		})
+		);
+}
+
+FCustomLensFlareHalfPrecision& FCustomLensFlareHalfPrecision::Get()
+{
+	check(IsInRenderingThread());
+	static FCustomLensFlareHalfPrecision HalfPrecision;
+	return HalfPrecision;
+}
+
+bool FCustomLensFlareHalfPrecision::ShouldCompilePermutation(EShaderPlatform Platform)
+{
+	static FShaderPlatformCachedIniValue<int32> HalfPrecisionIniValue(TEXT("r.LensFlare.HalfPrecision"));
+	return FDataDrivenShaderPlatformInfo::GetSupportsRealTypes(Platform) != ERHIFeatureSupport::Unsupported
+		&& HalfPrecisionIniValue.Get(Platform) != 0;
+}
+
+void FCustomLensFlareHalfPrecision::ModifyCompilationEnvironment(bool bHalfPrecision, FShaderCompilerEnvironment& OutEnvironment)
+{
+	if (bHalfPrecision)
+	{
+		OutEnvironment.CompilerFlags.Add(CFLAG_AllowRealTypes);
+	}
+}
+
+bool FCustomLensFlareHalfPrecision::IsSupported(EShaderPlatform Platform)
+{
+	// The ini of the platform can have the permutations off while the cvar is set at runtime
+	if (CVarLensFlareHalfPrecision.GetValueOnAnyThread() == 0 || !ShouldCompilePermutation(Platform))
+		return false;
+
+	switch (FDataDrivenShaderPlatformInfo::GetSupportsRealTypes(Platform))
+	{
+	case ERHIFeatureSupport::RuntimeGuaranteed:
+		return true;
+	case ERHIFeatureSupport::RuntimeDependent:
+		return GRHIGlobals.SupportsNative16BitOps;
+	default:
+		return false;
+	}
+}
+
+void FCustomLensFlareHalfPrecision::Tick()
+{
+	for (int32 Index = 0; Index < PendingChecks.Num();)
+	{
+		FPendingCheck& PendingCheck = PendingChecks[Index];
+		if (!PendingCheck.Readbacks[0]->IsReady() || !PendingCheck.Readbacks[1]->IsReady())
+		{
+			++Index;
+			continue;
+		}
+
+		CompareOutputs(PendingCheck);
+		PendingChecks.RemoveAt(Index);
+	}
+}
+
+FScreenPassTexture FCustomLensFlareHalfPrecision::Check(FRDGBuilder& GraphBuilder, const FViewInfo& View, TFunctionRef<FScreenPassTexture()> RenderFunction)
+{
+	if (!bCheckRequested || IsChecking())
+		return {};
+
+	bCheckRequested = false;
+	const EShaderPlatform Platform = View.GetShaderPlatform();
+	if (!IsSupported(Platform))
+	{
+		UE_LOG(LogCustomLensFlareHalfPrecision, Display, TEXT("Nothing to check, %s doesn't use the 16 bit lens flare shaders. See r.LensFlare.HalfPrecision."),
+			*LexToString(Platform));
+		return {};
+	}
+
+	RDG_EVENT_SCOPE(GraphBuilder, "LensFlareHalfPrecisionCheck");
+
+	FPendingCheck PendingCheck;
+	PendingCheck.Platform = Platform;
+	FScreenPassTexture Output;
+	for (int32 Index = 0; Index < 2; ++Index)
+	{
+		ForcedHalfPrecision = Index == 1;
+		Output = RenderFunction();
+		if (!Output.IsValid() || (Index == 1 && Output.ViewRect.Size() != PendingCheck.Size))
+		{
+			ForcedHalfPrecision.Reset();
+			UE_LOG(LogCustomLensFlareHalfPrecision, Warning, TEXT("Can't check, the chain didn't render the same output twice."));
+			return Output;
+		}
+		PendingCheck.Size = Output.ViewRect.Size();
+
+		// Converted to 32 bit so the comparison doesn't have to decode the target format
+		FRDGTextureRef CheckTexture = GraphBuilder.CreateTexture(
+			FRDGTextureDesc::Create2D(PendingCheck.Size, PF_A32B32G32R32F, FClearValueBinding::None, TexCreate_RenderTargetable | TexCreate_ShaderResource),
+			CheckTextureName);
+		AddDrawTexturePass(GraphBuilder, View, Output.Texture, CheckTexture, Output.ViewRect.Min, FIntPoint::ZeroValue, PendingCheck.Size);
+
+		PendingCheck.Readbacks[Index] = MakeUnique<FRHIGPUTextureReadback>(CheckTextureName);
+		AddEnqueueCopyPass(GraphBuilder, PendingCheck.Readbacks[Index].Get(), CheckTexture);
+	}
+	ForcedHalfPrecision.Reset();
+
+	PendingChecks.Add(MoveTemp(PendingCheck));
+	return Output;
+}
+
+void FCustomLensFlareHalfPrecision::CompareOutputs(FPendingCheck& PendingCheck)
+{
+	const FIntPoint Size = PendingCheck.Size;
+	const int32 PixelCount = Size.X * Size.Y;
+
+	TArray<FLinearColor> Pixels[2];
+	for (int32 Index = 0; Index < 2; ++Index)
+	{
+		Pixels[Index].SetNumUninitialized(PixelCount);
+
+		int32 RowPitchInPixels = 0;
+		const FLinearColor* Data = static_cast<const FLinearColor*>(PendingCheck.Readbacks[Index]->Lock(RowPitchInPixels));
+		for (int32 Y = 0; Y < Size.Y; ++Y)
+		{
+			FMemory::Memcpy(&Pixels[Index][Y * Size.X], Data + int64(Y) * RowPitchInPixels, Size.X * sizeof(FLinearColor));
+		}
+		PendingCheck.Readbacks[Index]->Unlock();
+	}
+
+	float Peak = 0.0f;
+	for (const FLinearColor& Reference : Pixels[0])
+	{
+		Peak = FMath::Max(Peak, FVector3f(Reference.R, Reference.G, Reference.B).GetAbsMax());
+	}
+	const float Floor = FMath::Max(Peak * ErrorFloor, UE_SMALL_NUMBER);
+
+	// Largest relative difference of the color channels of every pixel
+	TArray<float> Errors;
+	Errors.SetNumUninitialized(PixelCount);
+	double ErrorSum = 0.0;
+	int32 NonFinitePixels = 0;
+	int32 MaxErrorPixel = 0;
+	for (int32 PixelIndex = 0; PixelIndex < PixelCount; ++PixelIndex)
+	{
+		const FLinearColor& Reference = Pixels[0][PixelIndex];
+		const FLinearColor& Half = Pixels[1][PixelIndex];
+
+		float Error = 0.0f;
+		for (int32 Channel = 0; Channel < 3; ++Channel)
+		{
+			if (!FMath::IsFinite(Half.Component(Channel)))
+			{
+				++NonFinitePixels;
+				Error = 0.0f;
+				break;
+			}
+			Error = FMath::Max(Error, FMath::Abs(Half.Component(Channel) - Reference.Component(Channel)) / FMath::Max(FMath::Abs(Reference.Component(Channel)), Floor));
+		}
+
+		Errors[PixelIndex] = Error;
+		ErrorSum += Error;
+		if (Error > Errors[MaxErrorPixel])
+		{
+			MaxErrorPixel = PixelIndex;
+		}
+	}
+
+	const float MaxError = Errors[MaxErrorPixel];
+	const float MeanError = float(ErrorSum / FMath::Max(PixelCount, 1));
+	Errors.Sort();
+	const float PercentileError = Errors[FMath::Min(int32(PixelCount * 0.99f), PixelCount - 1)];
+
+	const float ErrorBudget = CVarLensFlareHalfPrecisionErrorBudget.GetValueOnRenderThread();
+	const bool bWithinBudget = MeanError <= ErrorBudget && NonFinitePixels == 0;
+	UE_LOG(LogCustomLensFlareHalfPrecision, Display,
+		TEXT("%s %dx%d: Mean relative difference %.5f, 99th percentile %.5f, max %.5f at (%d, %d), %d pixels not finite. %s the budget of %.5f."),
+		*LexToString(PendingCheck.Platform), Size.X, Size.Y,
+		MeanError, PercentileError, MaxError, MaxErrorPixel % Size.X, MaxErrorPixel / Size.X, NonFinitePixels,
+		bWithinBudget ? TEXT("Within") : TEXT("Exceeds"), ErrorBudget);
+	UE_CLOG(!bWithinBudget, LogCustomLensFlareHalfPrecision, Warning, TEXT("The 16 bit lens flare shaders are off by more than r.LensFlare.HalfPrecision.ErrorBudget."));
+}
@@ -0,0 +1,69 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHIDefinitions.h"
+#include "ScreenPass.h"
+
+class FRHIGPUTextureReadback;
+class FShaderCompilerEnvironment;
+class FViewInfo;
+
+/**
+ * 16 bit color math in the bloom and flare shaders, see r.LensFlare.HalfPrecision.
+ * The HALF_PRECISION permutations are only compiled for platforms that enable it in their config and have 16 bit types,
+ * and only used where the RHI runs 16 bit math natively.
+ *
+ * r.LensFlare.HalfPrecision.Check renders the next view with the 32 bit and the 16 bit shaders, reads both outputs back
+ * and compares them on the CPU against r.LensFlare.HalfPrecision.ErrorBudget.
+ * Only when the plugin renders the bloom itself, not in r.PostProcessing.CustomBloomFlareMode 2.
+ * Render thread only, apart from the console command and the static functions.
+ */
+class FCustomLensFlareHalfPrecision
+{
+public:
+	static FCustomLensFlareHalfPrecision& Get();
+
+	/** Whether the HALF_PRECISION permutations are compiled for the platform */
+	static bool ShouldCompilePermutation(EShaderPlatform Platform);
+
+	/** Lets the compiler emit 16 bit types for the HALF_PRECISION permutations */
+	static void ModifyCompilationEnvironment(bool bHalfPrecision, FShaderCompilerEnvironment& OutEnvironment);
+
+	/** Whether views on the platform use the HALF_PRECISION permutations outside of a check */
+	static bool IsSupported(EShaderPlatform Platform);
+
+	/** Whether the passes of a view use the HALF_PRECISION permutations. Switches between both while checking. */
+	bool IsEnabled(EShaderPlatform Platform) const { return ForcedHalfPrecision.Get(IsSupported(Platform)); }
+
+	/** Called by the console command through the render thread */
+	void RequestCheck() { bCheckRequested = true; }
+
+	/** Compares the outputs whose readbacks have arrived. Once per hook call. */
+	void Tick();
+
+	/**
+	 * If a check was requested, calls RenderFunction with the 32 bit and then with the 16 bit permutations in effect,
+	 * queues the readback of both outputs and returns the 16 bit one. RenderFunction must not reuse earlier output.
+	 * Returns an invalid texture without a check, the caller renders as usual then.
+	 */
+	FScreenPassTexture Check(FRDGBuilder& GraphBuilder, const FViewInfo& View, TFunctionRef<FScreenPassTexture()> RenderFunction);
+
+	bool IsChecking() const { return ForcedHalfPrecision.IsSet(); }
+
+private:
+	struct FPendingCheck
+	{
+		// 32 bit output first, RGBA32F
+		TUniquePtr<FRHIGPUTextureReadback> Readbacks[2];
+		FIntPoint Size;
+		EShaderPlatform Platform = SP_NumPlatforms;
+	};
+
+	static void CompareOutputs(FPendingCheck& PendingCheck);
+
+	bool bCheckRequested = false;
+	TOptional<bool> ForcedHalfPrecision;
+	TArray<FPendingCheck> PendingChecks;
+};
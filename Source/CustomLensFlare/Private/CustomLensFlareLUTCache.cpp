@@ -0,0 +1,232 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#include "CustomLensFlareLUTCache.h"
+
+#include "CustomLensFlarePSOPrecache.h"
+#include "GlobalShader.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "ShaderParameterStruct.h"
+
+TAutoConsoleVariable<int32> CVarLensFlareLUT(
+	TEXT("r.LensFlare.LUT"),
+	1,
+	TEXT(" 0: Evaluate the halo distortion and ghost masks per pixel\n")
+	TEXT(" 1: Bake them into lookup textures whenever their parameters change"),
+	ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlareLUTResolution(
+	TEXT("r.LensFlare.LUT.Resolution"),
+	256,
+	TEXT("Resolution of the halo lookup texture and width of the ghost mask lookup texture."),
+	ECVF_RenderThreadSafe
+	);
+
+namespace
+{
+	constexpr int32 MaxCachedLUTs = 4;
+
+	class FBakeHaloLUTCS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FBakeHaloLUTCS);
+		SHADER_USE_PARAMETER_STRUCT(FBakeHaloLUTCS, FGlobalShader);
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float4>, RWHaloLUT)
+			SHADER_PARAMETER(FVector2f, LUTInvSize)
+			SHADER_PARAMETER(float, Width)
+			SHADER_PARAMETER(float, Mask)
+			SHADER_PARAMETER(float, Compression)
+			SHADER_PARAMETER(float, ChromaShift)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+		}
+	};
+
+	IMPLEMENT_GLOBAL_SHADER(FBakeHaloLUTCS, "/Plugin/CustomLensFlare/Halo.usf", "BakeHaloLUTCS", SF_Compute);
+
+	class FBakeGhostMaskLUTCS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FBakeGhostMaskLUTCS);
+		SHADER_USE_PARAMETER_STRUCT(FBakeGhostMaskLUTCS, FGlobalShader);
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float>, RWGhostMaskLUT)
+			SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<float>, GhostScales)
+			SHADER_PARAMETER(FUintVector2, LUTSize)
+			SHADER_PARAMETER(FVector2f, LUTInvSize)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+		}
+	};
+
+	IMPLEMENT_GLOBAL_SHADER(FBakeGhostMaskLUTCS, "/Plugin/CustomLensFlare/Ghosts.usf", "BakeGhostMaskLUTCS", SF_Compute);
+
+	void CollectLUTBakePSOs(ERHIFeatureLevel::Type FeatureLevel, FCustomLensFlarePSOCollection& OutCollection)
+	{
+		const FGlobalShaderMap* ShaderMap = GetGlobalShaderMap(FeatureLevel);
+		if (!ShaderMap || FeatureLevel < ERHIFeatureLevel::SM5)
+			return;
+
+		OutCollection.AddCompute(TEXT("BakeHaloLUT"), TShaderMapRef<FBakeHaloLUTCS>(ShaderMap).GetComputeShader());
+		OutCollection.AddCompute(TEXT("BakeGhostMaskLUT"), TShaderMapRef<FBakeGhostMaskLUTCS>(ShaderMap).GetComputeShader());
+	}
+
+	FCustomLensFlarePSOPrecache::FRegisterCollector RegisterLUTBakePSOCollector(&CollectLUTBakePSOs);
+
+	int32 GetLUTResolution()
+	{
+		return FMath::Clamp(CVarLensFlareLUTResolution.GetValueOnRenderThread(), 16, 1024);
+	}
+}
+
+bool FCustomLensFlareLUTCache::IsEnabled()
+{
+	return CVarLensFlareLUT.GetValueOnRenderThread() != 0;
+}
+
+FRDGTextureRef FCustomLensFlareLUTCache::GetHaloLUT(FRDGBuilder& GraphBuilder, const FGlobalShaderMap* ShaderMap, float Compression, float Width, float Mask, float ChromaShift)
+{
+	check(IsInRenderingThread());
+
+	const int32 Resolution = GetLUTResolution();
+
+	FParameters Parameters = {float(Resolution), Compression, Width, Mask, ChromaShift};
+	if (FRDGTextureRef CachedTexture = FindEntry(GraphBuilder, HaloEntries, Parameters))
+		return CachedTexture;
+
+	// Half float is enough for the masks and keeps the UVs within a fraction of a texel of the bloom texture,
+	// and unlike full float it can be filtered on every RHI
+	const FRDGTextureDesc Description = FRDGTextureDesc::Create2D(
+		FIntPoint(Resolution, Resolution),
+		PF_FloatRGBA,
+		FClearValueBinding::None,
+		TexCreate_ShaderResource | TexCreate_UAV);
+	FRDGTextureRef Texture = GraphBuilder.CreateTexture(Description, TEXT("LensFlareHaloLUT"));
+
+	FBakeHaloLUTCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FBakeHaloLUTCS::FParameters>();
+	PassParameters->RWHaloLUT = GraphBuilder.CreateUAV(Texture);
+	PassParameters->LUTInvSize = FVector2f(1.0f / Resolution, 1.0f / Resolution);
+	PassParameters->Width = Width;
+	PassParameters->Mask = Mask;
+	PassParameters->Compression = Compression;
+	PassParameters->ChromaShift = ChromaShift;
+
+	TShaderMapRef<FBakeHaloLUTCS> ComputeShader(ShaderMap);
+	FCustomLensFlarePSOPrecache::ValidatePrecached(ComputeShader.GetComputeShader(), TEXT("BakeHaloLUT"));
+
+	FComputeShaderUtils::AddPass(
+		GraphBuilder,
+		RDG_EVENT_NAME("BakeHaloLUT %dx%d", Resolution, Resolution),
+		ComputeShader,
+		PassParameters,
+		FComputeShaderUtils::GetGroupCount(FIntPoint(Resolution, Resolution), FIntPoint(8, 8)));
+
+	AddEntry(GraphBuilder, HaloEntries, MoveTemp(Parameters), Texture);
+	return Texture;
+}
+
+FRDGTextureRef FCustomLensFlareLUTCache::GetGhostMaskLUT(FRDGBuilder& GraphBuilder, const FGlobalShaderMap* ShaderMap, TConstArrayView<float> GhostScales)
+{
+	check(IsInRenderingThread());
+
+	const int32 Resolution = GetLUTResolution();
+
+	// Always at least one row so the LUT can be bound when all ghosts are culled
+	TArray<float, TInlineAllocator<8>> Rows(GhostScales);
+	if (Rows.IsEmpty())
+	{
+		Rows.Add(0.0f);
+	}
+
+	FParameters Parameters = {float(Resolution)};
+	Parameters.Append(Rows);
+	if (FRDGTextureRef CachedTexture = FindEntry(GraphBuilder, GhostMaskEntries, Parameters))
+		return CachedTexture;
+
+	const FIntPoint LUTSize(Resolution, Rows.Num());
+	const FRDGTextureDesc Description = FRDGTextureDesc::Create2D(
+		LUTSize,
+		PF_R16F,
+		FClearValueBinding::None,
+		TexCreate_ShaderResource | TexCreate_UAV);
+	FRDGTextureRef Texture = GraphBuilder.CreateTexture(Description, TEXT("LensFlareGhostMaskLUT"));
+
+	FBakeGhostMaskLUTCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FBakeGhostMaskLUTCS::FParameters>();
+	PassParameters->RWGhostMaskLUT = GraphBuilder.CreateUAV(Texture);
+	PassParameters->GhostScales = GraphBuilder.CreateSRV(CreateStructuredBuffer(GraphBuilder, TEXT("LensFlareGhostScales"), Rows));
+	PassParameters->LUTSize = FUintVector2(LUTSize.X, LUTSize.Y);
+	PassParameters->LUTInvSize = FVector2f(1.0f / LUTSize.X, 1.0f / LUTSize.Y);
+
+	TShaderMapRef<FBakeGhostMaskLUTCS> ComputeShader(ShaderMap);
+	FCustomLensFlarePSOPrecache::ValidatePrecached(ComputeShader.GetComputeShader(), TEXT("BakeGhostMaskLUT"));
+
+	FComputeShaderUtils::AddPass(
+		GraphBuilder,
+		RDG_EVENT_NAME("BakeGhostMaskLUT %dx%d", LUTSize.X, LUTSize.Y),
+		ComputeShader,
+		PassParameters,
+		FComputeShaderUtils::GetGroupCount(LUTSize, FIntPoint(8, 8)));
+
+	AddEntry(GraphBuilder, GhostMaskEntries, MoveTemp(Parameters), Texture);
+	return Texture;
+}
+
+uint32 FCustomLensFlareLUTCache::GetKey(const FParameters& Parameters)
+{
+	uint32 Key = 0;
+	for (float Parameter : Parameters)
+	{
+		Key = HashCombine(Key, GetTypeHash(Parameter));
+	}
+	return Key;
+}
+
+FRDGTextureRef FCustomLensFlareLUTCache::FindEntry(FRDGBuilder& GraphBuilder, FEntries& Entries, const FParameters& Parameters)
+{
+	const uint32 Key = GetKey(Parameters);
+	for (FEntry& Entry : Entries)
+	{
+		if (Entry.Key == Key && Entry.Parameters == Parameters && Entry.Texture.IsValid())
+		{
+			Entry.LastUsedFrame = GFrameCounterRenderThread;
+			return GraphBuilder.RegisterExternalTexture(Entry.Texture);
+		}
+	}
+	return nullptr;
+}
+
+void FCustomLensFlareLUTCache::AddEntry(FRDGBuilder& GraphBuilder, FEntries& Entries, FParameters&& Parameters, FRDGTextureRef Texture)
+{
+	FEntry* Entry = nullptr;
+	if (Entries.Num() < MaxCachedLUTs)
+	{
+		Entry = &Entries.AddDefaulted_GetRef();
+	}
+	else
+	{
+		// Parameters are animating or many views differ, reuse the slot that has been idle the longest
+		Entry = &Entries[0];
+		for (FEntry& Candidate : Entries)
+		{
+			if (Candidate.LastUsedFrame < Entry->LastUsedFrame)
+			{
+				Entry = &Candidate;
+			}
+		}
+	}
+
+	Entry->Key = GetKey(Parameters);
+	Entry->Parameters = MoveTemp(Parameters);
+	Entry->LastUsedFrame = GFrameCounterRenderThread;
+	Entry->Texture = GraphBuilder.ConvertToExternalTexture(Texture);
+}
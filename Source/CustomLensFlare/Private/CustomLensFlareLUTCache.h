@@ -0,0 +1,51 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RenderGraphResources.h"
+
+class FGlobalShaderMap;
+
+/**
+ * Lookup textures for the parts of the flare pass that only depend on rarely changing parameters.
+ * Baked on demand and keyed by the parameters so views with the same settings share them.
+ * Render thread only.
+ */
+class FCustomLensFlareLUTCache
+{
+public:
+	/** Fisheye UV, chroma offset and masks of the halo. See ComputeHalo() in Halo.usf. */
+	FRDGTextureRef GetHaloLUT(FRDGBuilder& GraphBuilder, const FGlobalShaderMap* ShaderMap, float Compression, float Width, float Mask, float ChromaShift);
+
+	/** Radial masks of the ghosts, one row per ghost in the given order. See GhostMask() in Ghosts.usf. */
+	FRDGTextureRef GetGhostMaskLUT(FRDGBuilder& GraphBuilder, const FGlobalShaderMap* ShaderMap, TConstArrayView<float> GhostScales);
+
+	/** Whether the flare shaders should use the LUT permutations. */
+	static bool IsEnabled();
+
+private:
+	/** The values a LUT is baked from, compared in full so a hash collision can't return the LUT of other parameters */
+	using FParameters = TArray<float, TInlineAllocator<9>>;
+
+	struct FEntry
+	{
+		uint32 Key = 0;
+		FParameters Parameters;
+		uint64 LastUsedFrame = 0;
+		TRefCountPtr<IPooledRenderTarget> Texture;
+	};
+
+	using FEntries = TArray<FEntry, TInlineAllocator<4>>;
+
+	/** Returns the cached texture for the parameters or null. Marks the entry as used. */
+	static FRDGTextureRef FindEntry(FRDGBuilder& GraphBuilder, FEntries& Entries, const FParameters& Parameters);
+
+	/** Stores a freshly baked texture, replacing the least recently used entry if the cache is full. */
+	static void AddEntry(FRDGBuilder& GraphBuilder, FEntries& Entries, FParameters&& Parameters, FRDGTextureRef Texture);
+
+	static uint32 GetKey(const FParameters& Parameters);
+
+	FEntries HaloEntries;
+	FEntries GhostMaskEntries;
+};
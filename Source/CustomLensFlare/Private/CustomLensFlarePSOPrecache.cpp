@@ -0,0 +1,285 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#include "CustomLensFlarePSOPrecache.h"
+
+#include "GlobalShader.h"
+#include "Misc/ScopeRWLock.h"
+#include "PipelineStateCache.h"
+#include "PSOPrecache.h"
+#include "RenderingThread.h"
+#include "SceneTexturesConfig.h"
+#include "CommonRenderResources.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogCustomLensFlarePSO, Log, All);
+
+TAutoConsoleVariable<int32> CVarLensFlarePSOPrewarmOnStartup(
+	TEXT("r.LensFlare.PSOPrecache.PrewarmOnStartup"),
+	0,
+	TEXT(" 0: Only hand the lens flare pipelines to the engine PSO precacher\n")
+	TEXT(" 1: Additionally compile all lens flare pipelines while the module starts up"),
+	ECVF_ReadOnly
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlarePSOValidate(
+	TEXT("r.LensFlare.PSOPrecache.Validate"),
+	1,
+	TEXT("Non shipping builds only. If 1, every pipeline used by a lens flare pass is checked against the precached set."),
+	ECVF_RenderThreadSafe
+	);
+
+namespace
+{
+	TArray<FCustomLensFlarePSOCollectorFunction>& GetCollectors()
+	{
+		static TArray<FCustomLensFlarePSOCollectorFunction> Collectors;
+		return Collectors;
+	}
+
+	// One bit per feature level views have rendered lens flares at
+	std::atomic<uint32> GRenderedFeatureLevels = 0;
+
+	// Hands the lens flare pipelines to the engine so they are compiled together with the global shader PSOs.
+	void CustomLensFlareGlobalPSOCollector(const FSceneTexturesConfig& SceneTexturesConfig, int32 GlobalPSOCollectorIndex, TArray<FPSOPrecacheData>& PSOInitializers)
+	{
+		FCustomLensFlarePSOCollection Collection;
+		FCustomLensFlarePSOPrecache::CollectAll(SceneTexturesConfig.FeatureLevel, Collection);
+
+		for (const FCustomLensFlarePSOCollection::FGraphicsEntry& Entry : Collection.GetGraphicsEntries())
+		{
+			FPSOPrecacheData PSOPrecacheData;
+			PSOPrecacheData.bRequired = true;
+			PSOPrecacheData.Type = FPSOPrecacheData::EType::Graphics;
+			PSOPrecacheData.GraphicsPSOInitializer = Entry.Initializer;
+#if PSO_PRECACHING_VALIDATE
+			PSOPrecacheData.PSOCollectorIndex = GlobalPSOCollectorIndex;
+#endif
+			PSOInitializers.Add(PSOPrecacheData);
+		}
+
+		for (const FCustomLensFlarePSOCollection::FComputeEntry& Entry : Collection.GetComputeEntries())
+		{
+			FPSOPrecacheData PSOPrecacheData;
+			PSOPrecacheData.bRequired = true;
+			PSOPrecacheData.Type = FPSOPrecacheData::EType::Compute;
+			PSOPrecacheData.ComputeShader = Entry.ComputeShader;
+#if PSO_PRECACHING_VALIDATE
+			PSOPrecacheData.PSOCollectorIndex = GlobalPSOCollectorIndex;
+#endif
+			PSOInitializers.Add(PSOPrecacheData);
+		}
+	}
+
+	FRegisterGlobalPSOCollectorFunction RegisterCustomLensFlareGlobalPSOCollector(&CustomLensFlareGlobalPSOCollector, TEXT("CustomLensFlare"));
+
+	FAutoConsoleCommand LensFlarePSODumpCommand(
+		TEXT("r.LensFlare.PSOPrecache.Dump"),
+		TEXT("Lists every pipeline state the lens flare passes can produce."),
+		FConsoleCommandDelegate::CreateLambda([]()
+		{
+			ENQUEUE_RENDER_COMMAND(DumpCustomLensFlarePSOs)([](FRHICommandListImmediate&)
+			{
+				FCustomLensFlarePSOCollection Collection;
+				FCustomLensFlarePSOPrecache::CollectAll(GMaxRHIFeatureLevel, Collection);
+
+				UE_LOG(LogCustomLensFlarePSO, Display, TEXT("%d lens flare graphics pipelines:"), Collection.GetGraphicsEntries().Num());
+				for (const FCustomLensFlarePSOCollection::FGraphicsEntry& Entry : Collection.GetGraphicsEntries())
+				{
+					UE_LOG(LogCustomLensFlarePSO, Display, TEXT("  %-32s %s key=%08x"),
+						Entry.PassName,
+						GetPixelFormatString(EPixelFormat(Entry.Initializer.RenderTargetFormats[0])),
+						FCustomLensFlarePSOPrecache::GetPipelineKey(Entry.Initializer));
+				}
+
+				UE_LOG(LogCustomLensFlarePSO, Display, TEXT("%d lens flare compute pipelines:"), Collection.GetComputeEntries().Num());
+				for (const FCustomLensFlarePSOCollection::FComputeEntry& Entry : Collection.GetComputeEntries())
+				{
+					UE_LOG(LogCustomLensFlarePSO, Display, TEXT("  %s"), Entry.PassName);
+				}
+			});
+		})
+		);
+}
+
+void FCustomLensFlarePSOCollection::AddGraphics(const TCHAR* PassName, const FGraphicsPipelineStateInitializer& Initializer)
+{
+	FGraphicsEntry& Entry = GraphicsEntries.AddDefaulted_GetRef();
+	Entry.PassName = PassName;
+	Entry.Initializer = Initializer;
+	Entry.Initializer.StatePrecachePSOHash = RHIComputeStatePrecachePSOHash(Entry.Initializer);
+}
+
+void FCustomLensFlarePSOCollection::AddCompute(const TCHAR* PassName, FRHIComputeShader* ComputeShader)
+{
+	FComputeEntry& Entry = ComputeEntries.AddDefaulted_GetRef();
+	Entry.PassName = PassName;
+	Entry.ComputeShader = ComputeShader;
+}
+
+void FCustomLensFlarePSOCollection::AddScreenPass(const TCHAR* PassName, FRHIVertexShader* VertexShader, FRHIPixelShader* PixelShader, FRHIBlendState* BlendState, EPixelFormat RenderTargetFormat)
+{
+	AddGraphics(PassName, FCustomLensFlarePSOPrecache::MakeScreenPassInitializer(VertexShader, PixelShader, BlendState, RenderTargetFormat));
+}
+
+FCustomLensFlarePSOPrecache::FRegisterCollector::FRegisterCollector(FCustomLensFlarePSOCollectorFunction Collector)
+{
+	GetCollectors().Add(Collector);
+}
+
+void FCustomLensFlarePSOPrecache::CollectAll(ERHIFeatureLevel::Type FeatureLevel, FCustomLensFlarePSOCollection& OutCollection)
+{
+	// Removed feature levels have no platform, and cooked builds only load the global shaders of the levels they ship
+	const EShaderPlatform ShaderPlatform = GShaderPlatformForFeatureLevel[FeatureLevel];
+	if (ShaderPlatform == SP_NumPlatforms || !GGlobalShaderMap[ShaderPlatform])
+		return;
+
+	for (FCustomLensFlarePSOCollectorFunction Collector : GetCollectors())
+	{
+		Collector(FeatureLevel, OutCollection);
+	}
+}
+
+void FCustomLensFlarePSOPrecache::PrecacheAll(ERHIFeatureLevel::Type FeatureLevel)
+{
+	check(IsInRenderingThread());
+
+	FCustomLensFlarePSOCollection Collection;
+	CollectAll(FeatureLevel, Collection);
+
+	for (const FCustomLensFlarePSOCollection::FGraphicsEntry& Entry : Collection.GetGraphicsEntries())
+	{
+		PipelineStateCache::PrecacheGraphicsPipelineState(Entry.Initializer);
+	}
+
+	for (const FCustomLensFlarePSOCollection::FComputeEntry& Entry : Collection.GetComputeEntries())
+	{
+		PipelineStateCache::PrecacheComputePipelineState(Entry.ComputeShader);
+	}
+
+	UE_LOG(LogCustomLensFlarePSO, Log, TEXT("Requested precaching of %d lens flare graphics and %d compute pipelines"), Collection.GetGraphicsEntries().Num(), Collection.GetComputeEntries().Num());
+}
+
+void FCustomLensFlarePSOPrecache::PrewarmOnStartupIfEnabled()
+{
+	if (CVarLensFlarePSOPrewarmOnStartup.GetValueOnGameThread() == 0)
+		return;
+
+	ENQUEUE_RENDER_COMMAND(PrewarmCustomLensFlarePSOs)([](FRHICommandListImmediate&)
+	{
+		PrecacheAll(GMaxRHIFeatureLevel);
+	});
+}
+
+FGraphicsPipelineStateInitializer FCustomLensFlarePSOPrecache::MakeScreenPassInitializer(FRHIVertexShader* VertexShader, FRHIPixelShader* PixelShader, FRHIBlendState* BlendState, EPixelFormat RenderTargetFormat)
+{
+	// Matches the state FScreenPassPipelineState uses by default.
+	FGraphicsPipelineStateInitializer Initializer;
+	Initializer.BlendState = BlendState;
+	Initializer.RasterizerState = TStaticRasterizerState<>::GetRHI();
+	Initializer.DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
+	Initializer.BoundShaderState.VertexDeclarationRHI = GFilterVertexDeclaration.VertexDeclarationRHI;
+	Initializer.BoundShaderState.VertexShaderRHI = VertexShader;
+	Initializer.BoundShaderState.PixelShaderRHI = PixelShader;
+	Initializer.PrimitiveType = PT_TriangleList;
+	ApplyRenderTargetInfo(Initializer, RenderTargetFormat);
+	return Initializer;
+}
+
+void FCustomLensFlarePSOPrecache::ApplyRenderTargetInfo(FGraphicsPipelineStateInitializer& Initializer, EPixelFormat RenderTargetFormat)
+{
+	FGraphicsPipelineRenderTargetsInfo RenderTargetsInfo;
+	RenderTargetsInfo.NumSamples = 1;
+	AddRenderTargetInfo(RenderTargetFormat, TexCreate_RenderTargetable | TexCreate_ShaderResource, RenderTargetsInfo);
+	ApplyTargetsInfo(Initializer, RenderTargetsInfo);
+}
+
+void FCustomLensFlarePSOPrecache::MarkRenderedFeatureLevel(ERHIFeatureLevel::Type FeatureLevel)
+{
+	GRenderedFeatureLevels.fetch_or(1u << FeatureLevel, std::memory_order_relaxed);
+}
+
+#if !UE_BUILD_SHIPPING
+namespace
+{
+	void ValidatePipelineKey(uint32 Key, const TCHAR* PassName)
+	{
+		if (CVarLensFlarePSOValidate.GetValueOnAnyThread() == 0)
+			return;
+
+		// Passes can be executed from parallel RDG tasks. The sets are only written when a pipeline is missing.
+		static FRWLock Lock;
+		static TSet<uint32> PrecachedKeys;
+		static TSet<uint32> ReportedKeys;
+
+		{
+			FReadScopeLock ReadLock(Lock);
+			if (PrecachedKeys.Contains(Key) || ReportedKeys.Contains(Key))
+				return;
+		}
+
+		FWriteScopeLock WriteLock(Lock);
+		if (PrecachedKeys.Contains(Key) || ReportedKeys.Contains(Key))
+			return;
+
+		// The keys are shader pointers, which change when shaders are recompiled or r.LensFlare.HalfPrecision is changed,
+		// so the set is collected again before a pipeline is reported. This also collects it on the first draw.
+		PrecachedKeys.Reset();
+		// Only the levels views render at, the editor renders the mobile preview at a lower one than GMaxRHIFeatureLevel
+		const uint32 RenderedFeatureLevels = GRenderedFeatureLevels.load(std::memory_order_relaxed);
+		for (int32 FeatureLevel = 0; FeatureLevel < ERHIFeatureLevel::Num; ++FeatureLevel)
+		{
+			if ((RenderedFeatureLevels & (1u << FeatureLevel)) == 0)
+				continue;
+
+			FCustomLensFlarePSOCollection Collection;
+			FCustomLensFlarePSOPrecache::CollectAll(ERHIFeatureLevel::Type(FeatureLevel), Collection);
+			for (const FCustomLensFlarePSOCollection::FGraphicsEntry& Entry : Collection.GetGraphicsEntries())
+			{
+				PrecachedKeys.Add(FCustomLensFlarePSOPrecache::GetPipelineKey(Entry.Initializer));
+			}
+			for (const FCustomLensFlarePSOCollection::FComputeEntry& Entry : Collection.GetComputeEntries())
+			{
+				PrecachedKeys.Add(FCustomLensFlarePSOPrecache::GetPipelineKey(Entry.ComputeShader));
+			}
+		}
+
+		if (!PrecachedKeys.Contains(Key))
+		{
+			ReportedKeys.Add(Key);
+			UE_LOG(LogCustomLensFlarePSO, Error, TEXT("Lens flare pass %s uses a pipeline (key=%08x) that is not precached. Add it to the PSO collector of its pass."), PassName, Key);
+			ensureMsgf(false, TEXT("Lens flare pass %s uses a pipeline that is not precached."), PassName);
+		}
+	}
+}
+#endif
+
+void FCustomLensFlarePSOPrecache::ValidatePrecached(const FGraphicsPipelineStateInitializer& Initializer, const TCHAR* PassName)
+{
+#if !UE_BUILD_SHIPPING
+	ValidatePipelineKey(GetPipelineKey(Initializer), PassName);
+#endif
+}
+
+void FCustomLensFlarePSOPrecache::ValidatePrecached(FRHIComputeShader* ComputeShader, const TCHAR* PassName)
+{
+#if !UE_BUILD_SHIPPING
+	ValidatePipelineKey(GetPipelineKey(ComputeShader), PassName);
+#endif
+}
+
+uint32 FCustomLensFlarePSOPrecache::GetPipelineKey(const FGraphicsPipelineStateInitializer& Initializer)
+{
+	// Only what the lens flare passes actually vary. Everything else is fixed by MakeScreenPassInitializer().
+	uint32 Key = PointerHash(Initializer.BoundShaderState.VertexShaderRHI);
+	Key = HashCombine(Key, PointerHash(Initializer.BoundShaderState.GetGeometryShader()));
+	Key = HashCombine(Key, PointerHash(Initializer.BoundShaderState.PixelShaderRHI));
+	Key = HashCombine(Key, PointerHash(Initializer.BlendState));
+	Key = HashCombine(Key, GetTypeHash(uint32(Initializer.PrimitiveType)));
+	Key = HashCombine(Key, GetTypeHash(uint32(Initializer.RenderTargetFormats[0])));
+	return Key;
+}
+
+uint32 FCustomLensFlarePSOPrecache::GetPipelineKey(FRHIComputeShader* ComputeShader)
+{
+	// Compute pipelines only differ by their shader
+	return PointerHash(ComputeShader);
+}
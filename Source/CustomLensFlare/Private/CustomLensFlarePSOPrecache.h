@@ -0,0 +1,86 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHIResources.h"
+
+/**
+ * All pipeline states the lens flare passes can produce for one feature level.
+ * Filled by the collectors that every translation unit with lens flare passes registers.
+ */
+class FCustomLensFlarePSOCollection
+{
+public:
+	struct FGraphicsEntry
+	{
+		const TCHAR* PassName = nullptr;
+		FGraphicsPipelineStateInitializer Initializer;
+	};
+
+	struct FComputeEntry
+	{
+		const TCHAR* PassName = nullptr;
+		FRHIComputeShader* ComputeShader = nullptr;
+	};
+
+	void AddGraphics(const TCHAR* PassName, const FGraphicsPipelineStateInitializer& Initializer);
+
+	void AddCompute(const TCHAR* PassName, FRHIComputeShader* ComputeShader);
+
+	/** Adds a fullscreen pass as drawn by DrawRectangle() with the filter vertex declaration. */
+	void AddScreenPass(const TCHAR* PassName, FRHIVertexShader* VertexShader, FRHIPixelShader* PixelShader, FRHIBlendState* BlendState, EPixelFormat RenderTargetFormat);
+
+	const TArray<FGraphicsEntry>& GetGraphicsEntries() const { return GraphicsEntries; }
+	const TArray<FComputeEntry>& GetComputeEntries() const { return ComputeEntries; }
+
+private:
+	TArray<FGraphicsEntry> GraphicsEntries;
+	TArray<FComputeEntry> ComputeEntries;
+};
+
+using FCustomLensFlarePSOCollectorFunction = void(*)(ERHIFeatureLevel::Type FeatureLevel, FCustomLensFlarePSOCollection& OutCollection);
+
+/**
+ * PSO precaching for the lens flare pipeline.
+ * The collected pipelines are handed to the engine PSO precacher and can optionally be compiled during startup.
+ * In non shipping builds every drawn or dispatched pipeline is checked against the collected ones so that passes added without
+ * precaching are noticed right away.
+ */
+class FCustomLensFlarePSOPrecache
+{
+public:
+	/** Registers a collector at static initialization time. */
+	struct FRegisterCollector
+	{
+		FRegisterCollector(FCustomLensFlarePSOCollectorFunction Collector);
+	};
+
+	/** Collects nothing for feature levels without a shader platform or without a loaded global shader map. */
+	static void CollectAll(ERHIFeatureLevel::Type FeatureLevel, FCustomLensFlarePSOCollection& OutCollection);
+
+	/** Requests compilation of all collected pipelines. Render thread only. */
+	static void PrecacheAll(ERHIFeatureLevel::Type FeatureLevel);
+
+	/** Enqueues PrecacheAll() if r.LensFlare.PSOPrecache.PrewarmOnStartup is set. Game thread only. */
+	static void PrewarmOnStartupIfEnabled();
+
+	/** Builds the initializer the same way SetScreenPassPipelineState() does but with explicit render target info. */
+	static FGraphicsPipelineStateInitializer MakeScreenPassInitializer(FRHIVertexShader* VertexShader, FRHIPixelShader* PixelShader, FRHIBlendState* BlendState, EPixelFormat RenderTargetFormat);
+
+	/** Fills in the render target info every lens flare target uses. */
+	static void ApplyRenderTargetInfo(FGraphicsPipelineStateInitializer& Initializer, EPixelFormat RenderTargetFormat);
+
+	/** Remembers that a view rendered lens flares at the feature level, ValidatePrecached() only checks against those. */
+	static void MarkRenderedFeatureLevel(ERHIFeatureLevel::Type FeatureLevel);
+
+	/** Ensures that the pipeline about to be set was part of the precached set. No-op in shipping builds. */
+	static void ValidatePrecached(const FGraphicsPipelineStateInitializer& Initializer, const TCHAR* PassName);
+
+	/** Same for the compute shader about to be dispatched. */
+	static void ValidatePrecached(FRHIComputeShader* ComputeShader, const TCHAR* PassName);
+
+	static uint32 GetPipelineKey(const FGraphicsPipelineStateInitializer& Initializer);
+
+	static uint32 GetPipelineKey(FRHIComputeShader* ComputeShader);
+};
@@ -5,7 +5,35 @@
 
 // ReSharper disable once CppUnusedIncludeDirective
 #include "CustomLensFlareConfig.h"
+#include "SceneView.h"
 #include "Components/PostProcessComponent.h"
+#include "Curves/CurveFloat.h"
+#include "Engine/PostProcessVolume.h"
+#include "Engine/World.h"
+#include "Serialization/CustomVersion.h"
+
+namespace
+{
+	struct FCustomLensFlarePostProcessComponentVersion
+	{
+		enum Type
+		{
+			BeforeCustomVersionWasAdded = 0,
+
+			// The component became the blendable, before SetWeight() added the config to the owner
+			ComponentIsBlendable,
+
+			VersionPlusOne,
+			LatestVersion = VersionPlusOne - 1
+		};
+
+		static const FGuid GUID;
+	};
+
+	const FGuid FCustomLensFlarePostProcessComponentVersion::GUID(0x8D2F4A16, 0x7C3B4E85, 0xA1E95D20, 0x3F6B7C49);
+
+	FCustomVersionRegistration GRegisterCustomLensFlarePostProcessComponentVersion(FCustomLensFlarePostProcessComponentVersion::GUID, FCustomLensFlarePostProcessComponentVersion::LatestVersion, TEXT("CustomLensFlarePostProcessComponentVer"));
+}
 
 UCustomLensFlarePostProcessComponent::UCustomLensFlarePostProcessComponent()
 {
@@ -13,17 +41,49 @@ UCustomLensFlarePostProcessComponent::UCustomLensFlarePostProcessComponent()
 	PrimaryComponentTick.bCanEverTick = false;
 }
 
+void UCustomLensFlarePostProcessComponent::Serialize(FArchive& Ar)
+{
+	Ar.UsingCustomVersion(FCustomLensFlarePostProcessComponentVersion::GUID);
+	Super::Serialize(Ar);
+}
+
+void UCustomLensFlarePostProcessComponent::PostLoad()
+{
+	Super::PostLoad();
+
+	if (GetLinkerCustomVersion(FCustomLensFlarePostProcessComponentVersion::GUID) < FCustomLensFlarePostProcessComponentVersion::ComponentIsBlendable)
+	{
+		bRemoveLegacyConfigBlendable = true;
+	}
+}
+
+void UCustomLensFlarePostProcessComponent::OnRegister()
+{
+	Super::OnRegister();
+
+	// The owner is only complete once it registers its components. Saving the level again stores the new version.
+	if (bRemoveLegacyConfigBlendable)
+	{
+		bRemoveLegacyConfigBlendable = false;
+		FPostProcessSettings* Settings = GetOwnerSettings();
+		if (Settings && CustomLensFlareConfig)
+		{
+			Settings->RemoveBlendable(CustomLensFlareConfig.Get());
+		}
+	}
+}
+
 void UCustomLensFlarePostProcessComponent::Activate(bool bReset)
 {
 	Super::Activate(bReset);
 
-	SetWeight(Weight);
+	AddBlendable();
 }
 
 
 void UCustomLensFlarePostProcessComponent::Deactivate()
 {
-	RemoveBlendable(CustomLensFlareConfig);
+	RemoveBlendable();
 	Super::Deactivate();
 }
 
@@ -35,18 +95,7 @@ void UCustomLensFlarePostProcessComponent::PostEditChangeProperty(struct FProper
 	if (PropertyChangedEvent.Property == nullptr)
 		return;
 
-	if (PropertyChangedEvent.Property->GetFName() == GET_MEMBER_NAME_CHECKED(UCustomLensFlarePostProcessComponent, CustomLensFlareConfig))
-	{
-		if (CustomLensFlareConfig)
-		{
-			SetWeight(Weight);
-		}
-		else
-		{
-			RemoveBlendable(LastUsedConfig.Get());
-		}
-	}
-
+	// The config and the weight are read while blending, only the fade has to start over
 	if (PropertyChangedEvent.Property->GetFName() == GET_MEMBER_NAME_CHECKED(UCustomLensFlarePostProcessComponent, Weight))
 	{
 		SetWeight(Weight);
@@ -54,37 +103,111 @@ void UCustomLensFlarePostProcessComponent::PostEditChangeProperty(struct FProper
 }
 #endif
 
-void UCustomLensFlarePostProcessComponent::RemoveBlendable(UCustomLensFlareConfig* ConfigToRemove) const
+void UCustomLensFlarePostProcessComponent::OverrideBlendableSettings(FSceneView& View, float InWeight) const
+{
+	if (!CustomLensFlareConfig)
+		return;
+
+	const float BlendWeight = InWeight * GetCurrentWeight();
+	if (BlendWeight <= 0.0f)
+		return;
+
+	CustomLensFlareConfig->OverrideBlendableSettings(View, BlendWeight);
+}
+
+void UCustomLensFlarePostProcessComponent::AddBlendable()
+{
+	FPostProcessSettings* Settings = GetOwnerSettings();
+	if (!Settings)
+		return;
+
+	// Entries a designer put there keep their weight and stay when the component deactivates
+	const bool bAlreadyBlended = Settings->WeightedBlendables.Array.ContainsByPredicate([this](const FWeightedBlendable& Blendable)
+	{
+		return Blendable.Object == this;
+	});
+	if (bAlreadyBlended)
+		return;
+
+	// The weight is applied in OverrideBlendableSettings(), the owner always sees a full one
+	Settings->AddBlendable(this, 1.0f);
+	bAddedBlendable = true;
+}
+
+void UCustomLensFlarePostProcessComponent::RemoveBlendable()
+{
+	if (!bAddedBlendable)
+		return;
+
+	if (FPostProcessSettings* Settings = GetOwnerSettings())
+	{
+		Settings->RemoveBlendable(this);
+	}
+	bAddedBlendable = false;
+}
+
+FPostProcessSettings* UCustomLensFlarePostProcessComponent::GetOwnerSettings() const
 {
 	if (APostProcessVolume* PostProcessVolumeOwner = GetOwner<APostProcessVolume>())
 	{
-		PostProcessVolumeOwner->Settings.RemoveBlendable(ConfigToRemove);
+		return &PostProcessVolumeOwner->Settings;
 	}
-	else if (UPostProcessComponent* PostProcessComponent = GetOwner()->GetComponentByClass<UPostProcessComponent>())
+	if (UPostProcessComponent* PostProcessComponent = GetOwner()->GetComponentByClass<UPostProcessComponent>())
 	{
-		PostProcessComponent->Settings.RemoveBlendable(ConfigToRemove);
+		return &PostProcessComponent->Settings;
 	}
+	return nullptr;
 }
 
 void UCustomLensFlarePostProcessComponent::SetWeight(float NewWeight)
 {
 	Weight = NewWeight;
-	if (!CustomLensFlareConfig || NewWeight <= 0.0f)
+	FadeDuration = 0.0f;
+	FadeCurve = nullptr;
+}
+
+void UCustomLensFlarePostProcessComponent::FadeToWeight(float TargetWeight, float Duration, UCurveFloat* Curve)
+{
+	if (Duration <= 0.0f)
 	{
-		RemoveBlendable(CustomLensFlareConfig);
+		SetWeight(TargetWeight);
 		return;
 	}
 
-#if WITH_EDITOR
-	LastUsedConfig = CustomLensFlareConfig;
-#endif
+	const double WorldTime = GetWorldTime();
+	FadeStartWeight = GetWeightAt(WorldTime);
+	FadeStartTime = WorldTime;
+	FadeDuration = Duration;
+	FadeCurve = Curve;
+	Weight = TargetWeight;
+}
 
-	if (APostProcessVolume* PostProcessVolumeOwner = GetOwner<APostProcessVolume>())
-	{
-		PostProcessVolumeOwner->AddOrUpdateBlendable(CustomLensFlareConfig, NewWeight);
-	}
-	else if (UPostProcessComponent* PostProcessComponent = GetOwner()->GetComponentByClass<UPostProcessComponent>())
+float UCustomLensFlarePostProcessComponent::GetCurrentWeight() const
+{
+	return IsFading() ? GetWeightAt(GetWorldTime()) : Weight;
+}
+
+bool UCustomLensFlarePostProcessComponent::IsFading() const
+{
+	return FadeDuration > 0.0f && GetWorldTime() < FadeStartTime + FadeDuration;
+}
+
+float UCustomLensFlarePostProcessComponent::GetWeightAt(double WorldTime) const
+{
+	if (FadeDuration <= 0.0f)
+		return Weight;
+
+	float Alpha = FMath::Clamp(float((WorldTime - FadeStartTime) / FadeDuration), 0.0f, 1.0f);
+	if (FadeCurve)
 	{
-		PostProcessComponent->AddOrUpdateBlendable(CustomLensFlareConfig, NewWeight);
+		Alpha = FadeCurve->GetFloatValue(Alpha);
 	}
+	return FMath::Lerp(FadeStartWeight, Weight, Alpha);
+}
+
+double UCustomLensFlarePostProcessComponent::GetWorldTime() const
+{
+	// Fades follow pause and time dilation like the rest of the game
+	const UWorld* World = GetWorld();
+	return World ? World->GetTimeSeconds() : 0.0;
 }
@@ -3,12 +3,23 @@
 #include "CustomLensFlareSceneViewExtension.h"
 
 #include "CustomLensFlare.h"
+#include "CustomLensFlareCapture.h"
 #include "CustomLensFlareConfig.h"
+#include "CustomLensFlareFrameCache.h"
+#include "CustomLensFlareHalfPrecision.h"
+#include "CustomLensFlareLUTCache.h"
+#include "CustomLensFlarePSOPrecache.h"
 #include "CustomLensFlareSceneViewExtensionData.h"
+#include "CustomLensFlareSourceComponent.h"
+#include "DataDrivenShaderPlatformInfo.h"
+#include "ScenePrivate.h"
 #include "SceneRendering.h"
 #include "ScreenPass.h"
+#include "TextureResource.h"
+#include "RenderGraphUtils.h"
 #include "PostProcess/PostProcessing.h"
 #include "PostProcess/SceneFilterRendering.h"
+#include "SystemTextures.h"
 
 TAutoConsoleVariable<int32> CVarLensFlareRenderBloom(
 	TEXT("r.LensFlare.RenderBloom"),
@@ -63,6 +74,13 @@ TAutoConsoleVariable<int32> CVarMaxBloomPassAmount(
 	ECVF_RenderThreadSafe
 	);
 
+TAutoConsoleVariable<int32> CVarLensFlareMobileMaxBloomPassAmount(
+	TEXT("r.LensFlare.Mobile.MaxBloomPassAmount"),
+	5,
+	TEXT("Max Number of passes to render bloom in the mobile renderer, on top of r.LensFlare.MaxBloomPassAmount"),
+	ECVF_Scalability | ECVF_RenderThreadSafe
+	);
+
 TAutoConsoleVariable<float> CVarMinDownsampleSize(
 	TEXT("r.LensFlare.MinDownsampleSize"),
 	1,
@@ -70,6 +88,155 @@ TAutoConsoleVariable<float> CVarMinDownsampleSize(
 	ECVF_RenderThreadSafe
 	);
 
+TAutoConsoleVariable<int32> CVarLensFlareKarisAverage(
+	TEXT("r.LensFlare.Prefilter.KarisAverage"),
+	0,
+	TEXT(" 0: Plain average when thresholding scene color\n")
+	TEXT(" 1: Karis average to suppress fireflies from single very bright pixels"),
+	ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlareDownsampleTapCount(
+	TEXT("r.LensFlare.DownsampleTapCount"),
+	13,
+	TEXT("Taps of the bloom downsamples after the prefilter. The prefilter always uses 13.\n")
+	TEXT("  4: Box filter, cheapest\n")
+	TEXT(" 13: Wider filter, less aliasing"),
+	ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlareExposureRelativeThreshold(
+	TEXT("r.LensFlare.Threshold.ExposureRelative"),
+	1,
+	TEXT(" 0: The bloom threshold and the glare cutoff are absolute scene luminance\n")
+	TEXT(" 1: They are compared against the luminance after eye adaptation, so they hold up indoors and outdoors alike"),
+	ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlareMaxGhosts(
+	TEXT("r.LensFlare.MaxGhosts"),
+	32,
+	TEXT("Max number of ghosts drawn per view. The brightest ones are kept."),
+	ECVF_Scalability | ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlareGhostSpritesMaxSources(
+	TEXT("r.LensFlare.GhostSprites.MaxSources"),
+	16,
+	TEXT("Max number of bright spots that sprite ghosts are drawn for. Spots past this limit are dropped in no particular order."),
+	ECVF_Scalability | ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlareGhostSpritesSourceResolution(
+	TEXT("r.LensFlare.GhostSprites.SourceResolution"),
+	64,
+	TEXT("Bright spots for sprite ghosts are searched in the first bloom downsample that is at most this wide."),
+	ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlareFlareSourceMip(
+	TEXT("r.LensFlare.Flare.SourceMip"),
+	0,
+	TEXT("Mip of the bloom pyramid the chromatic ghosts and the halo sample, relative to the full bloom. Higher is cheaper and softer."),
+	ECVF_Scalability | ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlareGlareSourceMip(
+	TEXT("r.LensFlare.Glare.SourceMip"),
+	0,
+	TEXT("Mip of the bloom pyramid the glare samples, relative to the full bloom. Higher is cheaper and softer."),
+	ECVF_Scalability | ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlareFlareComputeBlur(
+	TEXT("r.LensFlare.Flare.ComputeBlur"),
+	1,
+	TEXT(" 0: Blur the flares with the dual Kawase chain of raster passes\n")
+	TEXT(" 1: Blur them with a separable gaussian of the same spread in two compute passes"),
+	ECVF_Scalability | ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<float> CVarLensFlareGhostSpritesMinLuminance(
+	TEXT("r.LensFlare.GhostSprites.MinLuminance"),
+	0.05f,
+	TEXT("Thresholded luminance a spot needs to emit sprite ghosts."),
+	ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlareAnalyticMaxSources(
+	TEXT("r.LensFlare.Analytic.MaxSources"),
+	8,
+	TEXT("Max number of lights that cast flares in the Analytic pipeline. The directional light comes first."),
+	ECVF_Scalability | ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlareAnalyticDirectionalLight(
+	TEXT("r.LensFlare.Analytic.DirectionalLight"),
+	1,
+	TEXT("If 1, the dominant directional light casts a flare in the Analytic pipeline."),
+	ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<float> CVarLensFlareAnalyticDirectionalLightIntensity(
+	TEXT("r.LensFlare.Analytic.DirectionalLightIntensity"),
+	1.0f,
+	TEXT("Flare brightness of the directional light. Its color is normalized, so this doesn't depend on the light units."),
+	ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<float> CVarLensFlareAnalyticSourceSize(
+	TEXT("r.LensFlare.Analytic.SourceSize"),
+	0.03f,
+	TEXT("Size of a light as a fraction of the view height. Scales the ghost sprites."),
+	ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<float> CVarLensFlareAnalyticGlareSize(
+	TEXT("r.LensFlare.Analytic.GlareSize"),
+	0.15f,
+	TEXT("Length of the longest glare ray as a fraction of the view height."),
+	ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<float> CVarLensFlareAnalyticOcclusionRadius(
+	TEXT("r.LensFlare.Analytic.OcclusionRadius"),
+	8.0f,
+	TEXT("Radius in pixels of the depth region that is tested around every light."),
+	ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlareTileClassification(
+	TEXT("r.LensFlare.TileClassification"),
+	1,
+	TEXT(" 0: The mix and the last bloom upsample are full screen passes\n")
+	TEXT(" 1: They run as compute over the screen tiles that have bloom, flare or glare energy, the other tiles are cleared to black"),
+	ECVF_Scalability | ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<float> CVarLensFlareTileClassificationThreshold(
+	TEXT("r.LensFlare.TileClassification.Threshold"),
+	0.001f,
+	TEXT("Luminance a tile has to contribute to the final image somewhere to not be skipped."),
+	ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlareFuseBloomUpsample(
+	TEXT("r.LensFlare.FuseBloomUpsample"),
+	1,
+	TEXT(" 0: The last bloom upsample writes a full resolution texture that the mix reads back\n")
+	TEXT(" 1: The mix does the last bloom upsample itself at its own resolution. Flares and glare are then fed by the half resolution upsample."),
+	ECVF_Scalability | ECVF_RenderThreadSafe
+	);
+
+TAutoConsoleVariable<int32> CVarLensFlareCompositeIntoEngineBloom(
+	TEXT("r.LensFlare.CompositeIntoEngineBloom"),
+	1,
+	TEXT("Only when the flares are added to the engine bloom (r.PostProcessing.CustomBloomFlareMode=2).\n")
+	TEXT(" 0: Mix the engine bloom, flares and glare into a texture of our own that the tonemapper reads instead\n")
+	TEXT(" 1: Blend the flares and glare straight into the engine bloom, no extra texture is allocated"),
+	ECVF_RenderThreadSafe
+	);
+
 TAutoConsoleVariable<float> CVarBloomRadius(
 	TEXT("r.LensFlare.BloomRadius"),
 	0.85,
@@ -77,11 +244,52 @@ TAutoConsoleVariable<float> CVarBloomRadius(
 	ECVF_RenderThreadSafe
 	);
 
+TAutoConsoleVariable<int32> CVarLensFlareStableExtents(
+	TEXT("r.LensFlare.StableExtents"),
+	1,
+	TEXT(" 0: Allocate every target at the size the view needs this frame\n")
+	TEXT(" 1: Allocate the targets at the same fraction of the scene texture extent and render into the part the view needs.\n")
+	TEXT("    The pooled textures then stay the same while dynamic resolution changes the view, see stat LensFlare."),
+	ECVF_RenderThreadSafe
+	);
+
 DECLARE_GPU_STAT(CustomLensFlares);
 DECLARE_GPU_STAT(CustomBloomFlares);
 
+DECLARE_STATS_GROUP(TEXT("Lens Flare"), STATGROUP_CustomLensFlare, STATCAT_Advanced);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Targets"), STAT_LensFlareTargets, STATGROUP_CustomLensFlare);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Targets not in the previous frame"), STAT_LensFlareTargetChurn, STATGROUP_CustomLensFlare);
+DECLARE_MEMORY_STAT(TEXT("Target memory"), STAT_LensFlareTargetMemory, STATGROUP_CustomLensFlare);
+
 namespace
 {
+	FRHIBlendState* GetClearBlendState()
+	{
+		return TStaticBlendState<>::GetRHI();
+	}
+
+	FRHIBlendState* GetAdditiveBlendState()
+	{
+		return TStaticBlendState<CW_RGB, BO_Add, BF_One, BF_One>::GetRHI();
+	}
+
+	// Same as SetScreenPassPipelineState() but checks that the pipeline has been precached
+	void SetLensFlarePipelineState(FRHICommandList& RHICmdList, const FScreenPassPipelineState& PipelineState, const TCHAR* PassName)
+	{
+		FGraphicsPipelineStateInitializer GraphicsPSOInit;
+		RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+		GraphicsPSOInit.BlendState = PipelineState.BlendState;
+		GraphicsPSOInit.RasterizerState = PipelineState.RasterizerState;
+		GraphicsPSOInit.DepthStencilState = PipelineState.DepthStencilState;
+		GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = PipelineState.VertexDeclaration;
+		GraphicsPSOInit.BoundShaderState.VertexShaderRHI = PipelineState.VertexShader.GetVertexShader();
+		GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PipelineState.PixelShader.GetPixelShader();
+		GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+
+		FCustomLensFlarePSOPrecache::ValidatePrecached(GraphicsPSOInit, PassName);
+		SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, PipelineState.StencilRef);
+	}
+
 	// The function that draw a shader into a given RenderGraph texture
 	template <typename TShaderParameters, typename TShaderClassVertex, typename TShaderClassPixel>
 	void DrawShaderPass(
@@ -100,14 +308,14 @@ namespace
 			RDG_EVENT_NAME("%s", *PassName),
 			PassParameters,
 			ERDGPassFlags::Raster,
-			[PixelShader, PassParameters, Viewport, PipelineState](FRHICommandListImmediate& RHICmdList)
+			[PixelShader, PassParameters, Viewport, PipelineState, PassName](FRHICommandListImmediate& RHICmdList)
 			{
 				RHICmdList.SetViewport(
 					Viewport.Min.X, Viewport.Min.Y, 0.0f,
 					Viewport.Max.X, Viewport.Max.Y, 1.0f
 					);
 
-				SetScreenPassPipelineState(RHICmdList, PipelineState);
+				SetLensFlarePipelineState(RHICmdList, PipelineState, *PassName);
 
 				SetShaderParameters(
 					RHICmdList,
@@ -118,7 +326,7 @@ namespace
 				DrawRectangle(RHICmdList, // FRHICommandList
 					0.0f, 0.0f, // float X, float Y
 					Viewport.Width(), Viewport.Height(), // float SizeX, float SizeY
-					Viewport.Min.X, Viewport.Min.Y, // float U, float V
+					0.0f, 0.0f, // float U, float V
 					Viewport.Width(), // float SizeU
 					Viewport.Height(), // float SizeV
 					Viewport.Size(), // FIntPoint TargetSize
@@ -130,6 +338,87 @@ namespace
 			);
 	}
 
+	FIntPoint GetMipSize(FRDGTextureRef Texture, int32 MipLevel)
+	{
+		return FIntPoint(
+			FMath::Max(Texture->Desc.Extent.X >> MipLevel, 1),
+			FMath::Max(Texture->Desc.Extent.Y >> MipLevel, 1)
+			);
+	}
+
+	// FScreenPassTextureViewport(FScreenPassTextureSlice) takes the extent of mip 0,
+	// but slices of the bloom pyramid view a single mip of it.
+	FScreenPassTextureViewport GetSliceViewport(const FScreenPassTextureSlice& Slice)
+	{
+		return FScreenPassTextureViewport(GetMipSize(Slice.TextureSRV->GetParent(), Slice.TextureSRV->Desc.MipLevel), Slice.ViewRect);
+	}
+
+	// Extent to allocate a target of Size at that is rendered at 1 / Divider of a ReferenceExtent sized texture.
+	// The reference is allocated at the largest view size already, so the result doesn't follow dynamic resolution.
+	FIntPoint GetTargetExtent(FIntPoint ReferenceExtent, int32 Divider, FIntPoint Size)
+	{
+		if (CVarLensFlareStableExtents.GetValueOnRenderThread() == 0)
+			return Size;
+
+		return FIntPoint(
+			FMath::Max(FMath::DivideAndRoundUp(ReferenceExtent.X, Divider), Size.X),
+			FMath::Max(FMath::DivideAndRoundUp(ReferenceExtent.Y, Divider), Size.Y)
+			);
+	}
+
+	// What the viewport of a target at the origin covers of it in UV, see InputViewportSize in Shared.ush
+	FVector2f GetViewportUVSize(const FScreenPassTexture& Texture)
+	{
+		return FVector2f(Texture.ViewRect.Size()) / FVector2f(Texture.Texture->Desc.Extent);
+	}
+
+	FVector2f GetViewportUVSize(const FScreenPassTextureSlice& Slice)
+	{
+		const FScreenPassTextureViewport Viewport = GetSliceViewport(Slice);
+		return FVector2f(Viewport.Rect.Size()) / FVector2f(Viewport.Extent);
+	}
+
+	// Targets that are larger than their viewport are cleared, so that bilinear taps and the border
+	// sampler see black outside of the viewport just like at the edges of a texture that fits.
+	ERenderTargetLoadAction GetTargetLoadAction(FRDGTextureRef Texture, const FIntRect& Viewport, uint32 MipLevel = 0)
+	{
+		return Viewport.Size() == GetMipSize(Texture, MipLevel) ? ERenderTargetLoadAction::ENoAction : ERenderTargetLoadAction::EClear;
+	}
+
+	// Every transient target of the pipeline is created through here for stat LensFlare. A description
+	// that wasn't requested in the previous frame usually is a new allocation of the RDG pool.
+	FRDGTextureRef CreateTarget(FRDGBuilder& GraphBuilder, const FRDGTextureDesc& Description, const TCHAR* Name)
+	{
+		static uint64 CurrentFrame = 0;
+		static TArray<uint32> PreviousDescriptions;
+		static TArray<uint32> CurrentDescriptions;
+		static uint64 CurrentMemory = 0;
+
+		check(IsInRenderingThread());
+		if (CurrentFrame != GFrameCounterRenderThread)
+		{
+			SET_MEMORY_STAT(STAT_LensFlareTargetMemory, CurrentMemory);
+			Swap(PreviousDescriptions, CurrentDescriptions);
+			CurrentDescriptions.Reset();
+			CurrentMemory = 0;
+			CurrentFrame = GFrameCounterRenderThread;
+		}
+
+		const uint32 DescriptionHash = HashCombine(
+			HashCombine(GetTypeHash(Description.Extent), GetTypeHash(uint32(Description.Format))),
+			HashCombine(GetTypeHash(uint32(Description.NumMips)), GetTypeHash(uint64(Description.Flags))));
+
+		INC_DWORD_STAT(STAT_LensFlareTargets);
+		if (PreviousDescriptions.RemoveSingleSwap(DescriptionHash, EAllowShrinking::No) == 0)
+		{
+			INC_DWORD_STAT(STAT_LensFlareTargetChurn);
+		}
+		CurrentDescriptions.Add(DescriptionHash);
+		CurrentMemory += CalcTextureSize(Description.Extent.X, Description.Extent.Y, Description.Format, Description.NumMips);
+
+		return GraphBuilder.CreateTexture(Description, Name);
+	}
+
 	// The function that draw a shader into a given RenderGraph texture
 	// with the input texture having a different viewport than the target
 	template <typename TShaderParameters, typename TShaderClassVertex, typename TShaderClassPixel>
@@ -150,7 +439,7 @@ namespace
 			RDG_EVENT_NAME("%s", *PassName),
 			PassParameters,
 			ERDGPassFlags::Raster,
-			[PixelShader, PassParameters, InputTexture, OutputViewport, PipelineState](
+			[PixelShader, PassParameters, InputTexture, OutputViewport, PipelineState, PassName](
 			FRHICommandListImmediate& RHICmdList)
 			{
 				RHICmdList.SetViewport(
@@ -158,7 +447,7 @@ namespace
 					OutputViewport.Max.X, OutputViewport.Max.Y, 1.0f
 					);
 
-				SetScreenPassPipelineState(RHICmdList, PipelineState);
+				SetLensFlarePipelineState(RHICmdList, PipelineState, *PassName);
 
 				SetShaderParameters(
 					RHICmdList,
@@ -166,7 +455,7 @@ namespace
 					PixelShader.GetPixelShader(),
 					*PassParameters
 					);
-				FIntVector InputTextureSize = InputTexture.TextureSRV->GetParent()->Desc.GetSize();
+				FIntPoint InputTextureSize = GetSliceViewport(InputTexture).Extent;
 				FIntRect InputViewport = InputTexture.ViewRect;
 				DrawRectangle(RHICmdList, // FRHICommandList
 					OutputViewport.Min.X, OutputViewport.Min.Y, // float X, float Y
@@ -174,7 +463,7 @@ namespace
 					InputViewport.Min.X, InputViewport.Min.Y, // float U, float V
 					InputViewport.Width(), InputViewport.Height(), // float SizeU, float SizeV
 					OutputViewport.Size(), // FIntPoint TargetSize
-					FIntPoint(InputTextureSize.X, InputTextureSize.Y), // FIntPoint TextureSize
+					InputTextureSize, // FIntPoint TextureSize
 					PipelineState.VertexShader, // const TShaderRefBase VertexShader
 					EDrawRectangleFlags::EDRF_UseTriangleOptimization // EDrawRectangleFlags Flags
 					);
@@ -182,22 +471,6 @@ namespace
 			);
 	}
 
-	FVector2f GetInputViewportSize(const FIntRect& Input, const FIntPoint& Extent)
-	{
-		// Based on
-		// GetScreenPassTextureViewportParameters()
-		// Engine/Source/Runtime/Renderer/Private/ScreenPass.cpp
-
-		FVector2f ExtentInverse = FVector2f(1.0f / Extent.X, 1.0f / Extent.Y);
-
-		FVector2f RectMin = FVector2f(Input.Min);
-		FVector2f RectMax = FVector2f(Input.Max);
-
-		FVector2f Min = RectMin * ExtentInverse;
-		FVector2f Max = RectMax * ExtentInverse;
-
-		return (Max - Min);
-	}
 }
 
 namespace
@@ -231,6 +504,37 @@ namespace
 		"CustomLensFlareScreenPassVS", SF_Vertex
 		);
 
+	// Colors, masks and weights in 16 bit, see FCustomLensFlareHalfPrecision
+	class FLensFlareHalfPrecisionDim : SHADER_PERMUTATION_BOOL("HALF_PRECISION");
+
+	// False for the HALF_PRECISION permutations of platforms that don't use them
+	template<typename FPermutationDomain>
+	bool ShouldCompileHalfPrecisionPermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		const FPermutationDomain PermutationVector(Parameters.PermutationId);
+		return !PermutationVector.template Get<FLensFlareHalfPrecisionDim>()
+			|| FCustomLensFlareHalfPrecision::ShouldCompilePermutation(Parameters.Platform);
+	}
+
+	template<typename FPermutationDomain>
+	void ModifyHalfPrecisionCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		const FPermutationDomain PermutationVector(Parameters.PermutationId);
+		FCustomLensFlareHalfPrecision::ModifyCompilationEnvironment(PermutationVector.template Get<FLensFlareHalfPrecisionDim>(), OutEnvironment);
+	}
+
+	bool UseHalfPrecision(const FViewInfo& View)
+	{
+		return FCustomLensFlareHalfPrecision::Get().IsEnabled(View.GetShaderPlatform());
+	}
+
+	// Views of the mobile renderer, which calls MobileBloomFlaresHook, get the reduced pipeline:
+	// raster passes only, fewer bloom mips, no flare blur and the glare without geometry shader.
+	bool UseMobilePipeline(const FViewInfo& View)
+	{
+		return View.GetFeatureLevel() < ERHIFeatureLevel::SM5;
+	}
+
 	// Rescale shader
 	class FLensFlareRescalePS : public FGlobalShader
 	{
@@ -260,78 +564,160 @@ namespace
 		DECLARE_GLOBAL_SHADER(FDownsamplePS);
 		SHADER_USE_PARAMETER_STRUCT(FDownsamplePS, FGlobalShader);
 
+		class FPrefilterDim : SHADER_PERMUTATION_BOOL("PREFILTER");
+		class FKarisAverageDim : SHADER_PERMUTATION_BOOL("KARIS_AVERAGE");
+		class FTapCountDim : SHADER_PERMUTATION_SPARSE_INT("TAP_COUNT", 4, 13);
+		using FPermutationDomain = TShaderPermutationDomain<FPrefilterDim, FKarisAverageDim, FTapCountDim, FLensFlareHalfPrecisionDim>;
+
 		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
 			RENDER_TARGET_BINDING_SLOTS()
 			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, InputTexture)
 			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
 			SHADER_PARAMETER(FVector4f, InputSizeAndInvInputSize)
+			SHADER_PARAMETER_STRUCT(FScreenPassTextureViewportParameters, Input)
 			SHADER_PARAMETER(float, ThresholdLevel)
 			SHADER_PARAMETER(float, ThresholdRange)
+			SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<float4>, EyeAdaptationBuffer)
+			SHADER_PARAMETER(float, ExposureScale)
 		END_SHADER_PARAMETER_STRUCT()
 
 		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 		{
-			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+			const FPermutationDomain PermutationVector(Parameters.PermutationId);
+			if (PermutationVector.Get<FPrefilterDim>())
+			{
+				// The prefilter always uses the wide filter
+				if (PermutationVector.Get<FTapCountDim>() != 13)
+					return false;
+			}
+			else if (PermutationVector.Get<FKarisAverageDim>())
+			{
+				// Only the prefilter sees unfiltered fireflies
+				return false;
+			}
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1)
+				&& ShouldCompileHalfPrecisionPermutation<FPermutationDomain>(Parameters);
+		}
+
+		static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+		{
+			FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+			ModifyHalfPrecisionCompilationEnvironment<FPermutationDomain>(Parameters, OutEnvironment);
+		}
+
+		static FPermutationDomain GetPermutationVector(bool bPrefilter, bool bHalfPrecision)
+		{
+			FPermutationDomain PermutationVector;
+			PermutationVector.Set<FPrefilterDim>(bPrefilter);
+			PermutationVector.Set<FKarisAverageDim>(bPrefilter && CVarLensFlareKarisAverage.GetValueOnRenderThread() != 0);
+			PermutationVector.Set<FTapCountDim>(bPrefilter || CVarLensFlareDownsampleTapCount.GetValueOnRenderThread() > 4 ? 13 : 4);
+			PermutationVector.Set<FLensFlareHalfPrecisionDim>(bHalfPrecision);
+			return PermutationVector;
 		}
 	};
 
 	IMPLEMENT_GLOBAL_SHADER(FDownsamplePS, "/Plugin/CustomLensFlare/DownsampleThreshold.usf", "DownsamplePS", SF_Pixel);
 
 	// Bloom upsample + combine
+	BEGIN_SHADER_PARAMETER_STRUCT(FUpsampleCombineParameters,)
+		SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, InputTexture)
+		SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
+		SHADER_PARAMETER_STRUCT(FScreenPassTextureViewportParameters, Input)
+		SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, PreviousTexture)
+		SHADER_PARAMETER_STRUCT(FScreenPassTextureViewportParameters, Previous)
+		SHADER_PARAMETER(float, Radius)
+	END_SHADER_PARAMETER_STRUCT()
+
 	class FUpsampleCombinePS : public FGlobalShader
 	{
 	public:
 		DECLARE_GLOBAL_SHADER(FUpsampleCombinePS);
 		SHADER_USE_PARAMETER_STRUCT(FUpsampleCombinePS, FGlobalShader);
 
+		using FPermutationDomain = TShaderPermutationDomain<FLensFlareHalfPrecisionDim>;
+
 		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
 			RENDER_TARGET_BINDING_SLOTS()
-			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, InputTexture)
-			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
-			SHADER_PARAMETER(FVector4f, InputSizeAndInvInputSize)
-			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, PreviousTexture)
-			SHADER_PARAMETER(FVector4f, PreviousSizeAndInvInputSize)
-			SHADER_PARAMETER(float, Radius)
+			SHADER_PARAMETER_STRUCT_INCLUDE(FUpsampleCombineParameters, Upsample)
 		END_SHADER_PARAMETER_STRUCT()
 
 		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 		{
-			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1)
+				&& ShouldCompileHalfPrecisionPermutation<FPermutationDomain>(Parameters);
+		}
+
+		static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+		{
+			FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+			ModifyHalfPrecisionCompilationEnvironment<FPermutationDomain>(Parameters, OutEnvironment);
 		}
 	};
 
 	IMPLEMENT_GLOBAL_SHADER(FUpsampleCombinePS, "/Plugin/CustomLensFlare/DownsampleThreshold.usf", "UpsampleCombinePS", SF_Pixel);
 
-	// Blur shader (use Dual Kawase method)
-	class FKawaseBlurDownPS : public FGlobalShader
+	// Must match UPSAMPLE_TILE_SIZE in DownsampleThreshold.usf and MIX_TILE_SIZE in Mix.usf.
+	// Both cover the same part of the screen since the mix runs at half resolution.
+	constexpr int32 UpsampleTileSize = 32;
+	constexpr int32 MixTileSize = 16;
+
+	// Last bloom upsample for the active tiles only
+	class FUpsampleCombineCS : public FGlobalShader
 	{
 	public:
-		DECLARE_GLOBAL_SHADER(FKawaseBlurDownPS);
-		SHADER_USE_PARAMETER_STRUCT(FKawaseBlurDownPS, FGlobalShader);
+		DECLARE_GLOBAL_SHADER(FUpsampleCombineCS);
+		SHADER_USE_PARAMETER_STRUCT(FUpsampleCombineCS, FGlobalShader);
+
+		using FPermutationDomain = TShaderPermutationDomain<FLensFlareHalfPrecisionDim>;
 
 		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
-			SHADER_PARAMETER_STRUCT_INCLUDE(FCustomLensFlarePassParameters, Pass)
-			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
-			SHADER_PARAMETER(FVector2f, BufferSize)
+			SHADER_PARAMETER_STRUCT_INCLUDE(FUpsampleCombineParameters, Upsample)
+			SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<uint>, TileList)
+			SHADER_PARAMETER(FUintVector2, OutputSize)
+			SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float3>, RWOutput)
+			RDG_BUFFER_ACCESS(IndirectDispatchArgs, ERHIAccess::IndirectArgs)
 		END_SHADER_PARAMETER_STRUCT()
 
 		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 		{
-			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5)
+				&& ShouldCompileHalfPrecisionPermutation<FPermutationDomain>(Parameters);
+		}
+
+		static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+		{
+			FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+			ModifyHalfPrecisionCompilationEnvironment<FPermutationDomain>(Parameters, OutEnvironment);
 		}
 	};
 
+	IMPLEMENT_GLOBAL_SHADER(FUpsampleCombineCS, "/Plugin/CustomLensFlare/DownsampleThreshold.usf", "UpsampleCombineCS", SF_Compute);
 
-	class FKawaseBlurUpPS : public FGlobalShader
+	// Tile classification
+	class FLensFlareClassifyTilesCS : public FGlobalShader
 	{
 	public:
-		DECLARE_GLOBAL_SHADER(FKawaseBlurUpPS);
-		SHADER_USE_PARAMETER_STRUCT(FKawaseBlurUpPS, FGlobalShader);
+		DECLARE_GLOBAL_SHADER(FLensFlareClassifyTilesCS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareClassifyTilesCS, FGlobalShader);
 
 		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
-			SHADER_PARAMETER_STRUCT_INCLUDE(FCustomLensFlarePassParameters, Pass)
+			SHADER_PARAMETER(FUintVector2, TileCount)
+			SHADER_PARAMETER(FVector2f, TileUVSize)
 			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
-			SHADER_PARAMETER(FVector2f, BufferSize)
+			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, BloomTexture)
+			SHADER_PARAMETER(FVector2f, BloomViewportSize)
+			SHADER_PARAMETER(float, BloomWeight)
+			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, SceneColorTexture)
+			SHADER_PARAMETER_STRUCT(FScreenPassTextureViewportParameters, SceneColor)
+			SHADER_PARAMETER(float, SceneColorWeight)
+			SHADER_PARAMETER_RDG_TEXTURE(Texture2D, FlareTexture)
+			SHADER_PARAMETER_RDG_TEXTURE(Texture2D, GlareTexture)
+			SHADER_PARAMETER(FVector2f, FlareViewportSize)
+			SHADER_PARAMETER(FVector2f, GlareViewportSize)
+			SHADER_PARAMETER(float, FlareWeight)
+			SHADER_PARAMETER(float, EnergyThreshold)
+			SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, RWTileList)
+			SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, RWTileCount)
 		END_SHADER_PARAMETER_STRUCT()
 
 		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
@@ -340,25 +726,17 @@ namespace
 		}
 	};
 
-	IMPLEMENT_GLOBAL_SHADER(FKawaseBlurDownPS, "/Plugin/CustomLensFlare/DualKawaseBlur.usf", "KawaseBlurDownsamplePS",
-		SF_Pixel
-		);
-	IMPLEMENT_GLOBAL_SHADER(FKawaseBlurUpPS, "/Plugin/CustomLensFlare/DualKawaseBlur.usf", "KawaseBlurUpsamplePS",
-		SF_Pixel
-		);
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareClassifyTilesCS, "/Plugin/CustomLensFlare/TileClassify.usf", "ClassifyTilesCS", SF_Compute);
 
-	// Chromatic shift shader
-	class FLensFlareChromaPS : public FGlobalShader
+	class FLensFlareBuildTileDispatchArgsCS : public FGlobalShader
 	{
 	public:
-		DECLARE_GLOBAL_SHADER(FLensFlareChromaPS);
-		SHADER_USE_PARAMETER_STRUCT(FLensFlareChromaPS, FGlobalShader);
+		DECLARE_GLOBAL_SHADER(FLensFlareBuildTileDispatchArgsCS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareBuildTileDispatchArgsCS, FGlobalShader);
 
 		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
-			RENDER_TARGET_BINDING_SLOTS()
-			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, InputTexture)
-			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
-			SHADER_PARAMETER(float, ChromaShift)
+			SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<uint>, TileCountBuffer)
+			SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, RWDispatchArgs)
 		END_SHADER_PARAMETER_STRUCT()
 
 		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
@@ -367,142 +745,1108 @@ namespace
 		}
 	};
 
-	IMPLEMENT_GLOBAL_SHADER(FLensFlareChromaPS, "/Plugin/CustomLensFlare/Chroma.usf", "ChromaPS", SF_Pixel);
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareBuildTileDispatchArgsCS, "/Plugin/CustomLensFlare/TileClassify.usf", "BuildTileDispatchArgsCS", SF_Compute);
 
-	// Ghost shader
-	class FLensFlareGhostsPS : public FGlobalShader
+	// The tiled passes write the lens flare targets as UAVs
+	bool UseTileClassification()
+	{
+		return CVarLensFlareTileClassification.GetValueOnRenderThread() != 0
+			&& UE::PixelFormat::HasCapabilities(PF_FloatRGB, EPixelFormatCapabilities::TypedUAVStore);
+	}
+
+	// Dispatch arguments for one group per listed tile. The number of tiles is only known on the GPU.
+	FRDGBufferRef AddBuildTileDispatchArgsPass(FRDGBuilder& GraphBuilder, const FGlobalShaderMap* ShaderMap, FRDGBufferRef TileCountBuffer)
+	{
+		FRDGBufferRef DispatchArgsBuffer = GraphBuilder.CreateBuffer(
+			FRDGBufferDesc::CreateIndirectDesc<FRHIDispatchIndirectParameters>(1),
+			TEXT("LensFlareTileDispatchArgs"));
+
+		FLensFlareBuildTileDispatchArgsCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareBuildTileDispatchArgsCS::FParameters>();
+		PassParameters->TileCountBuffer = GraphBuilder.CreateSRV(TileCountBuffer, PF_R32_UINT);
+		PassParameters->RWDispatchArgs = GraphBuilder.CreateUAV(DispatchArgsBuffer, PF_R32_UINT);
+
+		TShaderMapRef<FLensFlareBuildTileDispatchArgsCS> ComputeShader(ShaderMap);
+		FCustomLensFlarePSOPrecache::ValidatePrecached(ComputeShader.GetComputeShader(), TEXT("LensFlareBuildTileDispatchArgs"));
+
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("LensFlareBuildTileDispatchArgs"),
+			ComputeShader,
+			PassParameters,
+			FIntVector(1, 1, 1));
+
+		return DispatchArgsBuffer;
+	}
+
+	// Blur shader (use Dual Kawase method)
+	class FKawaseBlurDownPS : public FGlobalShader
 	{
 	public:
-		DECLARE_GLOBAL_SHADER(FLensFlareGhostsPS);
-		SHADER_USE_PARAMETER_STRUCT(FLensFlareGhostsPS, FGlobalShader);
+		DECLARE_GLOBAL_SHADER(FKawaseBlurDownPS);
+		SHADER_USE_PARAMETER_STRUCT(FKawaseBlurDownPS, FGlobalShader);
+
+		using FPermutationDomain = TShaderPermutationDomain<FLensFlareHalfPrecisionDim>;
 
 		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
 			SHADER_PARAMETER_STRUCT_INCLUDE(FCustomLensFlarePassParameters, Pass)
 			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
-			SHADER_PARAMETER_ARRAY(FVector4f, GhostColors, [8])
-			SHADER_PARAMETER_SCALAR_ARRAY(float, GhostScales, [8])
-			SHADER_PARAMETER(float, Intensity)
+			SHADER_PARAMETER(FVector2f, BufferSize)
 		END_SHADER_PARAMETER_STRUCT()
 
 		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 		{
-			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1)
+				&& ShouldCompileHalfPrecisionPermutation<FPermutationDomain>(Parameters);
+		}
+
+		static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+		{
+			FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+			ModifyHalfPrecisionCompilationEnvironment<FPermutationDomain>(Parameters, OutEnvironment);
 		}
 	};
 
-	IMPLEMENT_GLOBAL_SHADER(FLensFlareGhostsPS, "/Plugin/CustomLensFlare/Ghosts.usf", "GhostsPS", SF_Pixel);
 
-	class FLensFlareHaloPS : public FGlobalShader
+	class FKawaseBlurUpPS : public FGlobalShader
 	{
 	public:
-		DECLARE_GLOBAL_SHADER(FLensFlareHaloPS);
-		SHADER_USE_PARAMETER_STRUCT(FLensFlareHaloPS, FGlobalShader);
+		DECLARE_GLOBAL_SHADER(FKawaseBlurUpPS);
+		SHADER_USE_PARAMETER_STRUCT(FKawaseBlurUpPS, FGlobalShader);
+
+		using FPermutationDomain = TShaderPermutationDomain<FLensFlareHalfPrecisionDim>;
 
 		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
-			RENDER_TARGET_BINDING_SLOTS()
-			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, InputTexture)
+			SHADER_PARAMETER_STRUCT_INCLUDE(FCustomLensFlarePassParameters, Pass)
 			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
-			SHADER_PARAMETER(float, Width)
-			SHADER_PARAMETER(float, Mask)
-			SHADER_PARAMETER(float, Compression)
-			SHADER_PARAMETER(float, Intensity)
-			SHADER_PARAMETER(float, ChromaShift)
+			SHADER_PARAMETER(FVector2f, BufferSize)
 		END_SHADER_PARAMETER_STRUCT()
 
 		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 		{
-			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1)
+				&& ShouldCompileHalfPrecisionPermutation<FPermutationDomain>(Parameters);
+		}
+
+		static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+		{
+			FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+			ModifyHalfPrecisionCompilationEnvironment<FPermutationDomain>(Parameters, OutEnvironment);
 		}
 	};
 
-	IMPLEMENT_GLOBAL_SHADER(FLensFlareHaloPS, "/Plugin/CustomLensFlare/Halo.usf", "HaloPS", SF_Pixel);
+	IMPLEMENT_GLOBAL_SHADER(FKawaseBlurDownPS, "/Plugin/CustomLensFlare/DualKawaseBlur.usf", "KawaseBlurDownsamplePS",
+		SF_Pixel
+		);
+	IMPLEMENT_GLOBAL_SHADER(FKawaseBlurUpPS, "/Plugin/CustomLensFlare/DualKawaseBlur.usf", "KawaseBlurUpsamplePS",
+		SF_Pixel
+		);
 
-	// Glare shader pass
-	class FLensFlareGlareVS : public FGlobalShader
+	// Separable gaussian blur in compute, see RenderBlur()
+	class FLensFlareSeparableBlurCS : public FGlobalShader
 	{
 	public:
-		DECLARE_GLOBAL_SHADER(FLensFlareGlareVS);
-		SHADER_USE_PARAMETER_STRUCT(FLensFlareGlareVS, FGlobalShader);
+		DECLARE_GLOBAL_SHADER(FLensFlareSeparableBlurCS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareSeparableBlurCS, FGlobalShader);
+
+		using FPermutationDomain = TShaderPermutationDomain<FLensFlareHalfPrecisionDim>;
 
 		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
-			RENDER_TARGET_BINDING_SLOTS()
-			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, InputTexture)
-			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
-			SHADER_PARAMETER(FIntPoint, TileCount)
-			SHADER_PARAMETER(FVector4f, PixelSize)
-			SHADER_PARAMETER(FVector2f, BufferSize)
+			SHADER_PARAMETER_RDG_TEXTURE(Texture2D, InputTexture)
+			SHADER_PARAMETER(FUintVector2, InputViewportMin)
+			SHADER_PARAMETER(FUintVector2, ViewportSize)
+			SHADER_PARAMETER(FUintVector2, BlurAxis)
+			SHADER_PARAMETER(int32, BlurRadius)
+			SHADER_PARAMETER(float, BlurInvTwoSigmaSquared)
+			SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float3>, RWOutput)
 		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5)
+				&& ShouldCompileHalfPrecisionPermutation<FPermutationDomain>(Parameters);
+		}
+
+		static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+		{
+			FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+			ModifyHalfPrecisionCompilationEnvironment<FPermutationDomain>(Parameters, OutEnvironment);
+		}
+	};
+
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareSeparableBlurCS, "/Plugin/CustomLensFlare/SeparableBlur.usf", "SeparableBlurCS", SF_Compute);
+
+	// Must match BLUR_TILE_SIZE and BLUR_MAX_RADIUS in SeparableBlur.usf
+	constexpr int32 SeparableBlurTileSize = 64;
+	constexpr int32 SeparableBlurMaxRadius = 32;
+
+	// A horizontal and a vertical pass, the output starts at the origin
+	FScreenPassTexture AddSeparableBlurPasses(FRDGBuilder& GraphBuilder, const FGlobalShaderMap* ShaderMap, const FScreenPassTexture& InputTexture, float Sigma, int32 Radius, bool bHalfPrecision)
+	{
+		check(Radius <= SeparableBlurMaxRadius);
+		const FIntPoint Size = InputTexture.ViewRect.Size();
+
+		FRDGTextureDesc Description = InputTexture.Texture->Desc;
+		Description.Reset();
+		Description.Extent = GetTargetExtent(InputTexture.Texture->Desc.Extent, 1, Size);
+		Description.Format = PF_FloatRGB;
+		Description.NumMips = 1;
+		Description.Flags |= TexCreate_UAV;
+		Description.ClearValue = FClearValueBinding(FLinearColor::Transparent);
+
+		FLensFlareSeparableBlurCS::FPermutationDomain PermutationVector;
+		PermutationVector.Set<FLensFlareHalfPrecisionDim>(bHalfPrecision);
+		TShaderMapRef<FLensFlareSeparableBlurCS> ComputeShader(ShaderMap, PermutationVector);
+		FCustomLensFlarePSOPrecache::ValidatePrecached(ComputeShader.GetComputeShader(), TEXT("LensFlareSeparableBlur"));
+		FRDGTextureRef PreviousTexture = InputTexture.Texture;
+		FIntPoint PreviousMin = InputTexture.ViewRect.Min;
+
+		for (const FIntPoint Axis : {FIntPoint(1, 0), FIntPoint(0, 1)})
+		{
+			FRDGTextureRef Texture = CreateTarget(GraphBuilder, Description, Axis.X ? TEXT("LensFlareBlurX") : TEXT("LensFlareBlurY"));
+			if (Axis.Y && Description.Extent != Size)
+			{
+				// Only the viewport is written, the bilinear taps of later passes need black around it
+				AddClearUAVPass(GraphBuilder, GraphBuilder.CreateUAV(Texture), FLinearColor::Transparent);
+			}
+
+			FLensFlareSeparableBlurCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareSeparableBlurCS::FParameters>();
+			PassParameters->InputTexture = PreviousTexture;
+			PassParameters->InputViewportMin = FUintVector2(PreviousMin.X, PreviousMin.Y);
+			PassParameters->ViewportSize = FUintVector2(Size.X, Size.Y);
+			PassParameters->BlurAxis = FUintVector2(Axis.X, Axis.Y);
+			PassParameters->BlurRadius = Radius;
+			PassParameters->BlurInvTwoSigmaSquared = 1.0f / (2.0f * Sigma * Sigma);
+			PassParameters->RWOutput = GraphBuilder.CreateUAV(Texture);
+
+			// One group per run of pixels along the axis, one row of groups per line across it
+			const int32 AxisSize = Axis.X ? Size.X : Size.Y;
+			const int32 LineCount = Axis.X ? Size.Y : Size.X;
+
+			FComputeShaderUtils::AddPass(
+				GraphBuilder,
+				RDG_EVENT_NAME("SeparableBlur_%s %dx%d radius %d", Axis.X ? TEXT("X") : TEXT("Y"), Size.X, Size.Y, Radius),
+				ComputeShader,
+				PassParameters,
+				FIntVector(FMath::DivideAndRoundUp(AxisSize, SeparableBlurTileSize), LineCount, 1));
+
+			PreviousTexture = Texture;
+			PreviousMin = FIntPoint::ZeroValue;
+		}
+
+		return FScreenPassTexture(PreviousTexture, FIntRect(FIntPoint::ZeroValue, Size));
+	}
+
+	// Chromatic shift shader
+	class FLensFlareChromaPS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareChromaPS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareChromaPS, FGlobalShader);
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			RENDER_TARGET_BINDING_SLOTS()
+			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, InputTexture)
+			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
+			SHADER_PARAMETER(FVector2f, InputViewportSize)
+			SHADER_PARAMETER(float, ChromaShift)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+		}
+	};
+
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareChromaPS, "/Plugin/CustomLensFlare/Chroma.usf", "ChromaPS", SF_Pixel);
+
+	// Must match FGhost in Ghosts.usf
+	struct FLensFlareGhost
+	{
+		// Color premultiplied by its alpha
+		FVector3f Color;
+		float Scale;
+	};
+
+	// Ghost shader
+	class FLensFlareGhostsPS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareGhostsPS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareGhostsPS, FGlobalShader);
+
+		class FUseLUTDim : SHADER_PERMUTATION_BOOL("USE_LUT");
+		using FPermutationDomain = TShaderPermutationDomain<FUseLUTDim, FLensFlareHalfPrecisionDim>;
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER_STRUCT_INCLUDE(FCustomLensFlarePassParameters, Pass)
+			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
+			SHADER_PARAMETER(FVector2f, InputViewportSize)
+			SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<FLensFlareGhost>, Ghosts)
+			SHADER_PARAMETER(uint32, GhostCount)
+			SHADER_PARAMETER(float, Intensity)
+			SHADER_PARAMETER_RDG_TEXTURE(Texture2D, GhostMaskLUT)
+			SHADER_PARAMETER_SAMPLER(SamplerState, GhostMaskLUTSampler)
+			SHADER_PARAMETER(float, GhostMaskLUTInvRows)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			// The LUT is baked in compute, which the mobile pipeline doesn't use
+			const FPermutationDomain PermutationVector(Parameters.PermutationId);
+			return IsFeatureLevelSupported(Parameters.Platform, PermutationVector.Get<FUseLUTDim>() ? ERHIFeatureLevel::SM5 : ERHIFeatureLevel::ES3_1)
+				&& ShouldCompileHalfPrecisionPermutation<FPermutationDomain>(Parameters);
+		}
+
+		static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+		{
+			FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+			ModifyHalfPrecisionCompilationEnvironment<FPermutationDomain>(Parameters, OutEnvironment);
+		}
+	};
+
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareGhostsPS, "/Plugin/CustomLensFlare/Ghosts.usf", "GhostsPS", SF_Pixel);
+
+	class FLensFlareHaloPS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareHaloPS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareHaloPS, FGlobalShader);
+
+		class FUseLUTDim : SHADER_PERMUTATION_BOOL("USE_LUT");
+		using FPermutationDomain = TShaderPermutationDomain<FUseLUTDim, FLensFlareHalfPrecisionDim>;
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			RENDER_TARGET_BINDING_SLOTS()
+			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, InputTexture)
+			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
+			SHADER_PARAMETER(FVector2f, InputViewportSize)
+			SHADER_PARAMETER(float, Width)
+			SHADER_PARAMETER(float, Mask)
+			SHADER_PARAMETER(float, Compression)
+			SHADER_PARAMETER(float, Intensity)
+			SHADER_PARAMETER(float, ChromaShift)
+			SHADER_PARAMETER_RDG_TEXTURE(Texture2D, HaloLUT)
+			SHADER_PARAMETER_SAMPLER(SamplerState, HaloLUTSampler)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			// The LUT is baked in compute, which the mobile pipeline doesn't use
+			const FPermutationDomain PermutationVector(Parameters.PermutationId);
+			return IsFeatureLevelSupported(Parameters.Platform, PermutationVector.Get<FUseLUTDim>() ? ERHIFeatureLevel::SM5 : ERHIFeatureLevel::ES3_1)
+				&& ShouldCompileHalfPrecisionPermutation<FPermutationDomain>(Parameters);
+		}
+
+		static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+		{
+			FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+			ModifyHalfPrecisionCompilationEnvironment<FPermutationDomain>(Parameters, OutEnvironment);
+		}
+	};
+
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareHaloPS, "/Plugin/CustomLensFlare/Halo.usf", "HaloPS", SF_Pixel);
+
+	// The ghost sprites and the analytic flares are drawn indirectly and read their lights from buffers in the vertex
+	// shader. Mobile has the compute and the indirect draws, but not every mobile platform has buffers in vertex shaders.
+	bool SupportsAnalyticFlares(EShaderPlatform Platform)
+	{
+		return IsFeatureLevelSupported(Platform, ERHIFeatureLevel::SM5)
+			|| (IsFeatureLevelSupported(Platform, ERHIFeatureLevel::ES3_1) && FDataDrivenShaderPlatformInfo::GetSupportsVertexShaderSRVs(Platform));
+	}
+
+	// Must match FGhostSource in GhostSprites.usf
+	struct FLensFlareGhostSource
+	{
+		FVector2f Position;
+		float Extent;
+		FVector3f Color;
+	};
+
+	// Sprite ghosts
+	class FLensFlareExtractGhostSourcesCS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareExtractGhostSourcesCS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareExtractGhostSourcesCS, FGlobalShader);
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, SourceTexture)
+			SHADER_PARAMETER(FUintVector2, SourceSize)
+			SHADER_PARAMETER(float, MinLuminance)
+			SHADER_PARAMETER(uint32, MaxSources)
+			SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<FLensFlareGhostSource>, RWSources)
+			SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, RWSourceCount)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+		}
+	};
+
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareExtractGhostSourcesCS, "/Plugin/CustomLensFlare/GhostSprites.usf", "ExtractSourcesCS", SF_Compute);
+
+	class FLensFlareBuildGhostSpriteArgsCS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareBuildGhostSpriteArgsCS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareBuildGhostSpriteArgsCS, FGlobalShader);
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<uint>, SourceCount)
+			SHADER_PARAMETER(uint32, MaxSources)
+			SHADER_PARAMETER(uint32, InstancesPerSource)
+			SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, RWDrawArgs)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return SupportsAnalyticFlares(Parameters.Platform);
+		}
+	};
+
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareBuildGhostSpriteArgsCS, "/Plugin/CustomLensFlare/GhostSprites.usf", "BuildGhostSpriteArgsCS", SF_Compute);
+
+	class FLensFlareGhostSpriteVS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareGhostSpriteVS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareGhostSpriteVS, FGlobalShader);
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<FLensFlareGhostSource>, Sources)
+			SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<FLensFlareGhost>, Ghosts)
+			SHADER_PARAMETER(uint32, GhostCount)
+			SHADER_PARAMETER(FVector2f, SourceInvSize)
+			SHADER_PARAMETER(float, SpriteSize)
+			SHADER_PARAMETER(float, Intensity)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return SupportsAnalyticFlares(Parameters.Platform);
+		}
+	};
+
+	class FLensFlareGhostSpritePS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareGhostSpritePS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareGhostSpritePS, FGlobalShader);
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER_TEXTURE(Texture2D, SpriteTexture)
+			SHADER_PARAMETER_SAMPLER(SamplerState, SpriteSampler)
+			SHADER_PARAMETER(uint32, bHasSpriteTexture)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return SupportsAnalyticFlares(Parameters.Platform);
+		}
+	};
+
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareGhostSpriteVS, "/Plugin/CustomLensFlare/GhostSprites.usf", "GhostSpriteVS", SF_Vertex);
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareGhostSpritePS, "/Plugin/CustomLensFlare/GhostSprites.usf", "GhostSpritePS", SF_Pixel);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FLensFlareGhostSpritePassParameters,)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FLensFlareGhostSpriteVS::FParameters, VS)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FLensFlareGhostSpritePS::FParameters, PS)
+		RDG_BUFFER_ACCESS(IndirectDrawArgs, ERHIAccess::IndirectArgs)
+		RENDER_TARGET_BINDING_SLOTS()
+	END_SHADER_PARAMETER_STRUCT()
+
+	// Must match FAnalyticSource in AnalyticFlare.usf
+	struct FLensFlareAnalyticSource
+	{
+		FVector2f Position;
+		float DeviceZ;
+		float Extent;
+		FVector3f Color;
+	};
+
+	// Analytic flares
+	class FLensFlareFlareVisibilityCS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareFlareVisibilityCS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareFlareVisibilityCS, FGlobalShader);
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<FLensFlareAnalyticSource>, AnalyticSources)
+			SHADER_PARAMETER_RDG_TEXTURE(Texture2D, SceneDepthTexture)
+			SHADER_PARAMETER(uint32, bUseSceneDepth)
+			SHADER_PARAMETER(FIntVector4, DepthViewRect)
+			SHADER_PARAMETER(float, OcclusionRadius)
+			SHADER_PARAMETER(uint32, MaxSources)
+			SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<FLensFlareGhostSource>, RWSources)
+			SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, RWSourceCount)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return SupportsAnalyticFlares(Parameters.Platform);
+		}
+	};
+
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareFlareVisibilityCS, "/Plugin/CustomLensFlare/AnalyticFlare.usf", "FlareVisibilityCS", SF_Compute);
+
+	class FLensFlareAnalyticGlareVS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareAnalyticGlareVS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareAnalyticGlareVS, FGlobalShader);
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<FLensFlareGhostSource>, Sources)
+			SHADER_PARAMETER(float, InvAspectRatio)
+			SHADER_PARAMETER(float, GlareSize)
+			SHADER_PARAMETER(FVector3f, GlareTint)
+			SHADER_PARAMETER(float, GlareIntensity)
+			SHADER_PARAMETER(float, HaloWidth)
+			SHADER_PARAMETER(float, HaloIntensity)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return SupportsAnalyticFlares(Parameters.Platform);
+		}
+	};
+
+	class FLensFlareAnalyticGlarePS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareAnalyticGlarePS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareAnalyticGlarePS, FGlobalShader);
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER(FVector3f, GlareAngles)
+			SHADER_PARAMETER(FVector3f, GlareScales)
+			SHADER_PARAMETER(float, GlareDivider)
+			SHADER_PARAMETER(float, HaloWidth)
+			SHADER_PARAMETER(float, HaloMask)
+			SHADER_PARAMETER(float, HaloChromaShift)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return SupportsAnalyticFlares(Parameters.Platform);
+		}
+	};
+
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareAnalyticGlareVS, "/Plugin/CustomLensFlare/AnalyticFlare.usf", "AnalyticGlareVS", SF_Vertex);
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareAnalyticGlarePS, "/Plugin/CustomLensFlare/AnalyticFlare.usf", "AnalyticGlarePS", SF_Pixel);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FLensFlareAnalyticGlarePassParameters,)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FLensFlareAnalyticGlareVS::FParameters, VS)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FLensFlareAnalyticGlarePS::FParameters, PS)
+		RDG_BUFFER_ACCESS(IndirectDrawArgs, ERHIAccess::IndirectArgs)
+		RENDER_TARGET_BINDING_SLOTS()
+	END_SHADER_PARAMETER_STRUCT()
+
+	// Culls ghosts that wouldn't be visible and keeps the brightest ones if there are too many.
+	// Returns the number of ghosts, OutGhosts gets a dummy entry if that is 0 since structured buffers can't be empty.
+	uint32 GatherGhosts(const FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy& RenderProxy, TArray<FLensFlareGhost, TInlineAllocator<32>>& OutGhosts)
+	{
+		for (const FLensFlareGhostSettings& GhostSettings : RenderProxy.Ghosts)
+		{
+			const FLinearColor Color = GhostSettings.Color * GhostSettings.Color.A;
+			if (FMath::Abs(GhostSettings.Scale) <= UE_KINDA_SMALL_NUMBER || Color.GetMax() * RenderProxy.GhostIntensity <= UE_KINDA_SMALL_NUMBER)
+				continue;
+
+			OutGhosts.Add({FVector3f(Color.R, Color.G, Color.B), GhostSettings.Scale});
+		}
+
+		OutGhosts.StableSort([](const FLensFlareGhost& A, const FLensFlareGhost& B)
+		{
+			return A.Color.GetMax() > B.Color.GetMax();
+		});
+		OutGhosts.SetNum(FMath::Min(OutGhosts.Num(), FMath::Max(CVarLensFlareMaxGhosts.GetValueOnRenderThread(), 0)));
+
+		const uint32 GhostCount = OutGhosts.Num();
+		if (OutGhosts.IsEmpty())
+		{
+			OutGhosts.Add({FVector3f::ZeroVector, 0.0f});
+		}
+		return GhostCount;
+	}
+
+	// Draw arguments for InstancesPerSource quads per source. The number of sources is only known on the GPU.
+	FRDGBufferRef AddBuildSpriteArgsPass(FRDGBuilder& GraphBuilder, const FGlobalShaderMap* ShaderMap, FRDGBufferRef SourceCountBuffer, uint32 MaxSources, uint32 InstancesPerSource)
+	{
+		FRDGBufferRef DrawArgsBuffer = GraphBuilder.CreateBuffer(
+			FRDGBufferDesc::CreateIndirectDesc<FRHIDrawIndirectParameters>(1),
+			TEXT("LensFlareSpriteArgs"));
+
+		FLensFlareBuildGhostSpriteArgsCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareBuildGhostSpriteArgsCS::FParameters>();
+		PassParameters->SourceCount = GraphBuilder.CreateSRV(SourceCountBuffer, PF_R32_UINT);
+		PassParameters->MaxSources = MaxSources;
+		PassParameters->InstancesPerSource = InstancesPerSource;
+		PassParameters->RWDrawArgs = GraphBuilder.CreateUAV(DrawArgsBuffer, PF_R32_UINT);
+
+		TShaderMapRef<FLensFlareBuildGhostSpriteArgsCS> ComputeShader(ShaderMap);
+		FCustomLensFlarePSOPrecache::ValidatePrecached(ComputeShader.GetComputeShader(), TEXT("LensFlareBuildSpriteArgs"));
+
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("LensFlareBuildSpriteArgs"),
+			ComputeShader,
+			PassParameters,
+			FIntVector(1, 1, 1));
+
+		return DrawArgsBuffer;
+	}
+
+	// Glare shader pass
+	class FLensFlareGlareVS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareGlareVS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareGlareVS, FGlobalShader);
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			RENDER_TARGET_BINDING_SLOTS()
+			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, InputTexture)
+			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
+			SHADER_PARAMETER(FVector2f, InputViewportSize)
+			SHADER_PARAMETER(FIntPoint, TileCount)
+			SHADER_PARAMETER(FVector4f, PixelSize)
+			SHADER_PARAMETER(FVector2f, BufferSize)
+			SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<float4>, EyeAdaptationBuffer)
+			SHADER_PARAMETER(float, ExposureScale)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5)
+				&& RHISupportsGeometryShaders(Parameters.Platform);
+		}
 	};
 
 	class FLensFlareGlareGS : public FGlobalShader
 	{
 	public:
-		DECLARE_GLOBAL_SHADER(FLensFlareGlareGS);
-		SHADER_USE_PARAMETER_STRUCT(FLensFlareGlareGS, FGlobalShader);
+		DECLARE_GLOBAL_SHADER(FLensFlareGlareGS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareGlareGS, FGlobalShader);
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER(FVector4f, PixelSize)
+			SHADER_PARAMETER(FVector2f, BufferSize)
+			SHADER_PARAMETER(FVector2f, BufferRatio)
+			SHADER_PARAMETER(float, GlareIntensity)
+			SHADER_PARAMETER(float, GlareDivider)
+			SHADER_PARAMETER(FVector4f, GlareTint)
+			SHADER_PARAMETER_SCALAR_ARRAY(float, GlareScales, [3])
+			SHADER_PARAMETER_SCALAR_ARRAY(float, GlareAngles, [3])
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5)
+				&& RHISupportsGeometryShaders(Parameters.Platform);
+		}
+	};
+
+	// Color and luminance of every glare tile, so FLensFlareGlareQuadVS reads them once per vertex
+	class FLensFlareGlareTilePS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareGlareTilePS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareGlareTilePS, FGlobalShader);
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			RENDER_TARGET_BINDING_SLOTS()
+			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, InputTexture)
+			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
+			SHADER_PARAMETER(FVector2f, InputViewportSize)
+			SHADER_PARAMETER(FIntPoint, TileCount)
+			SHADER_PARAMETER(FVector4f, PixelSize)
+			SHADER_PARAMETER(FVector2f, BufferSize)
+			SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<float4>, EyeAdaptationBuffer)
+			SHADER_PARAMETER(float, ExposureScale)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+		}
+	};
+
+	// Draws the quads of GlareVS and GlareGS as instanced triangles, for the mobile pipeline and platforms without geometry shaders
+	class FLensFlareGlareQuadVS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareGlareQuadVS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareGlareQuadVS, FGlobalShader);
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER_RDG_TEXTURE(Texture2D, GlareTileTexture)
+			SHADER_PARAMETER(FIntPoint, TileCount)
+			SHADER_PARAMETER(FVector2f, BufferSize)
+			SHADER_PARAMETER(FVector2f, BufferRatio)
+			SHADER_PARAMETER(float, GlareIntensity)
+			SHADER_PARAMETER(float, GlareDivider)
+			SHADER_PARAMETER(FVector4f, GlareTint)
+			SHADER_PARAMETER_SCALAR_ARRAY(float, GlareScales, [3])
+			SHADER_PARAMETER_SCALAR_ARRAY(float, GlareAngles, [3])
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1);
+		}
+	};
+
+	class FLensFlareGlarePS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareGlarePS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareGlarePS, FGlobalShader);
+
+		// Draws into the engine bloom directly, see r.LensFlare.CompositeIntoEngineBloom
+		class FCompositeDim : SHADER_PERMUTATION_BOOL("COMPOSITE");
+		using FPermutationDomain = TShaderPermutationDomain<FCompositeDim, FLensFlareHalfPrecisionDim>;
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER_SAMPLER(SamplerState, GlareSampler)
+			SHADER_PARAMETER_TEXTURE(Texture2D, GlareTexture)
+			SHADER_PARAMETER(FVector2f, OutputViewportMin)
+			SHADER_PARAMETER(FVector2f, OutputViewportInvSize)
+			SHADER_PARAMETER(float, FlareIntensity)
+			SHADER_PARAMETER(FVector4f, FlareTint)
+			SHADER_PARAMETER_TEXTURE(Texture2D, FlareGradientTexture)
+			SHADER_PARAMETER_SAMPLER(SamplerState, FlareGradientSampler)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			// Only the desktop renderer has an engine bloom to composite into
+			const FPermutationDomain PermutationVector(Parameters.PermutationId);
+			return IsFeatureLevelSupported(Parameters.Platform, PermutationVector.Get<FCompositeDim>() ? ERHIFeatureLevel::SM5 : ERHIFeatureLevel::ES3_1)
+				&& ShouldCompileHalfPrecisionPermutation<FPermutationDomain>(Parameters);
+		}
+
+		static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+		{
+			FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+			ModifyHalfPrecisionCompilationEnvironment<FPermutationDomain>(Parameters, OutEnvironment);
+		}
+	};
+
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareGlareVS, "/Plugin/CustomLensFlare/Glare.usf", "GlareVS", SF_Vertex);
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareGlareGS, "/Plugin/CustomLensFlare/Glare.usf", "GlareGS", SF_Geometry);
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareGlareTilePS, "/Plugin/CustomLensFlare/Glare.usf", "GlareTilePS", SF_Pixel);
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareGlareQuadVS, "/Plugin/CustomLensFlare/Glare.usf", "GlareQuadVS", SF_Vertex);
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareGlarePS, "/Plugin/CustomLensFlare/Glare.usf", "GlarePS", SF_Pixel);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FLensFlareGlareQuadPassParameters,)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FLensFlareGlareQuadVS::FParameters, VS)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FLensFlareGlarePS::FParameters, PS)
+		RENDER_TARGET_BINDING_SLOTS()
+	END_SHADER_PARAMETER_STRUCT()
+
+	// Glare quads per tile, 2 triangles for each of the 3 leaves
+	constexpr uint32 GlareQuadTriangles = 6;
+
+	// The glare is expanded in a geometry shader where there is one, see FLensFlareGlareQuadVS
+	bool UseGlareGeometryShader(const FViewInfo& View)
+	{
+		return View.GetFeatureLevel() >= ERHIFeatureLevel::SM5 && RHISupportsGeometryShaders(View.GetShaderPlatform());
+	}
+
+	// Streak glare, see RenderStreaks()
+	class FLensFlareStreakPrefilterPS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareStreakPrefilterPS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareStreakPrefilterPS, FGlobalShader);
+
+		using FPermutationDomain = TShaderPermutationDomain<FLensFlareHalfPrecisionDim>;
 
 		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
-			SHADER_PARAMETER(FVector4f, PixelSize)
-			SHADER_PARAMETER(FVector2f, BufferSize)
-			SHADER_PARAMETER(FVector2f, BufferRatio)
-			SHADER_PARAMETER(float, GlareIntensity)
-			SHADER_PARAMETER(float, GlareDivider)
-			SHADER_PARAMETER(FVector4f, GlareTint)
-			SHADER_PARAMETER_SCALAR_ARRAY(float, GlareScales, [3])
-			SHADER_PARAMETER_SCALAR_ARRAY(float, GlareAngles, [3])
+			RENDER_TARGET_BINDING_SLOTS()
+			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, InputTexture)
+			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
+			SHADER_PARAMETER(FVector3f, StreakColor)
 		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1)
+				&& ShouldCompileHalfPrecisionPermutation<FPermutationDomain>(Parameters);
+		}
+
+		static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+		{
+			FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+			ModifyHalfPrecisionCompilationEnvironment<FPermutationDomain>(Parameters, OutEnvironment);
+		}
 	};
 
-	class FLensFlareGlarePS : public FGlobalShader
+	class FLensFlareStreakDownPS : public FGlobalShader
 	{
 	public:
-		DECLARE_GLOBAL_SHADER(FLensFlareGlarePS);
-		SHADER_USE_PARAMETER_STRUCT(FLensFlareGlarePS, FGlobalShader);
+		DECLARE_GLOBAL_SHADER(FLensFlareStreakDownPS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareStreakDownPS, FGlobalShader);
+
+		using FPermutationDomain = TShaderPermutationDomain<FLensFlareHalfPrecisionDim>;
 
 		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
-			SHADER_PARAMETER_SAMPLER(SamplerState, GlareSampler)
-			SHADER_PARAMETER_TEXTURE(Texture2D, GlareTexture)
+			SHADER_PARAMETER_STRUCT_INCLUDE(FCustomLensFlarePassParameters, Pass)
+			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
+			SHADER_PARAMETER(FVector2f, StreakAxis)
+			SHADER_PARAMETER(FVector2f, InputTexelSize)
 		END_SHADER_PARAMETER_STRUCT()
 
 		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 		{
-			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1)
+				&& ShouldCompileHalfPrecisionPermutation<FPermutationDomain>(Parameters);
+		}
+
+		static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+		{
+			FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+			ModifyHalfPrecisionCompilationEnvironment<FPermutationDomain>(Parameters, OutEnvironment);
 		}
 	};
 
-	IMPLEMENT_GLOBAL_SHADER(FLensFlareGlareVS, "/Plugin/CustomLensFlare/Glare.usf", "GlareVS", SF_Vertex);
-	IMPLEMENT_GLOBAL_SHADER(FLensFlareGlareGS, "/Plugin/CustomLensFlare/Glare.usf", "GlareGS", SF_Geometry);
-	IMPLEMENT_GLOBAL_SHADER(FLensFlareGlarePS, "/Plugin/CustomLensFlare/Glare.usf", "GlarePS", SF_Pixel);
+	class FLensFlareStreakUpPS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareStreakUpPS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareStreakUpPS, FGlobalShader);
+
+		using FPermutationDomain = TShaderPermutationDomain<FLensFlareHalfPrecisionDim>;
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER_STRUCT_INCLUDE(FCustomLensFlarePassParameters, Pass)
+			SHADER_PARAMETER_RDG_TEXTURE(Texture2D, HighTexture)
+			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
+			SHADER_PARAMETER(FVector2f, StreakAxis)
+			SHADER_PARAMETER(FVector2f, InputTexelSize)
+			SHADER_PARAMETER(FVector2f, InputViewportSize)
+			SHADER_PARAMETER(FVector2f, HighViewportSize)
+			SHADER_PARAMETER(float, Stretch)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1)
+				&& ShouldCompileHalfPrecisionPermutation<FPermutationDomain>(Parameters);
+		}
+
+		static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+		{
+			FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+			ModifyHalfPrecisionCompilationEnvironment<FPermutationDomain>(Parameters, OutEnvironment);
+		}
+	};
+
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareStreakPrefilterPS, "/Plugin/CustomLensFlare/Streak.usf", "StreakPrefilterPS", SF_Pixel);
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareStreakDownPS, "/Plugin/CustomLensFlare/Streak.usf", "StreakDownsamplePS", SF_Pixel);
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareStreakUpPS, "/Plugin/CustomLensFlare/Streak.usf", "StreakUpsamplePS", SF_Pixel);
+
+	// The streak chain halves the resolution along the axis down to this many texels
+	constexpr int32 StreakMinSizeLog2 = 3;
 
 	// Final bloom mix shader
 
+	BEGIN_SHADER_PARAMETER_STRUCT(FLensFlareMixParameters,)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, InputTexture)
+		SHADER_PARAMETER(FVector2f, InputViewportSize)
+		SHADER_PARAMETER(FIntVector, MixPass)
+		SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
+		SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, BloomTexture)
+		SHADER_PARAMETER(float, BloomIntensity)
+		SHADER_PARAMETER_STRUCT(FScreenPassTextureViewportParameters, Bloom)
+		SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, SceneColorTexture)
+		SHADER_PARAMETER_STRUCT(FScreenPassTextureViewportParameters, SceneColor)
+		SHADER_PARAMETER(float, BloomRadius)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, GlareTexture)
+		SHADER_PARAMETER(FVector2f, GlareViewportSize)
+		SHADER_PARAMETER(FVector2f, GlarePixelSize)
+		SHADER_PARAMETER(float, FlareIntensity)
+		SHADER_PARAMETER(FVector4f, FlareTint)
+		SHADER_PARAMETER_TEXTURE(Texture2D, FlareGradientTexture)
+		SHADER_PARAMETER_SAMPLER(SamplerState, FlareGradientSampler)
+	END_SHADER_PARAMETER_STRUCT()
+
+	// The mix does the last bloom upsample itself, see r.LensFlare.FuseBloomUpsample
+	class FLensFlareFuseUpsampleDim : SHADER_PERMUTATION_BOOL("FUSE_UPSAMPLE");
+
 	class FLensFlareBloomMixPS : public FGlobalShader
 	{
 	public:
 		DECLARE_GLOBAL_SHADER(FLensFlareBloomMixPS);
 		SHADER_USE_PARAMETER_STRUCT(FLensFlareBloomMixPS, FGlobalShader);
 
+		using FPermutationDomain = TShaderPermutationDomain<FLensFlareFuseUpsampleDim, FLensFlareHalfPrecisionDim>;
+
 		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
-			SHADER_PARAMETER_STRUCT_INCLUDE(FCustomLensFlarePassParameters, Pass)
-			SHADER_PARAMETER(FIntVector, MixPass)
-			SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
-			SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, BloomTexture)
-			SHADER_PARAMETER(float, BloomIntensity)
-			SHADER_PARAMETER_RDG_TEXTURE(Texture2D, GlareTexture)
-			SHADER_PARAMETER(FVector2f, GlarePixelSize)
-			SHADER_PARAMETER(float, FlareIntensity)
-			SHADER_PARAMETER(FVector4f, FlareTint)
-			SHADER_PARAMETER_TEXTURE(Texture2D, FlareGradientTexture)
-			SHADER_PARAMETER_SAMPLER(SamplerState, FlareGradientSampler)
+			RENDER_TARGET_BINDING_SLOTS()
+			SHADER_PARAMETER_STRUCT_INCLUDE(FLensFlareMixParameters, Mix)
 		END_SHADER_PARAMETER_STRUCT()
 
 		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 		{
-			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::ES3_1)
+				&& ShouldCompileHalfPrecisionPermutation<FPermutationDomain>(Parameters);
+		}
+
+		static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+		{
+			FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+			ModifyHalfPrecisionCompilationEnvironment<FPermutationDomain>(Parameters, OutEnvironment);
 		}
 	};
 
 	IMPLEMENT_GLOBAL_SHADER(FLensFlareBloomMixPS, "/Plugin/CustomLensFlare/Mix.usf", "MixPS", SF_Pixel);
 
+	// Mix for the active tiles only
+	class FLensFlareBloomMixCS : public FGlobalShader
+	{
+	public:
+		DECLARE_GLOBAL_SHADER(FLensFlareBloomMixCS);
+		SHADER_USE_PARAMETER_STRUCT(FLensFlareBloomMixCS, FGlobalShader);
+
+		using FPermutationDomain = TShaderPermutationDomain<FLensFlareFuseUpsampleDim, FLensFlareHalfPrecisionDim>;
+
+		BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+			SHADER_PARAMETER_STRUCT_INCLUDE(FLensFlareMixParameters, Mix)
+			SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<uint>, TileList)
+			SHADER_PARAMETER(FUintVector2, OutputSize)
+			SHADER_PARAMETER(FVector2f, OutputInvSize)
+			SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float3>, RWOutput)
+			RDG_BUFFER_ACCESS(IndirectDispatchArgs, ERHIAccess::IndirectArgs)
+		END_SHADER_PARAMETER_STRUCT()
+
+		static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+		{
+			return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5)
+				&& ShouldCompileHalfPrecisionPermutation<FPermutationDomain>(Parameters);
+		}
+
+		static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+		{
+			FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+			ModifyHalfPrecisionCompilationEnvironment<FPermutationDomain>(Parameters, OutEnvironment);
+		}
+	};
+
+	IMPLEMENT_GLOBAL_SHADER(FLensFlareBloomMixCS, "/Plugin/CustomLensFlare/Mix.usf", "MixCS", SF_Compute);
+
+	// The glare is drawn as points that the geometry shader expands into quads
+	FGraphicsPipelineStateInitializer MakeGlarePipelineState(
+		const TShaderMapRef<FLensFlareGlareVS>& VertexShader,
+		const TShaderMapRef<FLensFlareGlareGS>& GeometryShader,
+		const TShaderMapRef<FLensFlareGlarePS>& PixelShader,
+		FRHIBlendState* BlendState)
+	{
+		FGraphicsPipelineStateInitializer GraphicsPSOInit;
+		GraphicsPSOInit.BlendState = BlendState;
+		GraphicsPSOInit.RasterizerState = TStaticRasterizerState<>::GetRHI();
+		GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
+		GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GEmptyVertexDeclaration.VertexDeclarationRHI;
+		GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader.GetVertexShader();
+		GraphicsPSOInit.BoundShaderState.SetGeometryShader(GeometryShader.GetGeometryShader());
+		GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader.GetPixelShader();
+		GraphicsPSOInit.PrimitiveType = PT_PointList;
+		return GraphicsPSOInit;
+	}
+
+	// Instanced quads, the vertices are generated from SV_VertexID
+	FGraphicsPipelineStateInitializer MakeSpritePipelineState(
+		FRHIVertexShader* VertexShader,
+		FRHIPixelShader* PixelShader,
+		FRHIBlendState* BlendState)
+	{
+		FGraphicsPipelineStateInitializer GraphicsPSOInit;
+		GraphicsPSOInit.BlendState = BlendState;
+		GraphicsPSOInit.RasterizerState = TStaticRasterizerState<>::GetRHI();
+		GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
+		GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GEmptyVertexDeclaration.VertexDeclarationRHI;
+		GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader;
+		GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader;
+		GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+		return GraphicsPSOInit;
+	}
+
+	// Formats the engine bloom comes in that r.LensFlare.CompositeIntoEngineBloom draws into
+	const EPixelFormat EngineBloomFormats[] = {PF_FloatRGB, PF_FloatRGBA};
+
+	// Every pipeline state the passes in this file can produce.
+	// Passes that are added here need to be added to this list as well, r.LensFlare.PSOPrecache.Validate will complain otherwise.
+	void CollectLensFlarePSOs(ERHIFeatureLevel::Type FeatureLevel, FCustomLensFlarePSOCollection& OutCollection)
+	{
+		const FGlobalShaderMap* ShaderMap = GetGlobalShaderMap(FeatureLevel);
+		if (!ShaderMap || FeatureLevel < ERHIFeatureLevel::ES3_1)
+			return;
+
+		FRHIVertexShader* ScreenPassVS = TShaderMapRef<FCustomScreenPassVS>(ShaderMap).GetVertexShader();
+
+		// The mobile renderer only uses the raster passes of the reduced pipeline, see UseMobilePipeline()
+		const bool bMobile = FeatureLevel < ERHIFeatureLevel::SM5;
+
+		// The 32 bit pipelines are needed where views use the 16 bit ones as well, r.LensFlare.HalfPrecision.Check renders both
+		const EShaderPlatform ShaderPlatform = GShaderPlatformForFeatureLevel[FeatureLevel];
+		TArray<bool, TInlineAllocator<2>> HalfPrecisionPermutations = {false};
+		if (FCustomLensFlareHalfPrecision::IsSupported(ShaderPlatform))
+		{
+			HalfPrecisionPermutations.Add(true);
+		}
+
+		// Bloom
+		for (int32 PermutationId = 0; PermutationId < FDownsamplePS::FPermutationDomain::PermutationCount; ++PermutationId)
+		{
+			const FDownsamplePS::FPermutationDomain PermutationVector(PermutationId);
+			if (!HalfPrecisionPermutations.Contains(PermutationVector.Get<FLensFlareHalfPrecisionDim>()))
+				continue;
+			if (!FDownsamplePS::ShouldCompilePermutation(FGlobalShaderPermutationParameters(FDownsamplePS::GetStaticType().GetFName(), ShaderPlatform, PermutationId)))
+				continue;
+
+			OutCollection.AddScreenPass(PermutationVector.Get<FDownsamplePS::FPrefilterDim>() ? TEXT("Prefilter") : TEXT("Downsample"), ScreenPassVS, TShaderMapRef<FDownsamplePS>(ShaderMap, PermutationVector).GetPixelShader(), GetClearBlendState(), PF_FloatRGB);
+		}
+
+		// Flare
+		OutCollection.AddScreenPass(TEXT("LensFlareChromaGhost"), ScreenPassVS, TShaderMapRef<FLensFlareChromaPS>(ShaderMap).GetPixelShader(), GetClearBlendState(), PF_FloatRGB);
+
+		if (!bMobile)
+		{
+			// Tile classification
+			OutCollection.AddCompute(TEXT("LensFlareClassifyTiles"), TShaderMapRef<FLensFlareClassifyTilesCS>(ShaderMap).GetComputeShader());
+			OutCollection.AddCompute(TEXT("LensFlareBuildTileDispatchArgs"), TShaderMapRef<FLensFlareBuildTileDispatchArgsCS>(ShaderMap).GetComputeShader());
+
+			// Flare source when adding to the engine bloom
+			OutCollection.AddScreenPass(TEXT("LensFlareSource"), ScreenPassVS, TShaderMapRef<FLensFlareRescalePS>(ShaderMap).GetPixelShader(), GetClearBlendState(), PF_FloatRGB);
+
+			// Flare
+			OutCollection.AddCompute(TEXT("LensFlareExtractGhostSources"), TShaderMapRef<FLensFlareExtractGhostSourcesCS>(ShaderMap).GetComputeShader());
+		}
+
+		if (SupportsAnalyticFlares(ShaderPlatform))
+		{
+			// Ghost sprites, also drawn by the analytic flares
+			OutCollection.AddCompute(TEXT("LensFlareBuildSpriteArgs"), TShaderMapRef<FLensFlareBuildGhostSpriteArgsCS>(ShaderMap).GetComputeShader());
+			FGraphicsPipelineStateInitializer GhostSpritePSOInit = MakeSpritePipelineState(
+				TShaderMapRef<FLensFlareGhostSpriteVS>(ShaderMap).GetVertexShader(),
+				TShaderMapRef<FLensFlareGhostSpritePS>(ShaderMap).GetPixelShader(),
+				GetAdditiveBlendState());
+			FCustomLensFlarePSOPrecache::ApplyRenderTargetInfo(GhostSpritePSOInit, PF_FloatRGB);
+			OutCollection.AddGraphics(TEXT("LensFlareGhostSprites"), GhostSpritePSOInit);
+
+			// Analytic flares
+			OutCollection.AddCompute(TEXT("LensFlareFlareVisibility"), TShaderMapRef<FLensFlareFlareVisibilityCS>(ShaderMap).GetComputeShader());
+			FGraphicsPipelineStateInitializer AnalyticGlarePSOInit = MakeSpritePipelineState(
+				TShaderMapRef<FLensFlareAnalyticGlareVS>(ShaderMap).GetVertexShader(),
+				TShaderMapRef<FLensFlareAnalyticGlarePS>(ShaderMap).GetPixelShader(),
+				GetAdditiveBlendState());
+			FCustomLensFlarePSOPrecache::ApplyRenderTargetInfo(AnalyticGlarePSOInit, PF_FloatRGB);
+			OutCollection.AddGraphics(TEXT("LensFlareAnalyticGlare"), AnalyticGlarePSOInit);
+		}
+
+		const bool bGlareGeometryShader = !bMobile && RHISupportsGeometryShaders(ShaderPlatform);
+		if (!bGlareGeometryShader)
+		{
+			// The tile shader has no half precision permutation
+			OutCollection.AddScreenPass(TEXT("LensFlareGlareTiles"), ScreenPassVS, TShaderMapRef<FLensFlareGlareTilePS>(ShaderMap).GetPixelShader(), GetClearBlendState(), PF_FloatRGBA);
+		}
+
+		for (const bool bHalfPrecision : HalfPrecisionPermutations)
+		{
+			// Bloom
+			FUpsampleCombinePS::FPermutationDomain UpsamplePermutationVector;
+			UpsamplePermutationVector.Set<FLensFlareHalfPrecisionDim>(bHalfPrecision);
+			OutCollection.AddScreenPass(TEXT("UpsampleCombine"), ScreenPassVS, TShaderMapRef<FUpsampleCombinePS>(ShaderMap, UpsamplePermutationVector).GetPixelShader(), GetClearBlendState(), PF_FloatRGB);
+
+			// Blur
+			FKawaseBlurDownPS::FPermutationDomain BlurPermutationVector;
+			BlurPermutationVector.Set<FLensFlareHalfPrecisionDim>(bHalfPrecision);
+			OutCollection.AddScreenPass(TEXT("KawaseBlurDown"), ScreenPassVS, TShaderMapRef<FKawaseBlurDownPS>(ShaderMap, BlurPermutationVector).GetPixelShader(), GetClearBlendState(), PF_FloatRGB);
+			OutCollection.AddScreenPass(TEXT("KawaseBlurUp"), ScreenPassVS, TShaderMapRef<FKawaseBlurUpPS>(ShaderMap, BlurPermutationVector).GetPixelShader(), GetClearBlendState(), PF_FloatRGB);
+
+			if (!bMobile)
+			{
+				OutCollection.AddCompute(TEXT("UpsampleCombineTiled"), TShaderMapRef<FUpsampleCombineCS>(ShaderMap, UpsamplePermutationVector).GetComputeShader());
+				OutCollection.AddCompute(TEXT("LensFlareSeparableBlur"), TShaderMapRef<FLensFlareSeparableBlurCS>(ShaderMap, BlurPermutationVector).GetComputeShader());
+			}
+
+			// Flare
+			for (const bool bUseLUT : {false, true})
+			{
+				if (bUseLUT && bMobile)
+					continue;
+
+				FLensFlareGhostsPS::FPermutationDomain GhostsPermutationVector;
+				GhostsPermutationVector.Set<FLensFlareGhostsPS::FUseLUTDim>(bUseLUT);
+				GhostsPermutationVector.Set<FLensFlareHalfPrecisionDim>(bHalfPrecision);
+				OutCollection.AddScreenPass(TEXT("LensFlareGhosts"), ScreenPassVS, TShaderMapRef<FLensFlareGhostsPS>(ShaderMap, GhostsPermutationVector).GetPixelShader(), GetClearBlendState(), PF_FloatRGB);
+
+				FLensFlareHaloPS::FPermutationDomain HaloPermutationVector;
+				HaloPermutationVector.Set<FLensFlareHaloPS::FUseLUTDim>(bUseLUT);
+				HaloPermutationVector.Set<FLensFlareHalfPrecisionDim>(bHalfPrecision);
+				OutCollection.AddScreenPass(TEXT("LensFlareHalo"), ScreenPassVS, TShaderMapRef<FLensFlareHaloPS>(ShaderMap, HaloPermutationVector).GetPixelShader(), GetAdditiveBlendState(), PF_FloatRGB);
+			}
+
+			// Glare
+			FLensFlareGlarePS::FPermutationDomain GlarePermutationVector;
+			GlarePermutationVector.Set<FLensFlareGlarePS::FCompositeDim>(false);
+			GlarePermutationVector.Set<FLensFlareHalfPrecisionDim>(bHalfPrecision);
+			FGraphicsPipelineStateInitializer GlarePSOInit = bGlareGeometryShader
+				? MakeGlarePipelineState(
+					TShaderMapRef<FLensFlareGlareVS>(ShaderMap),
+					TShaderMapRef<FLensFlareGlareGS>(ShaderMap),
+					TShaderMapRef<FLensFlareGlarePS>(ShaderMap, GlarePermutationVector),
+					GetAdditiveBlendState())
+				: MakeSpritePipelineState(
+					TShaderMapRef<FLensFlareGlareQuadVS>(ShaderMap).GetVertexShader(),
+					TShaderMapRef<FLensFlareGlarePS>(ShaderMap, GlarePermutationVector).GetPixelShader(),
+					GetAdditiveBlendState());
+			FCustomLensFlarePSOPrecache::ApplyRenderTargetInfo(GlarePSOInit, PF_FloatRGB);
+			OutCollection.AddGraphics(TEXT("LensFlareGlare"), GlarePSOInit);
+
+			FLensFlareStreakDownPS::FPermutationDomain StreakPermutationVector;
+			StreakPermutationVector.Set<FLensFlareHalfPrecisionDim>(bHalfPrecision);
+			OutCollection.AddScreenPass(TEXT("LensFlareStreakPrefilter"), ScreenPassVS, TShaderMapRef<FLensFlareStreakPrefilterPS>(ShaderMap, StreakPermutationVector).GetPixelShader(), GetClearBlendState(), PF_FloatRGB);
+			OutCollection.AddScreenPass(TEXT("LensFlareStreakDown"), ScreenPassVS, TShaderMapRef<FLensFlareStreakDownPS>(ShaderMap, StreakPermutationVector).GetPixelShader(), GetClearBlendState(), PF_FloatRGB);
+			OutCollection.AddScreenPass(TEXT("LensFlareStreakUp"), ScreenPassVS, TShaderMapRef<FLensFlareStreakUpPS>(ShaderMap, StreakPermutationVector).GetPixelShader(), GetClearBlendState(), PF_FloatRGB);
+
+			if (!bMobile)
+			{
+				GlarePermutationVector.Set<FLensFlareGlarePS::FCompositeDim>(true);
+				GlarePSOInit.BoundShaderState.PixelShaderRHI = TShaderMapRef<FLensFlareGlarePS>(ShaderMap, GlarePermutationVector).GetPixelShader();
+				for (const EPixelFormat Format : EngineBloomFormats)
+				{
+					FCustomLensFlarePSOPrecache::ApplyRenderTargetInfo(GlarePSOInit, Format);
+					OutCollection.AddGraphics(TEXT("LensFlareGlare"), GlarePSOInit);
+				}
+			}
+
+			// Mix
+			FLensFlareBloomMixPS::FPermutationDomain MixPermutationVector;
+			MixPermutationVector.Set<FLensFlareHalfPrecisionDim>(bHalfPrecision);
+			for (const bool bFuseUpsample : {false, true})
+			{
+				MixPermutationVector.Set<FLensFlareFuseUpsampleDim>(bFuseUpsample);
+				OutCollection.AddScreenPass(TEXT("Mix"), ScreenPassVS, TShaderMapRef<FLensFlareBloomMixPS>(ShaderMap, MixPermutationVector).GetPixelShader(), GetClearBlendState(), PF_FloatRGB);
+				if (!bMobile)
+				{
+					OutCollection.AddCompute(TEXT("MixTiled"), TShaderMapRef<FLensFlareBloomMixCS>(ShaderMap, MixPermutationVector).GetComputeShader());
+				}
+			}
+			if (!bMobile)
+			{
+				MixPermutationVector.Set<FLensFlareFuseUpsampleDim>(false);
+				for (const EPixelFormat Format : EngineBloomFormats)
+				{
+					OutCollection.AddScreenPass(TEXT("Mix"), ScreenPassVS, TShaderMapRef<FLensFlareBloomMixPS>(ShaderMap, MixPermutationVector).GetPixelShader(), GetAdditiveBlendState(), Format);
+				}
+			}
+		}
+	}
+
+	FCustomLensFlarePSOPrecache::FRegisterCollector RegisterLensFlarePSOCollector(&CollectLensFlarePSOs);
+
 	FVector4f SizeToSizeAndInvSize(FIntPoint PixelSize)
 	{
 		check(PixelSize.X != 0);
@@ -514,68 +1858,306 @@ namespace
 	{
 		return SizeToSizeAndInvSize({PixelSize.X, PixelSize.Y});
 	}
-
-	FVector4f ViewToUVScaleAndPixelSize(FIntRect Viewport, FIntPoint FullSize)
-	{
-		return FVector4f(Viewport.Width() / FullSize.X, Viewport.Height() / FullSize.Y, 1.0 / FullSize.X, 1.0 / FullSize.Y);
-	}
 }
 
 
 FCustomLensFlareSceneViewExtension::FCustomLensFlareSceneViewExtension(const FAutoRegister& AutoRegister) :
-	FSceneViewExtensionBase(AutoRegister)
+	FSceneViewExtensionBase(AutoRegister),
+	LUTCache(MakeUnique<FCustomLensFlareLUTCache>()),
+	FrameCache(MakeUnique<FCustomLensFlareFrameCache>())
 {
 }
 
 FCustomLensFlareSceneViewExtension::~FCustomLensFlareSceneViewExtension()
 {
+	if (ConfigLoadHandle.IsValid())
+	{
+		ConfigLoadHandle->CancelHandle();
+	}
+
 	if (BloomFlaresHook.IsBoundToObject(this))
 	{
 		BloomFlaresHook.Unbind();
 	}
+
+	if (LensFlaresLayerHook.IsBoundToObject(this))
+	{
+		LensFlaresLayerHook.Unbind();
+	}
+
+	if (MobileBloomFlaresHook.IsBoundToObject(this))
+	{
+		MobileBloomFlaresHook.Unbind();
+	}
+}
+
+bool FCustomLensFlareSceneViewExtension::IsActiveThisFrame_Internal(const FSceneViewExtensionContext& Context) const
+{
+	return bHasBaseConfig;
+}
+
+void FCustomLensFlareSceneViewExtension::SetupViewFamily(FSceneViewFamily& InViewFamily)
+{
+	InViewFamily.GetOrCreateExtentionData<FCustomLensFlareSceneViewExtensionData>();
+}
+
+void FCustomLensFlareSceneViewExtension::SetupView(FSceneViewFamily& InViewFamily, FSceneView& InView)
+{
+	InViewFamily.GetExtentionData<FCustomLensFlareSceneViewExtensionData>()->GetOrCreateViewExtensionData(InView);
+}
+
+void FCustomLensFlareSceneViewExtension::BeginRenderViewFamily(FSceneViewFamily& InViewFamily)
+{
+	// Blending is done at this point, hand an immutable copy over to the render thread
+	if (FCustomLensFlareSceneViewExtensionData* ExtensionData = InViewFamily.GetExtentionData<FCustomLensFlareSceneViewExtensionData>())
+	{
+		ExtensionData->FinalizeRenderProxies(InViewFamily, ParameterOverrides);
+
+		if (ExtensionData->GetPipeline() == ECustomLensFlarePipeline::Analytic)
+		{
+			TArray<FCustomLensFlareSceneViewExtensionData::FFlareSource> FamilyFlareSources;
+			for (const TWeakObjectPtr<const UCustomLensFlareSourceComponent>& FlareSource : FlareSources)
+			{
+				const UCustomLensFlareSourceComponent* FlareSourceComponent = FlareSource.Get();
+				if (!FlareSourceComponent || !FlareSourceComponent->IsVisible() || !FlareSourceComponent->GetWorld() || FlareSourceComponent->GetWorld()->Scene != InViewFamily.Scene)
+					continue;
+
+				FamilyFlareSources.Add({FlareSourceComponent->GetComponentLocation(), FlareSourceComponent->GetFlareColor()});
+			}
+			ExtensionData->SetFlareSources(MoveTemp(FamilyFlareSources));
+		}
+	}
+}
+
+void FCustomLensFlareSceneViewExtension::Initialize()
+{
+	FString ConfigPath;
+	if (GConfig->GetString(TEXT("CustomLensFlareSceneViewExtension"), TEXT("ConfigPath"), ConfigPath, GEngineIni))
+	{
+		// The config and its textures are streamed in. Views render the neutral look until they have arrived.
+		IniConfigPath = FSoftObjectPath(ConfigPath);
+		RequestBaseConfig(IniConfigPath);
+	}
+
+	// Maps loaded during engine init registered their flare sources before this extension existed
+	for (TObjectIterator<UCustomLensFlareSourceComponent> It; It; ++It)
+	{
+		if (It->IsRegistered())
+		{
+			RegisterFlareSource(*It);
+		}
+	}
+}
+
+void FCustomLensFlareSceneViewExtension::SetBaseConfig(UCustomLensFlareConfig* NewConfig)
+{
+	check(IsInGameThread());
+
+	// A pending load must not override the config that was set after it was requested
+	if (ConfigLoadHandle.IsValid())
+	{
+		ConfigLoadHandle->CancelHandle();
+		ConfigLoadHandle.Reset();
+	}
+
+	if (!NewConfig)
+		return;
+
+	BindBloomFlaresHook();
+
+	// Families that are already in flight keep the render proxies of the old config. Its textures can only be
+	// destroyed after the render commands of those frames have executed, so dropping the reference here is safe.
+	if (Config.Get() != NewConfig)
+	{
+		Config = TStrongObjectPtr(NewConfig);
+		++ConfigGeneration;
+	}
+}
+
+void FCustomLensFlareSceneViewExtension::RequestBaseConfig(const FSoftObjectPath& ConfigPath)
+{
+	check(IsInGameThread());
+
+	if (ConfigLoadHandle.IsValid())
+	{
+		ConfigLoadHandle->CancelHandle();
+	}
+
+	BindBloomFlaresHook();
+
+	ConfigLoadHandle = StreamableManager.RequestAsyncLoad(
+		ConfigPath,
+		FStreamableDelegate::CreateSP(this, &FCustomLensFlareSceneViewExtension::OnConfigLoaded),
+		FStreamableManager::AsyncLoadHighPriority
+		);
+}
+
+void FCustomLensFlareSceneViewExtension::ResetBaseConfig()
+{
+	if (IniConfigPath.IsNull())
+		return;
+
+	RequestBaseConfig(IniConfigPath);
+}
+
+void FCustomLensFlareSceneViewExtension::NotifyConfigChanged(const UCustomLensFlareConfig* ChangedConfig)
+{
+	check(IsInGameThread());
+
+	if (ChangedConfig && ChangedConfig == Config.Get())
+	{
+		++ConfigGeneration;
+	}
+}
+
+void FCustomLensFlareSceneViewExtension::RegisterFlareSource(const UCustomLensFlareSourceComponent* FlareSource)
+{
+	check(IsInGameThread());
+	FlareSources.AddUnique(FlareSource);
+}
+
+void FCustomLensFlareSceneViewExtension::UnregisterFlareSource(const UCustomLensFlareSourceComponent* FlareSource)
+{
+	check(IsInGameThread());
+	FlareSources.RemoveAllSwap([FlareSource](const TWeakObjectPtr<const UCustomLensFlareSourceComponent>& Entry)
+	{
+		return !Entry.IsValid() || Entry.Get() == FlareSource;
+	});
+}
+
+void FCustomLensFlareSceneViewExtension::SetParameterOverride(int32 PlayerIndex, ECustomLensFlareParameter Parameter, ECustomLensFlareOverrideMode Mode, float Value)
+{
+	check(IsInGameThread());
+
+	FCustomLensFlareSceneViewExtensionData::FParameterOverride* ParameterOverride = ParameterOverrides.FindByPredicate([PlayerIndex, Parameter](const FCustomLensFlareSceneViewExtensionData::FParameterOverride& Entry)
+	{
+		return Entry.PlayerIndex == PlayerIndex && Entry.Parameter == Parameter;
+	});
+	if (!ParameterOverride)
+	{
+		ParameterOverride = &ParameterOverrides.AddDefaulted_GetRef();
+		ParameterOverride->PlayerIndex = PlayerIndex;
+		ParameterOverride->Parameter = Parameter;
+	}
+	ParameterOverride->Mode = Mode;
+	ParameterOverride->Value = Value;
+}
+
+void FCustomLensFlareSceneViewExtension::ClearParameterOverride(int32 PlayerIndex, ECustomLensFlareParameter Parameter)
+{
+	check(IsInGameThread());
+	ParameterOverrides.RemoveAll([PlayerIndex, Parameter](const FCustomLensFlareSceneViewExtensionData::FParameterOverride& Entry)
+	{
+		return Entry.PlayerIndex == PlayerIndex && Entry.Parameter == Parameter;
+	});
+}
+
+void FCustomLensFlareSceneViewExtension::ClearParameterOverrides(int32 PlayerIndex)
+{
+	check(IsInGameThread());
+	ParameterOverrides.RemoveAll([PlayerIndex](const FCustomLensFlareSceneViewExtensionData::FParameterOverride& Entry)
+	{
+		return Entry.PlayerIndex == PlayerIndex;
+	});
 }
 
-bool FCustomLensFlareSceneViewExtension::IsActiveThisFrame_Internal(const FSceneViewExtensionContext& Context) const
+void FCustomLensFlareSceneViewExtension::SetPipeline(ECustomLensFlarePipeline NewPipeline)
 {
-	return Config.IsValid();
+	check(IsInGameThread());
+	Pipeline = NewPipeline;
 }
 
-void FCustomLensFlareSceneViewExtension::SetupViewFamily(FSceneViewFamily& InViewFamily)
+void FCustomLensFlareSceneViewExtension::OnConfigLoaded()
 {
-	InViewFamily.GetOrCreateExtentionData<FCustomLensFlareSceneViewExtensionData>();
+	const TSharedPtr<FStreamableHandle> LoadedHandle = MoveTemp(ConfigLoadHandle);
+	UCustomLensFlareConfig* LoadedConfig = LoadedHandle.IsValid() ? Cast<UCustomLensFlareConfig>(LoadedHandle->GetLoadedAsset()) : nullptr;
+	ensureMsgf(LoadedConfig, TEXT("Failed to load custom lens flare config %s"), LoadedHandle.IsValid() ? *LoadedHandle->GetDebugName() : TEXT("None"));
+
+	// The strong pointer keeps the config and its textures alive from here on
+	SetBaseConfig(LoadedConfig);
 }
 
-void FCustomLensFlareSceneViewExtension::SetupView(FSceneViewFamily& InViewFamily, FSceneView& InView)
+void FCustomLensFlareSceneViewExtension::BindBloomFlaresHook()
 {
-	InViewFamily.GetExtentionData<FCustomLensFlareSceneViewExtensionData>()->GetOrCreateViewExtensionData(InView);
+	if (bHookBound)
+		return;
+
+	bHookBound = true;
+	bHasBaseConfig = true;
+
+	ENQUEUE_RENDER_COMMAND(BindBloomFlaresHook)([this](FRHICommandListImmediate&)
+	{
+		// r.PostProcessing.CustomBloomFlareMode picks which one the engine calls
+		BloomFlaresHook.BindSP(this, &FCustomLensFlareSceneViewExtension::HandleBloomFlaresHook);
+		LensFlaresLayerHook.BindSP(this, &FCustomLensFlareSceneViewExtension::HandleLensFlaresLayerHook);
+		MobileBloomFlaresHook.BindSP(this, &FCustomLensFlareSceneViewExtension::HandleMobileBloomFlaresHook);
+	});
+
+	FCustomLensFlarePSOPrecache::PrewarmOnStartupIfEnabled();
 }
 
-void FCustomLensFlareSceneViewExtension::BeginRenderViewFamily(FSceneViewFamily& InViewFamily)
+FScreenPassTexture FCustomLensFlareSceneViewExtension::HandleBloomFlaresHook(FRDGBuilder& GraphBuilder, const FViewInfo& View, FScreenPassTextureSlice SceneColor, const FTextureDownsampleChain& DownsampleChain, FRDGBufferRef EyeAdaptationBuffer)
 {
+	return RenderBloomFlares(GraphBuilder, View, SceneColor, FScreenPassTexture(), EyeAdaptationBuffer);
 }
 
-void FCustomLensFlareSceneViewExtension::Initialize()
+FScreenPassTexture FCustomLensFlareSceneViewExtension::HandleLensFlaresLayerHook(FRDGBuilder& GraphBuilder, const FViewInfo& View, FScreenPassTexture Bloom, FRDGBufferRef EyeAdaptationBuffer)
 {
-	FString ConfigPath;
-	if (GConfig->GetString(TEXT("CustomLensFlareSceneViewExtension"), TEXT("ConfigPath"), ConfigPath, GEngineIni))
-	{
-		UCustomLensFlareConfig* LoadedConfig = LoadObject<UCustomLensFlareConfig>(nullptr, *ConfigPath);
-		check(LoadedConfig);
-		Config = TStrongObjectPtr(LoadedConfig);
+	if (!Bloom.IsValid())
+		return Bloom;
 
-		ENQUEUE_RENDER_COMMAND(BindBloomFlaresHook)([this](FRHICommandListImmediate&)
-		{
-			BloomFlaresHook.BindSP(this, &FCustomLensFlareSceneViewExtension::HandleBloomFlaresHook);
-		});
-	}
+	return RenderBloomFlares(GraphBuilder, View, FScreenPassTextureSlice::CreateFromScreenPassTexture(GraphBuilder, Bloom), Bloom, EyeAdaptationBuffer);
 }
 
-FScreenPassTexture FCustomLensFlareSceneViewExtension::HandleBloomFlaresHook(FRDGBuilder& GraphBuilder, const FViewInfo& View, FScreenPassTextureSlice SceneColor, const FTextureDownsampleChain& DownsampleChain)
+FScreenPassTexture FCustomLensFlareSceneViewExtension::HandleMobileBloomFlaresHook(FRDGBuilder& GraphBuilder, const FViewInfo& View, FScreenPassTextureSlice SceneColor, FRDGBufferRef EyeAdaptationBuffer)
+{
+	return RenderBloomFlares(GraphBuilder, View, SceneColor, FScreenPassTexture(), EyeAdaptationBuffer);
+}
+
+FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderBloomFlares(FRDGBuilder& GraphBuilder, const FViewInfo& View, FScreenPassTextureSlice SceneColor, FScreenPassTexture EngineBloom, FRDGBufferRef EyeAdaptationBuffer)
 {
 	if (!SceneColor.IsValid())
 		return {};
 
-	const FCustomLensFlareSceneViewExtensionData::FPerViewExtensionData* PerViewExtensionData = GetPerViewExtensionData(View);
+	FCustomLensFlarePSOPrecache::MarkRenderedFeatureLevel(View.GetFeatureLevel());
+
+	FCustomLensFlareCapture& Capture = FCustomLensFlareCapture::Get();
+
+	const FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy* RenderProxy = GetPerViewRenderProxy(View);
+	const FCustomLensFlareSceneViewExtensionData* ExtensionData = View.Family->GetExtentionData<FCustomLensFlareSceneViewExtensionData>();
+	ECustomLensFlarePipeline ActivePipeline = Capture.GetReplayPipeline(ExtensionData ? ExtensionData->GetPipeline() : ECustomLensFlarePipeline::Full);
+
+	// Without buffers in vertex shaders the analytic sprites can't be drawn, the image based flares can
+	const bool bMobile = UseMobilePipeline(View);
+	if (ActivePipeline == ECustomLensFlarePipeline::Analytic && !SupportsAnalyticFlares(View.GetShaderPlatform()))
+	{
+		ActivePipeline = ECustomLensFlarePipeline::Full;
+	}
+
+	// The engine rendered the bloom already, we only add the flares on top
+	const bool bEngineBloom = EngineBloom.IsValid();
+	if (bEngineBloom && ActivePipeline == ECustomLensFlarePipeline::BloomOnly)
+		return EngineBloom;
+
+	// Captured frames are rendered ahead of the view's own input, see r.LensFlare.Capture and r.LensFlare.Replay
+	FCustomLensFlareHalfPrecision& HalfPrecision = FCustomLensFlareHalfPrecision::Get();
+	if (!bEngineBloom && !Capture.IsReplaying() && !HalfPrecision.IsChecking())
+	{
+		Capture.Tick();
+		Capture.Replay(GraphBuilder, View, [&](const FScreenPassTextureSlice& ReplaySceneColor)
+		{
+			return RenderBloomFlares(GraphBuilder, View, ReplaySceneColor, FScreenPassTexture(), EyeAdaptationBuffer);
+		});
+
+		// Renders the view with both precisions once requested, see r.LensFlare.HalfPrecision.Check
+		HalfPrecision.Tick();
+		const FScreenPassTexture CheckedOutput = HalfPrecision.Check(GraphBuilder, View, [&]()
+		{
+			return RenderBloomFlares(GraphBuilder, View, SceneColor, FScreenPassTexture(), EyeAdaptationBuffer);
+		});
+		if (CheckedOutput.IsValid())
+			return CheckedOutput;
+	}
 
 	RDG_GPU_STAT_SCOPE(GraphBuilder, CustomBloomFlares)
 	RDG_EVENT_SCOPE(GraphBuilder, "CustomBloomFlares");
@@ -592,6 +2174,11 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::HandleBloomFlaresHook(FRD
 		PassAmount = FMath::Min(PassAmount, DesiredPassAmount);
 	}
 
+	if (bMobile)
+	{
+		PassAmount = FMath::Min(PassAmount, CVarLensFlareMobileMaxBloomPassAmount.GetValueOnRenderThread());
+	}
+
 	// Buffers setup
 	const FScreenPassTexture BlackDummy{
 		GraphBuilder.RegisterExternalTexture(
@@ -603,44 +2190,74 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::HandleBloomFlaresHook(FRD
 	FScreenPassTextureSlice BloomTexture;
 	FScreenPassTexture FlareTexture;
 	FScreenPassTexture GlareTexture;
+	// Scene color can be a sub-region of a larger texture (editor viewports, dynamic resolution, split screen).
+	// Only the first downsample and the last upsample read it and both respect its viewport.
+	// Every texture created after that starts at the origin and spans its whole extent.
 	FScreenPassTextureSlice InputTexture(SceneColor);
 
-	// Scene color setup
-	// We need to pass a FScreenPassTexture into FScreenPassTextureViewport()
-	// and not a FRDGTextureRef (aka SceneColor.Texture) to ensure we can compute
-	// the right Rect vs Extent sub-region. Otherwise only the full buffer
-	// resolution is gonna be reported leading to NaNs/garbage in the rendering.
-	const FScreenPassTextureViewport SceneColorViewport(SceneColor);
-	const FVector2f SceneColorViewportSize = GetInputViewportSize(SceneColorViewport.Rect, SceneColorViewport.Extent);
-
 	////////////////////////////////////////////////////////////////////////
-	// Editor buffer rescale
+	// Render passes
 	////////////////////////////////////////////////////////////////////////
-
-	// Rescale the Scene Color to fit the whole texture and not use a sub-region.
-	// This is to simplify the render pass (shaders) that come after
-	if (SceneColorViewport.Rect.Width() != SceneColorViewport.Extent.X
-		|| SceneColorViewport.Rect.Height() != SceneColorViewport.Extent.Y)
+	// Exposure stays on the GPU. Scene color is pre-exposed, so that is divided out again to get what ends up on screen.
+	FRDGBufferSRVRef ExposureBuffer = nullptr;
+	float ExposureScale = 1.0f;
+	if (EyeAdaptationBuffer && CVarLensFlareExposureRelativeThreshold.GetValueOnRenderThread() != 0)
+	{
+		ExposureBuffer = GraphBuilder.CreateSRV(EyeAdaptationBuffer, PF_A32B32G32R32F);
+		ExposureScale = 1.0f / FMath::Max(View.PreExposure, UE_SMALL_NUMBER);
+	}
+	else
 	{
-		const FString SceneColorRescalePassName(TEXT("SceneColorRescale"));
+		if (!NoExposureBuffer.IsValid())
+		{
+			const FVector4f NoExposure(1.0f, 1.0f, 1.0f, 1.0f);
+			NoExposureBuffer = GraphBuilder.ConvertToExternalBuffer(
+				CreateVertexBuffer(GraphBuilder, TEXT("LensFlareNoExposure"), FRDGBufferDesc::CreateBufferDesc(sizeof(FVector4f), 1), &NoExposure, sizeof(NoExposure)));
+		}
+		ExposureBuffer = GraphBuilder.CreateSRV(GraphBuilder.RegisterExternalBuffer(NoExposureBuffer), PF_A32B32G32R32F);
+	}
 
-		// Build texture
-		FRDGTextureDesc Desc = SceneColor.TextureSRV->GetParent()->Desc;
-		Desc.Reset();
-		Desc.Extent = SceneColorViewport.Rect.Size();
-		FRDGTextureRef RescaleTexture = GraphBuilder.CreateTexture(Desc, *SceneColorRescalePassName);
-		AddCopyTexturePass(GraphBuilder, SceneColor.TextureSRV->GetParent(), RescaleTexture,
-			SceneColor.ViewRect.Min, FIntPoint::ZeroValue, SceneColor.ViewRect.Size());
+	// Views that look the same as in the previous frames show the same output again, see r.LensFlare.StaticReuse.
+	// The engine bloom is rendered anew every frame, so this only works when the plugin renders the bloom as well.
+	// The mobile pipeline has no compute pass to compare the frames with.
+	const bool bStaticReuse = !bEngineBloom && !bMobile && !Capture.IsReplaying() && !HalfPrecision.IsChecking() && FCustomLensFlareFrameCache::IsEnabled();
+	if (bStaticReuse)
+	{
+		uint32 ParameterHash = HashCombine(RenderProxy->GetHash(), GetTypeHash(uint8(ActivePipeline)));
+		ParameterHash = HashCombine(ParameterHash, ExtensionData ? ExtensionData->GetConfigGeneration() : 0);
+		ParameterHash = HashCombine(ParameterHash, GetTypeHash(View.FinalPostProcessSettings.BloomIntensity));
+		ParameterHash = HashCombine(ParameterHash, GetTypeHash(View.FinalPostProcessSettings.BloomThreshold));
+		if (ActivePipeline == ECustomLensFlarePipeline::Analytic && ExtensionData)
+		{
+			for (const FCustomLensFlareSceneViewExtensionData::FFlareSource& FlareSource : ExtensionData->GetFlareSources())
+			{
+				ParameterHash = HashCombine(ParameterHash, HashCombine(GetTypeHash(FlareSource.Position), GetTypeHash(FlareSource.Color)));
+			}
+		}
 
-		InputTexture.TextureSRV = GraphBuilder.CreateSRV(RescaleTexture);
-		InputTexture.ViewRect = SceneColorViewport.Rect;
+		const FScreenPassTexture StaticOutput = FrameCache->FindStaticOutput(
+			GraphBuilder, View, InputTexture, ParameterHash, RenderProxy->ThresholdRange, ExposureBuffer, ExposureScale);
+		if (StaticOutput.IsValid())
+			return StaticOutput;
 	}
 
-	////////////////////////////////////////////////////////////////////////
-	// Render passes
-	////////////////////////////////////////////////////////////////////////
-	FBloomFlareProcess Process{.OwningExtension = *this};
+	FBloomFlareProcess Process{
+		.OwningExtension = *this,
+		.ExposureBuffer = ExposureBuffer,
+		.ExposureScale = ExposureScale,
+		// The engine bloom covers the whole screen and there is no upsample of our own to fuse.
+		// The mobile pipeline stays in raster passes and always saves the half resolution upsample.
+		.bTileClassification = !bEngineBloom && !bMobile && UseTileClassification(),
+		.bFuseLastUpsample = !bEngineBloom && (bMobile || CVarLensFlareFuseBloomUpsample.GetValueOnRenderThread() != 0),
+		.bHalfPrecision = UseHalfPrecision(View)
+	};
 	// Bloom
+	if (bEngineBloom)
+	{
+		// Flares and glare are built from the engine bloom instead
+		BloomTexture = RenderFlareSource(GraphBuilder, InputTexture, View);
+	}
+	else
 	{
 		BloomTexture = Process.RenderBloom(
 			GraphBuilder,
@@ -648,10 +2265,50 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::HandleBloomFlaresHook(FRD
 			InputTexture,
 			PassAmount
 			);
+
+		if (Capture.IsCapturing() && !Capture.IsReplaying() && !HalfPrecision.IsChecking())
+		{
+			Capture.CaptureView(
+				GraphBuilder,
+				View,
+				*RenderProxy,
+				ActivePipeline,
+				Process.MipMapsDownsample.IsEmpty() ? MakeArrayView(&InputTexture, 1) : MakeArrayView(Process.MipMapsDownsample));
+		}
+	}
+	Capture.MarkStage(GraphBuilder, TEXT("Bloom"));
+
+	// Flares and glare can read a coarser mip of the bloom pyramid than the mix does
+	FScreenPassTextureSlice FlareSourceTexture = BloomTexture;
+	FScreenPassTextureSlice GlareSourceTexture = BloomTexture;
+	if (!bEngineBloom && BloomTexture.IsValid())
+	{
+		// Without the flare blur of the mobile pipeline, a coarser mip softens the ghosts instead
+		FlareSourceTexture = Process.GetBloomMip(CVarLensFlareFlareSourceMip.GetValueOnRenderThread() + (bMobile ? 1 : 0));
+		GlareSourceTexture = Process.GetBloomMip(CVarLensFlareGlareSourceMip.GetValueOnRenderThread());
+	}
+
+	if (ActivePipeline == ECustomLensFlarePipeline::Analytic)
+	{
+		FlareTexture = RenderAnalyticFlare(GraphBuilder, View);
+	}
+	else if (ActivePipeline != ECustomLensFlarePipeline::BloomOnly)
+	{
+		const FScreenPassTextureSlice GhostSourceTexture = bEngineBloom ? BloomTexture : Process.FindGhostSourceMip(CVarLensFlareGhostSpritesSourceResolution.GetValueOnRenderThread());
+		FlareTexture = RenderFlare(GraphBuilder, FlareSourceTexture, GhostSourceTexture, View);
 	}
+	Capture.MarkStage(GraphBuilder, TEXT("Flare"));
+
+	// Flares and glare are blended into the engine bloom itself instead of a mixed copy of it
+	const bool bCompositeIntoEngineBloom = bEngineBloom
+		&& CVarLensFlareCompositeIntoEngineBloom.GetValueOnRenderThread() != 0
+		&& EnumHasAnyFlags(EngineBloom.Texture->Desc.Flags, TexCreate_RenderTargetable);
 
-	FlareTexture = RenderFlare(GraphBuilder, BloomTexture, View);
-	GlareTexture = RenderGlare(GraphBuilder, BloomTexture, View);
+	if (ActivePipeline == ECustomLensFlarePipeline::Full)
+	{
+		GlareTexture = RenderGlare(GraphBuilder, GlareSourceTexture, ExposureBuffer, ExposureScale, View, bCompositeIntoEngineBloom ? EngineBloom : FScreenPassTexture());
+	}
+	Capture.MarkStage(GraphBuilder, TEXT("Glare"));
 
 	////////////////////////////////////////////////////////////////////////
 	// Composite Bloom, Flare and Glare together
@@ -669,7 +2326,8 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::HandleBloomFlaresHook(FRD
 
 		const FString MixPassName(TEXT("Mix"));
 
-		float BloomIntensity = PerViewExtensionData->Intensity * View.FinalPostProcessSettings.BloomIntensity;
+		// The engine applied the bloom intensity to its bloom already
+		float BloomIntensity = bEngineBloom ? 1.0f : RenderProxy->Intensity * View.FinalPostProcessSettings.BloomIntensity;
 
 		// If the internal blending for the upsample pass is additive
 		// (aka not using the lerp) then uncomment this line to
@@ -690,66 +2348,179 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::HandleBloomFlaresHook(FRD
 		// Create texture
 		FRDGTextureDesc Description = SceneColor.TextureSRV->GetParent()->Desc;
 		Description.Reset();
-		Description.Extent = MixViewport.Size();
+		Description.Extent = GetTargetExtent(View.GetSceneTexturesConfig().Extent, 2, MixViewport.Size());
 		Description.Format = PF_FloatRGB;
 		Description.ClearValue = FClearValueBinding(FLinearColor::Black);
-		MixTexture = GraphBuilder.CreateTexture(Description, *MixPassName);
-
-		// Render shader
-		TShaderMapRef<FCustomScreenPassVS> VertexShader(View.ShaderMap);
-		TShaderMapRef<FLensFlareBloomMixPS> PixelShader(View.ShaderMap);
+		if (Process.bTileClassification)
+		{
+			Description.Flags |= TexCreate_UAV;
+		}
+		if (!bCompositeIntoEngineBloom)
+		{
+			MixTexture = CreateTarget(GraphBuilder, Description, *MixPassName);
+		}
 
-		FLensFlareBloomMixPS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareBloomMixPS::FParameters>();
-		PassParameters->Pass.RenderTargets[0] = FRenderTargetBinding(MixTexture, ERenderTargetLoadAction::ENoAction);
-		PassParameters->InputSampler = BilinearClampSampler;
-		PassParameters->MixPass = BuffersValidity;
+		FLensFlareMixParameters MixParameters;
+		MixParameters.InputSampler = BilinearClampSampler;
+		MixParameters.MixPass = BuffersValidity;
 		// Bloom
-		PassParameters->BloomTexture = GraphBuilder.CreateSRV(FRDGTextureSRVDesc(BlackDummy.Texture));
-		PassParameters->BloomIntensity = BloomIntensity;
+		MixParameters.BloomTexture = GraphBuilder.CreateSRV(FRDGTextureSRVDesc(BlackDummy.Texture));
+		MixParameters.BloomIntensity = BloomIntensity;
+		MixParameters.Bloom = GetScreenPassTextureViewportParameters(FScreenPassTextureViewport(BlackDummy));
+		MixParameters.SceneColorTexture = MixParameters.BloomTexture;
+		MixParameters.SceneColor = MixParameters.Bloom;
+		MixParameters.BloomRadius = CVarBloomRadius.GetValueOnRenderThread();
 
 		// Glare
-		PassParameters->GlareTexture = BlackDummy.Texture;
-		PassParameters->GlarePixelSize = FVector2f(1.0f, 1.0f) / BufferSize;
+		MixParameters.GlareTexture = BlackDummy.Texture;
+		MixParameters.GlareViewportSize = FVector2f(1.0f, 1.0f);
+		MixParameters.GlarePixelSize = FVector2f(1.0f, 1.0f) / BufferSize;
 
 		// Flare
-		PassParameters->Pass.InputTexture = BlackDummy.Texture;
-		PassParameters->FlareIntensity = PerViewExtensionData->FlareIntensity;
-		PassParameters->FlareTint = FVector4f(PerViewExtensionData->FlareTint);
-		PassParameters->FlareGradientTexture = GWhiteTexture->TextureRHI;
-		PassParameters->FlareGradientSampler = BilinearClampSampler;
+		MixParameters.InputTexture = BlackDummy.Texture;
+		MixParameters.InputViewportSize = FVector2f(1.0f, 1.0f);
+		MixParameters.FlareIntensity = RenderProxy->FlareIntensity;
+		MixParameters.FlareTint = FVector4f(RenderProxy->FlareTint);
+		MixParameters.FlareGradientTexture = GWhiteTexture->TextureRHI;
+		MixParameters.FlareGradientSampler = BilinearClampSampler;
+
+		if (RenderProxy->GradientResource != nullptr && RenderProxy->GradientResource->TextureRHI)
+		{
+			MixParameters.FlareGradientTexture = RenderProxy->GradientResource->TextureRHI;
+		}
+
+		// A fused mix gets the half resolution upsample as BloomTexture and blends scene color in itself
+		const bool bFuseUpsample = Process.bFuseLastUpsample && BloomTexture.IsValid();
+		FLensFlareBloomMixPS::FPermutationDomain PermutationVector;
+		PermutationVector.Set<FLensFlareFuseUpsampleDim>(bFuseUpsample);
+		PermutationVector.Set<FLensFlareHalfPrecisionDim>(Process.bHalfPrecision);
 
-		if (PerViewExtensionData->Gradient != nullptr)
+		if (bEngineBloom)
+		{
+			MixParameters.BloomTexture = InputTexture.TextureSRV;
+			MixParameters.Bloom = GetScreenPassTextureViewportParameters(GetSliceViewport(InputTexture));
+		}
+		else if (BloomTexture.IsValid())
 		{
-			const FTextureRHIRef TextureRHI = PerViewExtensionData->Gradient->GetResource()->TextureRHI;
-			PassParameters->FlareGradientTexture = TextureRHI;
+			MixParameters.BloomTexture = BloomTexture.TextureSRV;
+			MixParameters.Bloom = GetScreenPassTextureViewportParameters(GetSliceViewport(BloomTexture));
 		}
 
-		if (BloomTexture.IsValid())
+		if (bFuseUpsample)
 		{
-			PassParameters->BloomTexture = BloomTexture.TextureSRV;
+			MixParameters.SceneColorTexture = InputTexture.TextureSRV;
+			MixParameters.SceneColor = GetScreenPassTextureViewportParameters(GetSliceViewport(InputTexture));
 		}
 
 		if (FlareTexture.IsValid())
 		{
-			PassParameters->Pass.InputTexture = FlareTexture.Texture;
+			MixParameters.InputTexture = FlareTexture.Texture;
+			MixParameters.InputViewportSize = GetViewportUVSize(FlareTexture);
 		}
 
 		if (GlareTexture.IsValid())
 		{
-			PassParameters->GlareTexture = GlareTexture.Texture;
+			MixParameters.GlareTexture = GlareTexture.Texture;
+			MixParameters.GlareViewportSize = GetViewportUVSize(GlareTexture);
 		}
 
-		// Render
-		DrawShaderPass(
-			GraphBuilder,
-			MixPassName,
-			PassParameters,
-			VertexShader,
-			PixelShader,
-			ClearBlendState,
-			MixViewport
-			);
+		if (bCompositeIntoEngineBloom)
+		{
+			// The quad glare is in there already, only the flares and streaks are left to add
+			if (!FlareTexture.IsValid() && !GlareTexture.IsValid())
+			{
+				return EngineBloom;
+			}
+			MixParameters.MixPass = FIntVector(0, FlareTexture.IsValid(), GlareTexture.IsValid());
+
+			TShaderMapRef<FCustomScreenPassVS> VertexShader(View.ShaderMap);
+			TShaderMapRef<FLensFlareBloomMixPS> PixelShader(View.ShaderMap, PermutationVector);
+
+			FLensFlareBloomMixPS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareBloomMixPS::FParameters>();
+			PassParameters->RenderTargets[0] = FRenderTargetBinding(EngineBloom.Texture, ERenderTargetLoadAction::ELoad);
+			PassParameters->Mix = MixParameters;
+
+			DrawShaderPass(
+				GraphBuilder,
+				MixPassName,
+				PassParameters,
+				VertexShader,
+				PixelShader,
+				AdditiveBlendState,
+				EngineBloom.ViewRect
+				);
+			return EngineBloom;
+		}
+		else if (Process.bTileClassification)
+		{
+			// Most of the screen is usually empty. Clear everything and only mix the tiles that have anything in them.
+			FRDGTextureUAVRef MixUAV = GraphBuilder.CreateUAV(MixTexture);
+			AddClearUAVPass(GraphBuilder, MixUAV, FLinearColor::Black);
+
+			// The gradient is assumed to be at most 1
+			const float FlareWeight = RenderProxy->FlareIntensity * FMath::Max(RenderProxy->FlareTint.GetMax(), 0.0f);
+
+			FRDGBufferRef TileList = nullptr;
+			FRDGBufferRef DispatchArgs = nullptr;
+			Process.ClassifyTiles(
+				GraphBuilder,
+				View,
+				MixViewport.Size(),
+				MixTileSize,
+				FlareTexture,
+				GlareTexture,
+				FlareWeight,
+				TileList,
+				DispatchArgs
+				);
+
+			FLensFlareBloomMixCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareBloomMixCS::FParameters>();
+			PassParameters->Mix = MixParameters;
+			PassParameters->TileList = GraphBuilder.CreateSRV(TileList, PF_R32_UINT);
+			PassParameters->OutputSize = FUintVector2(MixViewport.Width(), MixViewport.Height());
+			PassParameters->OutputInvSize = FVector2f(1.0f, 1.0f) / BufferSize;
+			PassParameters->RWOutput = MixUAV;
+			PassParameters->IndirectDispatchArgs = DispatchArgs;
+
+			TShaderMapRef<FLensFlareBloomMixCS> ComputeShader(View.ShaderMap, PermutationVector);
+			FCustomLensFlarePSOPrecache::ValidatePrecached(ComputeShader.GetComputeShader(), TEXT("MixTiled"));
+
+			FComputeShaderUtils::AddPass(
+				GraphBuilder,
+				RDG_EVENT_NAME("MixTiled"),
+				ComputeShader,
+				PassParameters,
+				DispatchArgs,
+				0);
+		}
+		else
+		{
+			// Render shader
+			TShaderMapRef<FCustomScreenPassVS> VertexShader(View.ShaderMap);
+			TShaderMapRef<FLensFlareBloomMixPS> PixelShader(View.ShaderMap, PermutationVector);
+
+			FLensFlareBloomMixPS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareBloomMixPS::FParameters>();
+			PassParameters->RenderTargets[0] = FRenderTargetBinding(MixTexture, ERenderTargetLoadAction::ENoAction);
+			PassParameters->Mix = MixParameters;
+
+			// Render
+			DrawShaderPass(
+				GraphBuilder,
+				MixPassName,
+				PassParameters,
+				VertexShader,
+				PixelShader,
+				ClearBlendState,
+				MixViewport
+				);
+		}
 	} // end of mixing scope
+	Capture.MarkStage(GraphBuilder, TEXT("Mix"));
+
+	if (bStaticReuse)
+	{
+		FrameCache->StoreOutput(GraphBuilder, View, FScreenPassTexture(MixTexture, MixViewport));
+	}
 
 	// Output
 	return FScreenPassTexture(MixTexture, MixViewport);
@@ -763,8 +2534,8 @@ void FCustomLensFlareSceneViewExtension::InitStates()
 	// Blend modes from:
 	// '/Engine/Source/Runtime/RenderCore/Private/ClearQuad.cpp'
 	// '/Engine/Source/Runtime/Renderer/Private/PostProcess/PostProcessMaterial.cpp'
-	ClearBlendState = TStaticBlendState<>::GetRHI();
-	AdditiveBlendState = TStaticBlendState<CW_RGB, BO_Add, BF_One, BF_One>::GetRHI();
+	ClearBlendState = GetClearBlendState();
+	AdditiveBlendState = GetAdditiveBlendState();
 
 	BilinearClampSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
 	BilinearBorderSampler = TStaticSamplerState<SF_Bilinear, AM_Border, AM_Border, AM_Border>::GetRHI();
@@ -772,222 +2543,524 @@ void FCustomLensFlareSceneViewExtension::InitStates()
 	NearestRepeatSampler = TStaticSamplerState<SF_Point, AM_Wrap, AM_Wrap, AM_Wrap>::GetRHI();
 }
 
-const FCustomLensFlareSceneViewExtensionData::FPerViewExtensionData* FCustomLensFlareSceneViewExtension::GetPerViewExtensionData(const FSceneView& View)
+const FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy* FCustomLensFlareSceneViewExtension::GetPerViewRenderProxy(const FSceneView& View)
 {
+	// Captured frames are replayed with the parameters they were captured with
+	if (const FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy* ReplayRenderProxy = FCustomLensFlareCapture::Get().GetReplayRenderProxy())
+		return ReplayRenderProxy;
+
 	const FCustomLensFlareSceneViewExtensionData* CustomLensFlareSceneViewExtensionData = View.Family->GetExtentionData<FCustomLensFlareSceneViewExtensionData>();
-	const FCustomLensFlareSceneViewExtensionData::FPerViewExtensionData* PerViewExtensionData = CustomLensFlareSceneViewExtensionData->GetViewExtensionData(View);
-	return PerViewExtensionData;
+	const FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy* RenderProxy = CustomLensFlareSceneViewExtensionData ? CustomLensFlareSceneViewExtensionData->GetRenderProxy(View) : nullptr;
+	if (!RenderProxy)
+	{
+		// Views that were not set up through this extension
+		static const FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy NeutralRenderProxy(FCustomLensFlareSceneViewExtensionData::FPerViewExtensionData::MakeNeutral());
+		RenderProxy = &NeutralRenderProxy;
+	}
+	return RenderProxy;
 }
 
 
-FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderThreshold(FRDGBuilder& GraphBuilder, FScreenPassTexture InputTexture, const FViewInfo& View)
+FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderFlare(FRDGBuilder& GraphBuilder, FScreenPassTextureSlice& BloomTexture, const FScreenPassTextureSlice& GhostSourceTexture, const FViewInfo& View)
 {
-	RDG_EVENT_SCOPE(GraphBuilder, "ThresholdPass");
+	RDG_EVENT_SCOPE(GraphBuilder, "FlarePass");
+	const FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy* RenderProxy = GetPerViewRenderProxy(View);
 
 	FScreenPassTexture OutputTexture = FScreenPassTexture();
 
-	const FCustomLensFlareSceneViewExtensionData::FPerViewExtensionData* PerViewExtensionData = GetPerViewExtensionData(View);
-
 	FIntRect Viewport = View.ViewRect;
-	FIntRect Viewport2 = InputTexture.ViewRect;
-	FIntRect Viewport4 = Viewport2 / 2;
+	FIntRect Viewport2 = FIntRect(0, 0,
+		View.ViewRect.Width() / 2,
+		View.ViewRect.Height() / 2
+		);
+	FIntRect Viewport4 = FIntRect(0, 0,
+		View.ViewRect.Width() / 4,
+		View.ViewRect.Height() / 4
+		);
+
+	FRDGTextureRef ChromaTexture = nullptr;
 
+	// The LUT bake and the sprite ghosts are compute passes, which the mobile pipeline leaves out
+	const bool bMobile = UseMobilePipeline(View);
+
+	// The halo distortion and ghost masks only depend on rarely changing parameters
+	const bool bUseLUT = !bMobile && FCustomLensFlareLUTCache::IsEnabled();
+
+	// Sprite ghosts don't resample the flare buffer, so they don't need the chroma shifted copy either
+	const bool bUseGhostSprites = !bMobile && RenderProxy->GhostMode == ECustomLensFlareGhostMode::Sprites && GhostSourceTexture.IsValid();
+
+	if (!bUseGhostSprites)
 	{
-		const FString PassName(TEXT("LensFlareDownsample"));
+		const FString PassName(TEXT("LensFlareChromaGhost"));
 
-		// Build texture
-		FRDGTextureDesc Description = InputTexture.Texture->Desc;
+		// Build buffer
+		FRDGTextureDesc Description = BloomTexture.TextureSRV->GetParent()->Desc;
 		Description.Reset();
-		Description.Extent = Viewport4.Size();
+		Description.NumMips = 1;
+		Description.Extent = GetTargetExtent(View.GetSceneTexturesConfig().Extent, 2, Viewport2.Size());
 		Description.Format = PF_FloatRGB;
 		Description.ClearValue = FClearValueBinding(FLinearColor::Black);
-		FRDGTextureRef Texture = GraphBuilder.CreateTexture(Description, *PassName);
+		ChromaTexture = CreateTarget(GraphBuilder, Description, *PassName);
 
-		// Render shader
+		// Shader parameters
 		TShaderMapRef<FCustomScreenPassVS> VertexShader(View.ShaderMap);
-		TShaderMapRef<FDownsamplePS> PixelShader(View.ShaderMap);
+		TShaderMapRef<FLensFlareChromaPS> PixelShader(View.ShaderMap);
 
-		FDownsamplePS::FParameters* PassParameters = GraphBuilder.AllocParameters<FDownsamplePS::FParameters>();
-		PassParameters->InputTexture = GraphBuilder.CreateSRV(FRDGTextureSRVDesc(InputTexture.Texture));
-		PassParameters->RenderTargets[0] = FRenderTargetBinding(Texture, ERenderTargetLoadAction::ENoAction);
-		PassParameters->InputSampler = BilinearClampSampler;
-		PassParameters->InputSizeAndInvInputSize = SizeToSizeAndInvSize(InputTexture.ViewRect.Size());
-		PassParameters->ThresholdLevel = PerViewExtensionData->ThresholdLevel;
-		PassParameters->ThresholdRange = PerViewExtensionData->ThresholdRange;
+		FLensFlareChromaPS::FParameters* PassParameters = GraphBuilder.AllocParameters<
+			FLensFlareChromaPS::FParameters>();
+		PassParameters->InputTexture = BloomTexture.TextureSRV;
+		PassParameters->RenderTargets[0] = FRenderTargetBinding(ChromaTexture, GetTargetLoadAction(ChromaTexture, Viewport2));
+		PassParameters->InputSampler = BilinearBorderSampler;
+		PassParameters->InputViewportSize = GetViewportUVSize(BloomTexture);
+		PassParameters->ChromaShift = RenderProxy->GhostChromaShift;
 
-		DrawSplitResolutionPass(
+		// Render
+		DrawShaderPass(
 			GraphBuilder,
 			PassName,
 			PassParameters,
 			VertexShader,
 			PixelShader,
 			ClearBlendState,
-			FScreenPassTextureSlice(GraphBuilder.CreateSRV(InputTexture.Texture), Viewport2),
-			Viewport4
+			Viewport2
+			);
+	}
+
+	{
+		const FString PassName(TEXT("LensFlareGhosts"));
+
+		// Build buffer
+		FRDGTextureDesc Description = BloomTexture.TextureSRV->GetParent()->Desc;
+		Description.Reset();
+		Description.NumMips = 1;
+		Description.Extent = GetTargetExtent(View.GetSceneTexturesConfig().Extent, 2, Viewport2.Size());
+		Description.Format = PF_FloatRGB;
+		Description.ClearValue = FClearValueBinding(FLinearColor::Transparent);
+		FRDGTextureRef Texture = CreateTarget(GraphBuilder, Description, *PassName);
+
+		TArray<FLensFlareGhost, TInlineAllocator<32>> Ghosts;
+		const uint32 GhostCount = GatherGhosts(*RenderProxy, Ghosts);
+		FRDGBufferSRVRef GhostsSRV = GraphBuilder.CreateSRV(CreateStructuredBuffer(GraphBuilder, TEXT("LensFlareGhosts"), Ghosts));
+
+		if (bUseGhostSprites)
+		{
+			RenderGhostSprites(GraphBuilder, GhostSourceTexture, GhostsSRV, GhostCount, Texture, Viewport2, View);
+		}
+		else
+		{
+			// Shader parameters
+			TShaderMapRef<FCustomScreenPassVS> VertexShader(View.ShaderMap);
+			FLensFlareGhostsPS::FPermutationDomain PermutationVector;
+			PermutationVector.Set<FLensFlareGhostsPS::FUseLUTDim>(bUseLUT);
+			PermutationVector.Set<FLensFlareHalfPrecisionDim>(UseHalfPrecision(View));
+			TShaderMapRef<FLensFlareGhostsPS> PixelShader(View.ShaderMap, PermutationVector);
+
+			FLensFlareGhostsPS::FParameters* PassParameters = GraphBuilder.AllocParameters<
+				FLensFlareGhostsPS::FParameters>();
+			PassParameters->Pass.InputTexture = ChromaTexture;
+			PassParameters->Pass.RenderTargets[0] = FRenderTargetBinding(Texture, GetTargetLoadAction(Texture, Viewport2));
+			PassParameters->InputSampler = BilinearBorderSampler;
+			PassParameters->InputViewportSize = GetViewportUVSize(FScreenPassTexture(ChromaTexture, Viewport2));
+			PassParameters->Intensity = RenderProxy->GhostIntensity;
+			PassParameters->Ghosts = GhostsSRV;
+			PassParameters->GhostCount = GhostCount;
+
+			if (bUseLUT)
+			{
+				TArray<float, TInlineAllocator<32>> GhostScales;
+				for (uint32 GhostIndex = 0; GhostIndex < GhostCount; ++GhostIndex)
+				{
+					GhostScales.Add(Ghosts[GhostIndex].Scale);
+				}
+
+				PassParameters->GhostMaskLUT = LUTCache->GetGhostMaskLUT(GraphBuilder, View.ShaderMap, GhostScales);
+				PassParameters->GhostMaskLUTSampler = BilinearClampSampler;
+				PassParameters->GhostMaskLUTInvRows = 1.0f / FMath::Max(GhostScales.Num(), 1);
+			}
+
+			// Render
+			DrawShaderPass(
+				GraphBuilder,
+				PassName,
+				PassParameters,
+				VertexShader,
+				PixelShader,
+				ClearBlendState,
+				Viewport2
+				);
+		}
+
+		OutputTexture = FScreenPassTexture(Texture, Viewport2);
+	}
+
+	{
+		// Render shader
+		const FString PassName(TEXT("LensFlareHalo"));
+
+		TShaderMapRef<FCustomScreenPassVS> VertexShader(View.ShaderMap);
+		FLensFlareHaloPS::FPermutationDomain PermutationVector;
+		PermutationVector.Set<FLensFlareHaloPS::FUseLUTDim>(bUseLUT);
+		PermutationVector.Set<FLensFlareHalfPrecisionDim>(UseHalfPrecision(View));
+		TShaderMapRef<FLensFlareHaloPS> PixelShader(View.ShaderMap, PermutationVector);
+
+		FLensFlareHaloPS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareHaloPS::FParameters>();
+		PassParameters->InputTexture = BloomTexture.TextureSRV;
+		PassParameters->RenderTargets[0] = FRenderTargetBinding(OutputTexture.Texture, ERenderTargetLoadAction::ELoad);
+		PassParameters->InputSampler = BilinearBorderSampler;
+		PassParameters->InputViewportSize = GetViewportUVSize(BloomTexture);
+		PassParameters->Intensity = RenderProxy->HaloIntensity;
+		PassParameters->Width = RenderProxy->HaloWidth;
+		PassParameters->Mask = RenderProxy->HaloMask;
+		PassParameters->Compression = RenderProxy->HaloCompression;
+		PassParameters->ChromaShift = RenderProxy->HaloChromaShift;
+
+		if (bUseLUT)
+		{
+			PassParameters->HaloLUT = LUTCache->GetHaloLUT(GraphBuilder, View.ShaderMap,
+				RenderProxy->HaloCompression, RenderProxy->HaloWidth, RenderProxy->HaloMask, RenderProxy->HaloChromaShift);
+			PassParameters->HaloLUTSampler = BilinearClampSampler;
+		}
+
+		DrawShaderPass(
+			GraphBuilder,
+			PassName,
+			PassParameters,
+			VertexShader,
+			PixelShader,
+			AdditiveBlendState,
+			Viewport2
+			);
+	}
+
+	// The mobile pipeline reads a coarser bloom mip instead, so ghosts and halo stay a single render pass
+	if (!bMobile)
+	{
+		OutputTexture = RenderBlur(
+			GraphBuilder,
+			OutputTexture,
+			View,
+			1,
+			CVarLensFlareFlareComputeBlur.GetValueOnRenderThread() != 0 ? EBlurMethod::Compute : EBlurMethod::Kawase
 			);
+	}
+
+	return OutputTexture;
+}
+
+void FCustomLensFlareSceneViewExtension::RenderGhostSprites(FRDGBuilder& GraphBuilder, const FScreenPassTextureSlice& SourceTexture, FRDGBufferSRVRef Ghosts, uint32 GhostCount, FRDGTextureRef OutputTexture, const FIntRect& Viewport, const FViewInfo& View)
+{
+	RDG_EVENT_SCOPE(GraphBuilder, "LensFlareGhostSprites");
+
+	const uint32 MaxSources = FMath::Max(CVarLensFlareGhostSpritesMaxSources.GetValueOnRenderThread(), 1);
+	const FIntPoint SourceSize = SourceTexture.ViewRect.Size();
+
+	FRDGBufferRef SourcesBuffer = GraphBuilder.CreateBuffer(
+		FRDGBufferDesc::CreateStructuredDesc(sizeof(FLensFlareGhostSource), MaxSources),
+		TEXT("LensFlareGhostSources"));
+	FRDGBufferRef SourceCountBuffer = GraphBuilder.CreateBuffer(
+		FRDGBufferDesc::CreateBufferDesc(sizeof(uint32), 1),
+		TEXT("LensFlareGhostSourceCount"));
+
+	FRDGBufferUAVRef SourceCountUAV = GraphBuilder.CreateUAV(SourceCountBuffer, PF_R32_UINT);
+	AddClearUAVPass(GraphBuilder, SourceCountUAV, 0u);
+
+	// Find the bright spots. Their number is only known on the GPU, so the draw below is indirect.
+	{
+		FLensFlareExtractGhostSourcesCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareExtractGhostSourcesCS::FParameters>();
+		PassParameters->SourceTexture = SourceTexture.TextureSRV;
+		PassParameters->SourceSize = FUintVector2(SourceSize.X, SourceSize.Y);
+		PassParameters->MinLuminance = CVarLensFlareGhostSpritesMinLuminance.GetValueOnRenderThread();
+		PassParameters->MaxSources = MaxSources;
+		PassParameters->RWSources = GraphBuilder.CreateUAV(SourcesBuffer);
+		PassParameters->RWSourceCount = SourceCountUAV;
+
+		TShaderMapRef<FLensFlareExtractGhostSourcesCS> ComputeShader(View.ShaderMap);
+		FCustomLensFlarePSOPrecache::ValidatePrecached(ComputeShader.GetComputeShader(), TEXT("LensFlareExtractGhostSources"));
+
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("LensFlareExtractGhostSources %dx%d", SourceSize.X, SourceSize.Y),
+			ComputeShader,
+			PassParameters,
+			FComputeShaderUtils::GetGroupCount(SourceSize, FIntPoint(8, 8)));
+	}
+
+	DrawGhostSprites(GraphBuilder, SourcesBuffer, SourceCountBuffer, MaxSources, FVector2f(1.0f / SourceSize.X, 1.0f / SourceSize.Y), Ghosts, GhostCount, OutputTexture, Viewport, View);
+}
+
+void FCustomLensFlareSceneViewExtension::DrawGhostSprites(FRDGBuilder& GraphBuilder, FRDGBufferRef SourcesBuffer, FRDGBufferRef SourceCountBuffer, uint32 MaxSources, const FVector2f& SourceInvSize, FRDGBufferSRVRef Ghosts, uint32 GhostCount, FRDGTextureRef OutputTexture, const FIntRect& Viewport, const FViewInfo& View)
+{
+	const FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy* RenderProxy = GetPerViewRenderProxy(View);
+
+	FRDGBufferRef DrawArgsBuffer = AddBuildSpriteArgsPass(GraphBuilder, View.ShaderMap, SourceCountBuffer, MaxSources, GhostCount);
+
+	FLensFlareGhostSpritePassParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareGhostSpritePassParameters>();
+	PassParameters->VS.Sources = GraphBuilder.CreateSRV(SourcesBuffer);
+	PassParameters->VS.Ghosts = Ghosts;
+	PassParameters->VS.GhostCount = GhostCount;
+	PassParameters->VS.SourceInvSize = SourceInvSize;
+	PassParameters->VS.SpriteSize = RenderProxy->GhostSpriteSize;
+	PassParameters->VS.Intensity = RenderProxy->GhostIntensity;
+	PassParameters->PS.SpriteTexture = GWhiteTexture->TextureRHI;
+	PassParameters->PS.SpriteSampler = BilinearClampSampler;
+	PassParameters->PS.bHasSpriteTexture = 0;
+	PassParameters->IndirectDrawArgs = DrawArgsBuffer;
+	PassParameters->RenderTargets[0] = FRenderTargetBinding(OutputTexture, ERenderTargetLoadAction::EClear);
+
+	if (RenderProxy->GhostSpriteTextureResource != nullptr && RenderProxy->GhostSpriteTextureResource->TextureRHI)
+	{
+		PassParameters->PS.SpriteTexture = RenderProxy->GhostSpriteTextureResource->TextureRHI;
+		PassParameters->PS.bHasSpriteTexture = 1;
+	}
+
+	TShaderMapRef<FLensFlareGhostSpriteVS> VertexShader(View.ShaderMap);
+	TShaderMapRef<FLensFlareGhostSpritePS> PixelShader(View.ShaderMap);
+	// Required for Lambda capture
+	FRHIBlendState* BlendState = this->AdditiveBlendState;
+
+	GraphBuilder.AddPass(
+		RDG_EVENT_NAME("LensFlareGhostSprites"),
+		PassParameters,
+		ERDGPassFlags::Raster,
+		[VertexShader, PixelShader, PassParameters, BlendState, Viewport](FRHICommandListImmediate& RHICmdList)
+		{
+			RHICmdList.SetViewport(
+				Viewport.Min.X, Viewport.Min.Y, 0.0f,
+				Viewport.Max.X, Viewport.Max.Y, 1.0f
+				);
+
+			FGraphicsPipelineStateInitializer GraphicsPSOInit = MakeSpritePipelineState(VertexShader.GetVertexShader(), PixelShader.GetPixelShader(), BlendState);
+			RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+			FCustomLensFlarePSOPrecache::ValidatePrecached(GraphicsPSOInit, TEXT("LensFlareGhostSprites"));
+			SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, 0);
+
+			SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), PassParameters->VS);
+			SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), PassParameters->PS);
+
+			RHICmdList.SetStreamSource(0, nullptr, 0);
+			PassParameters->IndirectDrawArgs->MarkResourceAsUsed();
+			RHICmdList.DrawPrimitiveIndirect(PassParameters->IndirectDrawArgs->GetIndirectRHICallBuffer(), 0);
+		}
+		);
+}
+
+FScreenPassTextureSlice FCustomLensFlareSceneViewExtension::RenderFlareSource(FRDGBuilder& GraphBuilder, const FScreenPassTextureSlice& EngineBloom, const FViewInfo& View)
+{
+	const FString PassName(TEXT("LensFlareSource"));
+
+	// The flare passes expect a texture that starts at the origin.
+	// Quarter resolution is plenty since the bloom is blurry anyway.
+	const FIntRect Viewport4(0, 0,
+		FMath::Max(View.ViewRect.Width() / 4, 1),
+		FMath::Max(View.ViewRect.Height() / 4, 1)
+		);
+
+	FRDGTextureDesc Description = EngineBloom.TextureSRV->GetParent()->Desc;
+	Description.Reset();
+	Description.Extent = GetTargetExtent(View.GetSceneTexturesConfig().Extent, 4, Viewport4.Size());
+	Description.Format = PF_FloatRGB;
+	Description.ClearValue = FClearValueBinding(FLinearColor::Black);
+	FRDGTextureRef Texture = CreateTarget(GraphBuilder, Description, *PassName);
 
-		OutputTexture = FScreenPassTexture(Texture);
-	}
+	TShaderMapRef<FCustomScreenPassVS> VertexShader(View.ShaderMap);
+	TShaderMapRef<FLensFlareRescalePS> PixelShader(View.ShaderMap);
+
+	FLensFlareRescalePS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareRescalePS::FParameters>();
+	PassParameters->InputTexture = EngineBloom.TextureSRV;
+	PassParameters->RenderTargets[0] = FRenderTargetBinding(Texture, GetTargetLoadAction(Texture, Viewport4));
+	PassParameters->InputSampler = BilinearClampSampler;
+	// The UVs already cover the viewport of the engine bloom
+	PassParameters->InputViewportSize = FVector2f(1.0f, 1.0f);
 
-	return RenderBlur(
+	DrawSplitResolutionPass(
 		GraphBuilder,
-		OutputTexture,
-		View,
-		1
+		PassName,
+		PassParameters,
+		VertexShader,
+		PixelShader,
+		ClearBlendState,
+		EngineBloom,
+		Viewport4
 		);
+
+	return FScreenPassTextureSlice(GraphBuilder.CreateSRV(FRDGTextureSRVDesc(Texture)), Viewport4);
 }
 
-FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderFlare(FRDGBuilder& GraphBuilder, FScreenPassTextureSlice& BloomTexture, const FViewInfo& View)
+FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderAnalyticFlare(FRDGBuilder& GraphBuilder, const FViewInfo& View)
 {
-	RDG_EVENT_SCOPE(GraphBuilder, "FlarePass");
-	const FCustomLensFlareSceneViewExtensionData::FPerViewExtensionData* PerViewExtensionData = GetPerViewExtensionData(View);
-
-	FScreenPassTexture OutputTexture = FScreenPassTexture();
+	RDG_EVENT_SCOPE(GraphBuilder, "AnalyticFlarePass");
+	const FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy* RenderProxy = GetPerViewRenderProxy(View);
+	const FCustomLensFlareSceneViewExtensionData* ExtensionData = View.Family->GetExtentionData<FCustomLensFlareSceneViewExtensionData>();
 
-	FIntRect Viewport = View.ViewRect;
-	FIntRect Viewport2 = FIntRect(0, 0,
+	const FIntRect Viewport2 = FIntRect(0, 0,
 		View.ViewRect.Width() / 2,
 		View.ViewRect.Height() / 2
 		);
-	FIntRect Viewport4 = FIntRect(0, 0,
-		View.ViewRect.Width() / 4,
-		View.ViewRect.Height() / 4
-		);
-
-	FRDGTextureRef ChromaTexture = nullptr;
-
+	const float InvAspectRatio = float(View.ViewRect.Height()) / float(View.ViewRect.Width());
+	const int32 MaxSources = FMath::Max(CVarLensFlareAnalyticMaxSources.GetValueOnRenderThread(), 1);
+	const float SourceSize = CVarLensFlareAnalyticSourceSize.GetValueOnRenderThread();
+
+	// Project the lights. Lights behind the camera or off screen can't cast a flare.
+	TArray<FLensFlareAnalyticSource, TInlineAllocator<8>> Sources;
+	const FMatrix& ViewProjectionMatrix = View.ViewMatrices.GetViewProjectionMatrix();
+	auto AddSource = [&Sources, &ViewProjectionMatrix, MaxSources, SourceSize](const FVector4& WorldPosition, const FLinearColor& Color)
 	{
-		const FString PassName(TEXT("LensFlareChromaGhost"));
+		if (Sources.Num() >= MaxSources || Color.GetMax() <= UE_KINDA_SMALL_NUMBER)
+			return;
 
-		// Build buffer
-		FRDGTextureDesc Description = BloomTexture.TextureSRV->GetParent()->Desc;
-		Description.Reset();
-		Description.Extent = Viewport2.Size();
-		Description.Format = PF_FloatRGB;
-		Description.ClearValue = FClearValueBinding(FLinearColor::Black);
-		ChromaTexture = GraphBuilder.CreateTexture(Description, *PassName);
+		const FVector4 ClipPosition = ViewProjectionMatrix.TransformFVector4(WorldPosition);
+		if (ClipPosition.W <= UE_KINDA_SMALL_NUMBER)
+			return;
 
-		// Shader parameters
-		TShaderMapRef<FCustomScreenPassVS> VertexShader(View.ShaderMap);
-		TShaderMapRef<FLensFlareChromaPS> PixelShader(View.ShaderMap);
+		const FVector2f UV(
+			float(ClipPosition.X / ClipPosition.W) * 0.5f + 0.5f,
+			0.5f - float(ClipPosition.Y / ClipPosition.W) * 0.5f);
+		if (UV.X < 0.0f || UV.X > 1.0f || UV.Y < 0.0f || UV.Y > 1.0f)
+			return;
 
-		FLensFlareChromaPS::FParameters* PassParameters = GraphBuilder.AllocParameters<
-			FLensFlareChromaPS::FParameters>();
-		PassParameters->InputTexture = BloomTexture.TextureSRV;
-		PassParameters->RenderTargets[0] = FRenderTargetBinding(ChromaTexture, ERenderTargetLoadAction::ENoAction);
-		PassParameters->InputSampler = BilinearBorderSampler;
-		PassParameters->ChromaShift = PerViewExtensionData->GhostChromaShift;
+		Sources.Add({UV, float(ClipPosition.Z / ClipPosition.W), SourceSize, FVector3f(Color.R, Color.G, Color.B)});
+	};
 
-		// Render
-		DrawShaderPass(
-			GraphBuilder,
-			PassName,
-			PassParameters,
-			VertexShader,
-			PixelShader,
-			ClearBlendState,
-			Viewport2
-			);
+	const FScene* Scene = View.Family->Scene ? View.Family->Scene->GetRenderScene() : nullptr;
+	if (CVarLensFlareAnalyticDirectionalLight.GetValueOnRenderThread() != 0 && Scene && Scene->SimpleDirectionalLight)
+	{
+		// Infinitely far away in the opposite of the direction it shines in. Only its hue is used, the units vary too much.
+		const FLightSceneProxy* LightProxy = Scene->SimpleDirectionalLight->Proxy;
+		const FLinearColor LightColor = LightProxy->GetColor();
+		AddSource(
+			FVector4(-LightProxy->GetDirection(), 0.0f),
+			LightColor / FMath::Max(LightColor.GetMax(), UE_SMALL_NUMBER) * CVarLensFlareAnalyticDirectionalLightIntensity.GetValueOnRenderThread());
 	}
 
+	if (ExtensionData)
 	{
-		const FString PassName(TEXT("LensFlareGhosts"));
+		for (const FCustomLensFlareSceneViewExtensionData::FFlareSource& FlareSource : ExtensionData->GetFlareSources())
+		{
+			AddSource(FVector4(FlareSource.Position, 1.0f), FlareSource.Color);
+		}
+	}
 
-		// Build buffer
-		FRDGTextureDesc Description = BloomTexture.TextureSRV->GetParent()->Desc;
-		Description.Reset();
-		Description.Extent = Viewport2.Size();
-		Description.Format = PF_FloatRGB;
-		Description.ClearValue = FClearValueBinding(FLinearColor::Transparent);
-		FRDGTextureRef Texture = GraphBuilder.CreateTexture(Description, *PassName);
+	if (Sources.IsEmpty())
+		return {};
 
-		// Shader parameters
-		TShaderMapRef<FCustomScreenPassVS> VertexShader(View.ShaderMap);
-		TShaderMapRef<FLensFlareGhostsPS> PixelShader(View.ShaderMap);
+	// Test how much of every light is hidden by the depth buffer. Visible ones become ghost sprite sources.
+	FRDGBufferRef VisibleSourcesBuffer = GraphBuilder.CreateBuffer(
+		FRDGBufferDesc::CreateStructuredDesc(sizeof(FLensFlareGhostSource), Sources.Num()),
+		TEXT("LensFlareVisibleSources"));
+	FRDGBufferRef VisibleSourceCountBuffer = GraphBuilder.CreateBuffer(
+		FRDGBufferDesc::CreateBufferDesc(sizeof(uint32), 1),
+		TEXT("LensFlareVisibleSourceCount"));
 
-		FLensFlareGhostsPS::FParameters* PassParameters = GraphBuilder.AllocParameters<
-			FLensFlareGhostsPS::FParameters>();
-		PassParameters->Pass.InputTexture = ChromaTexture;
-		PassParameters->Pass.RenderTargets[0] = FRenderTargetBinding(Texture, ERenderTargetLoadAction::ENoAction);
-		PassParameters->InputSampler = BilinearBorderSampler;
-		PassParameters->Intensity = PerViewExtensionData->GhostIntensity;
-
-		PassParameters->GhostColors[0] = PerViewExtensionData->Ghost1.Color;
-		PassParameters->GhostColors[1] = PerViewExtensionData->Ghost2.Color;
-		PassParameters->GhostColors[2] = PerViewExtensionData->Ghost3.Color;
-		PassParameters->GhostColors[3] = PerViewExtensionData->Ghost4.Color;
-		PassParameters->GhostColors[4] = PerViewExtensionData->Ghost5.Color;
-		PassParameters->GhostColors[5] = PerViewExtensionData->Ghost6.Color;
-		PassParameters->GhostColors[6] = PerViewExtensionData->Ghost7.Color;
-		PassParameters->GhostColors[7] = PerViewExtensionData->Ghost8.Color;
-
-		GET_SCALAR_ARRAY_ELEMENT(PassParameters->GhostScales, 0) = PerViewExtensionData->Ghost1.Scale;
-		GET_SCALAR_ARRAY_ELEMENT(PassParameters->GhostScales, 1) = PerViewExtensionData->Ghost2.Scale;
-		GET_SCALAR_ARRAY_ELEMENT(PassParameters->GhostScales, 2) = PerViewExtensionData->Ghost3.Scale;
-		GET_SCALAR_ARRAY_ELEMENT(PassParameters->GhostScales, 3) = PerViewExtensionData->Ghost4.Scale;
-		GET_SCALAR_ARRAY_ELEMENT(PassParameters->GhostScales, 4) = PerViewExtensionData->Ghost5.Scale;
-		GET_SCALAR_ARRAY_ELEMENT(PassParameters->GhostScales, 5) = PerViewExtensionData->Ghost6.Scale;
-		GET_SCALAR_ARRAY_ELEMENT(PassParameters->GhostScales, 6) = PerViewExtensionData->Ghost7.Scale;
-		GET_SCALAR_ARRAY_ELEMENT(PassParameters->GhostScales, 7) = PerViewExtensionData->Ghost8.Scale;
+	FRDGBufferUAVRef VisibleSourceCountUAV = GraphBuilder.CreateUAV(VisibleSourceCountBuffer, PF_R32_UINT);
+	AddClearUAVPass(GraphBuilder, VisibleSourceCountUAV, 0u);
 
-		// Render
-		DrawShaderPass(
+	{
+		FLensFlareFlareVisibilityCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareFlareVisibilityCS::FParameters>();
+		PassParameters->AnalyticSources = GraphBuilder.CreateSRV(CreateStructuredBuffer(GraphBuilder, TEXT("LensFlareAnalyticSources"), Sources));
+		// The mobile renderer only keeps the depth buffer around when something asked for it. Without it nothing is occluded.
+		FRDGTextureRef SceneDepthTexture = View.GetSceneTextures().Depth.Resolve;
+		const bool bUseSceneDepth = SceneDepthTexture && (!UseMobilePipeline(View) || View.GetSceneTexturesConfig().bKeepDepthContent);
+		PassParameters->SceneDepthTexture = bUseSceneDepth ? SceneDepthTexture : GSystemTextures.GetDepthDummy(GraphBuilder);
+		PassParameters->bUseSceneDepth = bUseSceneDepth;
+		PassParameters->DepthViewRect = FIntVector4(View.ViewRect.Min.X, View.ViewRect.Min.Y, View.ViewRect.Max.X, View.ViewRect.Max.Y);
+		PassParameters->OcclusionRadius = CVarLensFlareAnalyticOcclusionRadius.GetValueOnRenderThread();
+		PassParameters->MaxSources = Sources.Num();
+		PassParameters->RWSources = GraphBuilder.CreateUAV(VisibleSourcesBuffer);
+		PassParameters->RWSourceCount = VisibleSourceCountUAV;
+
+		TShaderMapRef<FLensFlareFlareVisibilityCS> ComputeShader(View.ShaderMap);
+		FCustomLensFlarePSOPrecache::ValidatePrecached(ComputeShader.GetComputeShader(), TEXT("LensFlareFlareVisibility"));
+
+		FComputeShaderUtils::AddPass(
 			GraphBuilder,
-			PassName,
+			RDG_EVENT_NAME("LensFlareFlareVisibility %d", Sources.Num()),
+			ComputeShader,
 			PassParameters,
-			VertexShader,
-			PixelShader,
-			ClearBlendState,
-			Viewport2
-			);
-
-		OutputTexture = FScreenPassTexture(Texture);
+			FIntVector(Sources.Num(), 1, 1));
 	}
 
+	const FRDGTextureDesc Description = FRDGTextureDesc::Create2D(
+		GetTargetExtent(View.GetSceneTexturesConfig().Extent, 2, Viewport2.Size()),
+		PF_FloatRGB,
+		FClearValueBinding(FLinearColor::Transparent),
+		TexCreate_RenderTargetable | TexCreate_ShaderResource);
+	FRDGTextureRef Texture = CreateTarget(GraphBuilder, Description, TEXT("LensFlareAnalytic"));
+
+	// Ghosts, the same sprites as in the image based pipeline
 	{
-		// Render shader
-		const FString PassName(TEXT("LensFlareHalo"));
+		TArray<FLensFlareGhost, TInlineAllocator<32>> Ghosts;
+		const uint32 GhostCount = GatherGhosts(*RenderProxy, Ghosts);
+		FRDGBufferSRVRef GhostsSRV = GraphBuilder.CreateSRV(CreateStructuredBuffer(GraphBuilder, TEXT("LensFlareGhosts"), Ghosts));
 
-		TShaderMapRef<FCustomScreenPassVS> VertexShader(View.ShaderMap);
-		TShaderMapRef<FLensFlareHaloPS> PixelShader(View.ShaderMap);
+		DrawGhostSprites(GraphBuilder, VisibleSourcesBuffer, VisibleSourceCountBuffer, Sources.Num(), FVector2f(InvAspectRatio, 1.0f), GhostsSRV, GhostCount, Texture, Viewport2, View);
+	}
 
-		FLensFlareHaloPS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareHaloPS::FParameters>();
-		PassParameters->InputTexture = BloomTexture.TextureSRV;
-		PassParameters->RenderTargets[0] = FRenderTargetBinding(OutputTexture.Texture, ERenderTargetLoadAction::ELoad);
-		PassParameters->InputSampler = BilinearBorderSampler;
-		PassParameters->Intensity = PerViewExtensionData->HaloIntensity;
-		PassParameters->Width = PerViewExtensionData->HaloWidth;
-		PassParameters->Mask = PerViewExtensionData->HaloMask;
-		PassParameters->Compression = PerViewExtensionData->HaloCompression;
-		PassParameters->ChromaShift = PerViewExtensionData->HaloChromaShift;
+	// Glare and halo
+	{
+		// Ray lengths are relative to the longest one, which spans the quad
+		const float MaxGlareScale = FMath::Max(RenderProxy->GlareScale.GetMax(), UE_KINDA_SMALL_NUMBER);
+
+		FLensFlareAnalyticGlarePassParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareAnalyticGlarePassParameters>();
+		PassParameters->VS.Sources = GraphBuilder.CreateSRV(VisibleSourcesBuffer);
+		PassParameters->VS.InvAspectRatio = InvAspectRatio;
+		PassParameters->VS.GlareSize = CVarLensFlareAnalyticGlareSize.GetValueOnRenderThread() * MaxGlareScale;
+		PassParameters->VS.GlareTint = FVector3f(RenderProxy->GlareTint.R, RenderProxy->GlareTint.G, RenderProxy->GlareTint.B);
+		PassParameters->VS.GlareIntensity = RenderProxy->GlareIntensity;
+		PassParameters->VS.HaloWidth = RenderProxy->HaloWidth;
+		PassParameters->VS.HaloIntensity = RenderProxy->HaloIntensity;
+		PassParameters->PS.GlareAngles = FVector3f(RenderProxy->GlareAngles);
+		PassParameters->PS.GlareScales = FVector3f(RenderProxy->GlareScale / MaxGlareScale);
+		PassParameters->PS.GlareDivider = FMath::Max(RenderProxy->GlareDivider, 0.01f);
+		PassParameters->PS.HaloWidth = RenderProxy->HaloWidth;
+		PassParameters->PS.HaloMask = RenderProxy->HaloMask;
+		PassParameters->PS.HaloChromaShift = RenderProxy->HaloChromaShift;
+		PassParameters->IndirectDrawArgs = AddBuildSpriteArgsPass(GraphBuilder, View.ShaderMap, VisibleSourceCountBuffer, Sources.Num(), 2);
+		PassParameters->RenderTargets[0] = FRenderTargetBinding(Texture, ERenderTargetLoadAction::ELoad);
+
+		TShaderMapRef<FLensFlareAnalyticGlareVS> VertexShader(View.ShaderMap);
+		TShaderMapRef<FLensFlareAnalyticGlarePS> PixelShader(View.ShaderMap);
+		// Required for Lambda capture
+		FRHIBlendState* BlendState = this->AdditiveBlendState;
 
-		DrawShaderPass(
-			GraphBuilder,
-			PassName,
+		GraphBuilder.AddPass(
+			RDG_EVENT_NAME("LensFlareAnalyticGlare"),
 			PassParameters,
-			VertexShader,
-			PixelShader,
-			AdditiveBlendState,
-			Viewport2
-			);
-	}
+			ERDGPassFlags::Raster,
+			[VertexShader, PixelShader, PassParameters, BlendState, Viewport2](FRHICommandListImmediate& RHICmdList)
+			{
+				RHICmdList.SetViewport(
+					Viewport2.Min.X, Viewport2.Min.Y, 0.0f,
+					Viewport2.Max.X, Viewport2.Max.Y, 1.0f
+					);
 
-	{
-		OutputTexture = RenderBlur(
-			GraphBuilder,
-			OutputTexture,
-			View,
-			1
+				FGraphicsPipelineStateInitializer GraphicsPSOInit = MakeSpritePipelineState(VertexShader.GetVertexShader(), PixelShader.GetPixelShader(), BlendState);
+				RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+				FCustomLensFlarePSOPrecache::ValidatePrecached(GraphicsPSOInit, TEXT("LensFlareAnalyticGlare"));
+				SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, 0);
+
+				SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), PassParameters->VS);
+				SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), PassParameters->PS);
+
+				RHICmdList.SetStreamSource(0, nullptr, 0);
+				PassParameters->IndirectDrawArgs->MarkResourceAsUsed();
+				RHICmdList.DrawPrimitiveIndirect(PassParameters->IndirectDrawArgs->GetIndirectRHICallBuffer(), 0);
+			}
 			);
 	}
 
-	return OutputTexture;
+	return FScreenPassTexture(Texture, Viewport2);
 }
 
-FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderGlare(FRDGBuilder& GraphBuilder, FScreenPassTextureSlice& BloomTexture, const FViewInfo& View)
+FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderGlare(FRDGBuilder& GraphBuilder, FScreenPassTextureSlice& BloomTexture, FRDGBufferSRVRef ExposureBuffer, float ExposureScale, const FViewInfo& View, const FScreenPassTexture& CompositeTarget)
 {
 	RDG_EVENT_SCOPE(GraphBuilder, "GlarePass");
-	const FCustomLensFlareSceneViewExtensionData::FPerViewExtensionData* PerViewExtensionData = GetPerViewExtensionData(View);
+	const FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy* RenderProxy = GetPerViewRenderProxy(View);
+
+	// The streaks finish in their own target, the mix adds them to the engine bloom together with the flares
+	if (RenderProxy->GlareMode == ECustomLensFlareGlareMode::Streaks)
+	{
+		return RenderProxy->GlareIntensity > SMALL_NUMBER ? RenderStreaks(GraphBuilder, BloomTexture, View) : FScreenPassTexture();
+	}
 
 	FScreenPassTexture OutputTexture = FScreenPassTexture();
 
@@ -998,7 +3071,7 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderGlare(FRDGBuilder&
 		View.ViewRect.Height() / 4
 		);
 	// Only render the Glare if its intensity is different from 0
-	if (PerViewExtensionData->GlareIntensity > SMALL_NUMBER)
+	if (RenderProxy->GlareIntensity > SMALL_NUMBER)
 	{
 		const FString LensFlareGlarePassName(TEXT("LensFlareGlare"));
 
@@ -1021,10 +3094,16 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderGlare(FRDGBuilder&
 		// Build the buffer
 		FRDGTextureDesc Description = BloomTexture.TextureSRV->GetParent()->Desc;
 		Description.Reset();
-		Description.Extent = Viewport4.Size();
+		Description.NumMips = 1;
+		Description.Extent = GetTargetExtent(View.GetSceneTexturesConfig().Extent, 4, Viewport4.Size());
 		Description.Format = PF_FloatRGB;
 		Description.ClearValue = FClearValueBinding(FLinearColor::Transparent);
-		FRDGTextureRef GlareTexture = GraphBuilder.CreateTexture(Description, *LensFlareGlarePassName);
+
+		// The quads are placed in clip space, so they land in the same spot
+		// when they are drawn into the composite target at its own resolution.
+		const bool bComposite = CompositeTarget.IsValid();
+		FRDGTextureRef GlareTexture = bComposite ? CompositeTarget.Texture : CreateTarget(GraphBuilder, Description, *LensFlareGlarePassName);
+		const FIntRect OutputViewport = bComposite ? CompositeTarget.ViewRect : Viewport4;
 
 		// Setup a few other variables that will 
 		// be needed by the shaders.
@@ -1034,101 +3113,320 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderGlare(FRDGBuilder&
 		PixelSize.Z = PixelSize.X;
 		PixelSize.W = PixelSize.Y * -1.0f;
 
-		FVector2f BufferSize = FVector2f(Description.Extent);
+		// The tiles cover the viewport, not the whole texture
+		FVector2f BufferSize = FVector2f(Viewport4.Size());
 
 		// Setup shader
 
 		// Vertex shader
 		FLensFlareGlareVS::FParameters* VertexParameters = GraphBuilder.AllocParameters<FLensFlareGlareVS::FParameters>();
 		VertexParameters->InputTexture = BloomTexture.TextureSRV;
-		VertexParameters->RenderTargets[0] = FRenderTargetBinding(GlareTexture, ERenderTargetLoadAction::EClear);
+		VertexParameters->RenderTargets[0] = FRenderTargetBinding(GlareTexture, bComposite ? ERenderTargetLoadAction::ELoad : ERenderTargetLoadAction::EClear);
 		VertexParameters->InputSampler = BilinearBorderSampler;
+		VertexParameters->InputViewportSize = GetViewportUVSize(BloomTexture);
 		VertexParameters->TileCount = TileCount;
 		VertexParameters->PixelSize = PixelSize;
 		VertexParameters->BufferSize = BufferSize;
+		VertexParameters->EyeAdaptationBuffer = ExposureBuffer;
+		VertexParameters->ExposureScale = ExposureScale;
 
 		// Geometry shader
 		FLensFlareGlareGS::FParameters* GeometryParameters = GraphBuilder.AllocParameters<FLensFlareGlareGS::FParameters>();
 		GeometryParameters->BufferSize = BufferSize;
 		GeometryParameters->BufferRatio = BufferRatio;
 		GeometryParameters->PixelSize = PixelSize;
-		GeometryParameters->GlareIntensity = PerViewExtensionData->GlareIntensity;
-		GeometryParameters->GlareTint = FVector4f(PerViewExtensionData->GlareTint);
-		GET_SCALAR_ARRAY_ELEMENT(GeometryParameters->GlareScales, 0) = PerViewExtensionData->GlareScale.X;
-		GET_SCALAR_ARRAY_ELEMENT(GeometryParameters->GlareScales, 1) = PerViewExtensionData->GlareScale.Y;
-		GET_SCALAR_ARRAY_ELEMENT(GeometryParameters->GlareScales, 2) = PerViewExtensionData->GlareScale.Z;
-		GET_SCALAR_ARRAY_ELEMENT(GeometryParameters->GlareAngles, 0) = PerViewExtensionData->GlareAngles.X;
-		GET_SCALAR_ARRAY_ELEMENT(GeometryParameters->GlareAngles, 1) = PerViewExtensionData->GlareAngles.Y;
-		GET_SCALAR_ARRAY_ELEMENT(GeometryParameters->GlareAngles, 2) = PerViewExtensionData->GlareAngles.Z;
-		GeometryParameters->GlareDivider = FMath::Max(PerViewExtensionData->GlareDivider, 0.01f);
+		GeometryParameters->GlareIntensity = RenderProxy->GlareIntensity;
+		GeometryParameters->GlareTint = FVector4f(RenderProxy->GlareTint);
+		GET_SCALAR_ARRAY_ELEMENT(GeometryParameters->GlareScales, 0) = RenderProxy->GlareScale.X;
+		GET_SCALAR_ARRAY_ELEMENT(GeometryParameters->GlareScales, 1) = RenderProxy->GlareScale.Y;
+		GET_SCALAR_ARRAY_ELEMENT(GeometryParameters->GlareScales, 2) = RenderProxy->GlareScale.Z;
+		GET_SCALAR_ARRAY_ELEMENT(GeometryParameters->GlareAngles, 0) = RenderProxy->GlareAngles.X;
+		GET_SCALAR_ARRAY_ELEMENT(GeometryParameters->GlareAngles, 1) = RenderProxy->GlareAngles.Y;
+		GET_SCALAR_ARRAY_ELEMENT(GeometryParameters->GlareAngles, 2) = RenderProxy->GlareAngles.Z;
+		GeometryParameters->GlareDivider = FMath::Max(RenderProxy->GlareDivider, 0.01f);
 
 		// Pixel shader
 		FLensFlareGlarePS::FParameters* PixelParameters = GraphBuilder.AllocParameters<FLensFlareGlarePS::FParameters>();
 		PixelParameters->GlareSampler = BilinearClampSampler;
 		PixelParameters->GlareTexture = GWhiteTexture->TextureRHI;
 
-		if (PerViewExtensionData->GlareLineMask != nullptr)
+		if (RenderProxy->GlareLineMaskResource != nullptr && RenderProxy->GlareLineMaskResource->TextureRHI)
 		{
-			const FTextureRHIRef TextureRHI = PerViewExtensionData->GlareLineMask->GetResource()->TextureRHI;
-			PixelParameters->GlareTexture = TextureRHI;
+			PixelParameters->GlareTexture = RenderProxy->GlareLineMaskResource->TextureRHI;
 		}
 
-		TShaderMapRef<FLensFlareGlareVS> VertexShader(View.ShaderMap);
-		TShaderMapRef<FLensFlareGlareGS> GeometryShader(View.ShaderMap);
-		TShaderMapRef<FLensFlareGlarePS> PixelShader(View.ShaderMap);
-		// Required for Lambda capture
-		FRHIBlendState* BlendState = this->AdditiveBlendState;
+		// What the mix applies to the glare otherwise
+		PixelParameters->OutputViewportMin = FVector2f(OutputViewport.Min);
+		PixelParameters->OutputViewportInvSize = FVector2f(1.0f, 1.0f) / FVector2f(OutputViewport.Size());
+		PixelParameters->FlareIntensity = RenderProxy->FlareIntensity;
+		PixelParameters->FlareTint = FVector4f(RenderProxy->FlareTint);
+		PixelParameters->FlareGradientTexture = GWhiteTexture->TextureRHI;
+		PixelParameters->FlareGradientSampler = BilinearClampSampler;
 
-		GraphBuilder.AddPass(
-			RDG_EVENT_NAME("%s", *LensFlareGlarePassName),
-			VertexParameters,
-			ERDGPassFlags::Raster,
-			[
-				VertexShader, VertexParameters,
-				GeometryShader, GeometryParameters,
-				PixelShader, PixelParameters,
-				BlendState, Viewport4, Amount
-			](FRHICommandListImmediate& RHICmdList)
-			{
-				RHICmdList.SetViewport(
-					Viewport4.Min.X, Viewport4.Min.Y, 0.0f,
-					Viewport4.Max.X, Viewport4.Max.Y, 1.0f
-					);
+		if (RenderProxy->GradientResource != nullptr && RenderProxy->GradientResource->TextureRHI)
+		{
+			PixelParameters->FlareGradientTexture = RenderProxy->GradientResource->TextureRHI;
+		}
 
-				FGraphicsPipelineStateInitializer GraphicsPSOInit;
-				RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
-				GraphicsPSOInit.BlendState = BlendState;
-				GraphicsPSOInit.RasterizerState = TStaticRasterizerState<>::GetRHI();
-				GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
-				GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GEmptyVertexDeclaration.VertexDeclarationRHI;
-				GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader.GetVertexShader();
-				GraphicsPSOInit.BoundShaderState.SetGeometryShader(GeometryShader.GetGeometryShader());
-				GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader.GetPixelShader();
-				GraphicsPSOInit.PrimitiveType = PT_PointList;
-				SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, 0);
+		FLensFlareGlarePS::FPermutationDomain PermutationVector;
+		PermutationVector.Set<FLensFlareGlarePS::FCompositeDim>(bComposite);
+		PermutationVector.Set<FLensFlareHalfPrecisionDim>(UseHalfPrecision(View));
 
-				SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), *VertexParameters);
-				SetShaderParameters(RHICmdList, GeometryShader, GeometryShader.GetGeometryShader(), *GeometryParameters);
-				SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), *PixelParameters);
+		TShaderMapRef<FLensFlareGlarePS> PixelShader(View.ShaderMap, PermutationVector);
+		// Required for Lambda capture
+		FRHIBlendState* BlendState = this->AdditiveBlendState;
 
-				RHICmdList.SetStreamSource(0, nullptr, 0);
-				RHICmdList.DrawPrimitive(0, 1, Amount);
+		if (!UseGlareGeometryShader(View))
+		{
+			// Every tile is sampled once up front, the 18 vertices of its quads only load the result
+			const FString LensFlareGlareTilePassName(TEXT("LensFlareGlareTiles"));
+			const FIntRect TileViewport(FIntPoint::ZeroValue, TileCount);
+
+			FRDGTextureDesc TileDescription = Description;
+			TileDescription.Extent = GetTargetExtent(View.GetSceneTexturesConfig().Extent, 8, TileCount);
+			TileDescription.Format = PF_FloatRGBA;
+			FRDGTextureRef TileTexture = CreateTarget(GraphBuilder, TileDescription, *LensFlareGlareTilePassName);
+
+			// The quads only load the texels of the viewport, the rest doesn't need a clear
+			FLensFlareGlareTilePS::FParameters* TileParameters = GraphBuilder.AllocParameters<FLensFlareGlareTilePS::FParameters>();
+			TileParameters->RenderTargets[0] = FRenderTargetBinding(TileTexture, ERenderTargetLoadAction::ENoAction);
+			TileParameters->InputTexture = VertexParameters->InputTexture;
+			TileParameters->InputSampler = VertexParameters->InputSampler;
+			TileParameters->InputViewportSize = VertexParameters->InputViewportSize;
+			TileParameters->TileCount = TileCount;
+			TileParameters->PixelSize = PixelSize;
+			TileParameters->BufferSize = BufferSize;
+			TileParameters->EyeAdaptationBuffer = ExposureBuffer;
+			TileParameters->ExposureScale = ExposureScale;
+
+			DrawShaderPass(
+				GraphBuilder,
+				LensFlareGlareTilePassName,
+				TileParameters,
+				TShaderMapRef<FCustomScreenPassVS>(View.ShaderMap),
+				TShaderMapRef<FLensFlareGlareTilePS>(View.ShaderMap),
+				ClearBlendState,
+				TileViewport
+				);
+
+			// Same quads, expanded from the vertex ID instead
+			FLensFlareGlareQuadPassParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareGlareQuadPassParameters>();
+			PassParameters->VS.GlareTileTexture = TileTexture;
+			PassParameters->VS.TileCount = TileCount;
+			PassParameters->VS.BufferSize = BufferSize;
+			PassParameters->VS.BufferRatio = BufferRatio;
+			PassParameters->VS.GlareIntensity = GeometryParameters->GlareIntensity;
+			PassParameters->VS.GlareDivider = GeometryParameters->GlareDivider;
+			PassParameters->VS.GlareTint = GeometryParameters->GlareTint;
+			for (int32 Index = 0; Index < 3; ++Index)
+			{
+				GET_SCALAR_ARRAY_ELEMENT(PassParameters->VS.GlareScales, Index) = GET_SCALAR_ARRAY_ELEMENT(GeometryParameters->GlareScales, Index);
+				GET_SCALAR_ARRAY_ELEMENT(PassParameters->VS.GlareAngles, Index) = GET_SCALAR_ARRAY_ELEMENT(GeometryParameters->GlareAngles, Index);
 			}
-			);
+			PassParameters->PS = *PixelParameters;
+			PassParameters->RenderTargets = VertexParameters->RenderTargets;
+
+			TShaderMapRef<FLensFlareGlareQuadVS> QuadVertexShader(View.ShaderMap);
+
+			GraphBuilder.AddPass(
+				RDG_EVENT_NAME("%s", *LensFlareGlarePassName),
+				PassParameters,
+				ERDGPassFlags::Raster,
+				[QuadVertexShader, PixelShader, PassParameters, BlendState, OutputViewport, Amount](FRHICommandListImmediate& RHICmdList)
+				{
+					RHICmdList.SetViewport(
+						OutputViewport.Min.X, OutputViewport.Min.Y, 0.0f,
+						OutputViewport.Max.X, OutputViewport.Max.Y, 1.0f
+						);
+
+					FGraphicsPipelineStateInitializer GraphicsPSOInit = MakeSpritePipelineState(QuadVertexShader.GetVertexShader(), PixelShader.GetPixelShader(), BlendState);
+					RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+					FCustomLensFlarePSOPrecache::ValidatePrecached(GraphicsPSOInit, TEXT("LensFlareGlare"));
+					SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, 0);
+
+					SetShaderParameters(RHICmdList, QuadVertexShader, QuadVertexShader.GetVertexShader(), PassParameters->VS);
+					SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), PassParameters->PS);
+
+					RHICmdList.SetStreamSource(0, nullptr, 0);
+					RHICmdList.DrawPrimitive(0, GlareQuadTriangles, Amount);
+				}
+				);
+		}
+		else
+		{
+			TShaderMapRef<FLensFlareGlareVS> VertexShader(View.ShaderMap);
+			TShaderMapRef<FLensFlareGlareGS> GeometryShader(View.ShaderMap);
+
+			GraphBuilder.AddPass(
+				RDG_EVENT_NAME("%s", *LensFlareGlarePassName),
+				VertexParameters,
+				ERDGPassFlags::Raster,
+				[
+					VertexShader, VertexParameters,
+					GeometryShader, GeometryParameters,
+					PixelShader, PixelParameters,
+					BlendState, OutputViewport, Amount
+				](FRHICommandListImmediate& RHICmdList)
+				{
+					RHICmdList.SetViewport(
+						OutputViewport.Min.X, OutputViewport.Min.Y, 0.0f,
+						OutputViewport.Max.X, OutputViewport.Max.Y, 1.0f
+						);
+
+					FGraphicsPipelineStateInitializer GraphicsPSOInit = MakeGlarePipelineState(VertexShader, GeometryShader, PixelShader, BlendState);
+					RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+					FCustomLensFlarePSOPrecache::ValidatePrecached(GraphicsPSOInit, TEXT("LensFlareGlare"));
+					SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, 0);
+
+					SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), *VertexParameters);
+					SetShaderParameters(RHICmdList, GeometryShader, GeometryShader.GetGeometryShader(), *GeometryParameters);
+					SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), *PixelParameters);
+
+					RHICmdList.SetStreamSource(0, nullptr, 0);
+					RHICmdList.DrawPrimitive(0, 1, Amount);
+				}
+				);
+		}
 
-		OutputTexture = FScreenPassTexture(GlareTexture);
+		// Nothing left for the mix to add when the glare went into the composite target
+		if (!bComposite)
+		{
+			OutputTexture = FScreenPassTexture(GlareTexture, Viewport4);
+		}
 	} // End of if()
 
 	return OutputTexture;
 }
 
+FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderStreaks(FRDGBuilder& GraphBuilder, const FScreenPassTextureSlice& BloomTexture, const FViewInfo& View)
+{
+	const FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy* RenderProxy = GetPerViewRenderProxy(View);
+
+	// Index of the dimension the streaks run along and of the one across them
+	const int32 Along = RenderProxy->StreakAxis == ECustomLensFlareStreakAxis::Vertical ? 1 : 0;
+	const int32 Across = 1 - Along;
+	const FVector2f StreakAxis = Along == 0 ? FVector2f(1.0f, 0.0f) : FVector2f(0.0f, 1.0f);
+
+	FLensFlareStreakDownPS::FPermutationDomain PermutationVector;
+	PermutationVector.Set<FLensFlareHalfPrecisionDim>(UseHalfPrecision(View));
+
+	TShaderMapRef<FCustomScreenPassVS> VertexShader(View.ShaderMap);
+	TShaderMapRef<FLensFlareStreakPrefilterPS> PixelShaderPrefilter(View.ShaderMap, PermutationVector);
+	TShaderMapRef<FLensFlareStreakDownPS> PixelShaderDown(View.ShaderMap, PermutationVector);
+	TShaderMapRef<FLensFlareStreakUpPS> PixelShaderUp(View.ShaderMap, PermutationVector);
+
+	// The first level has half the resolution of the bloom across the axis, every further one half the previous along it.
+	// The sizes follow the mip of the bloom pyramid as well, so the extents stay stable under dynamic resolution.
+	FIntPoint Size = BloomTexture.ViewRect.Size();
+	FIntPoint ReferenceExtent = GetSliceViewport(BloomTexture).Extent;
+	Size[Across] = FMath::Max(Size[Across] / 2, 1);
+	ReferenceExtent[Across] = FMath::DivideAndRoundUp(ReferenceExtent[Across], 2);
+
+	// Halving down to a few texels lets the streaks reach across the screen. The pass count only follows the
+	// resolution, the length is how much the upsamples keep of the coarser levels.
+	const int32 LevelCount = FMath::Max(int32(FMath::FloorLog2(uint32(FMath::Max(Size[Along], 1)))) - StreakMinSizeLog2 + 1, 2);
+
+	FRDGTextureDesc Description = BloomTexture.TextureSRV->GetParent()->Desc;
+	Description.Reset();
+	Description.NumMips = 1;
+	Description.Format = PF_FloatRGB;
+	Description.ClearValue = FClearValueBinding(FLinearColor::Transparent);
+
+	TArray<FScreenPassTexture, TInlineAllocator<16>> Levels;
+	for (int32 Level = 0; Level < LevelCount; ++Level)
+	{
+		if (Level > 0)
+		{
+			Size[Along] = FMath::Max(Size[Along] / 2, 1);
+			ReferenceExtent[Along] = FMath::DivideAndRoundUp(ReferenceExtent[Along], 2);
+		}
+
+		const FIntRect Viewport(FIntPoint::ZeroValue, Size);
+		const FString PassName = FString::Printf(TEXT("LensFlareStreak_%i_%s_%ix%i"), Level, Level == 0 ? TEXT("Prefilter") : TEXT("Down"), Size.X, Size.Y);
+
+		Description.Extent = GetTargetExtent(ReferenceExtent, 1, Size);
+		FRDGTextureRef Texture = CreateTarget(GraphBuilder, Description, *PassName);
+		const ERenderTargetLoadAction LoadAction = GetTargetLoadAction(Texture, Viewport);
+
+		if (Level == 0)
+		{
+			FLensFlareStreakPrefilterPS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareStreakPrefilterPS::FParameters>();
+			PassParameters->InputTexture = BloomTexture.TextureSRV;
+			PassParameters->RenderTargets[0] = FRenderTargetBinding(Texture, LoadAction);
+			PassParameters->InputSampler = BilinearBorderSampler;
+			PassParameters->StreakColor = FVector3f(RenderProxy->GlareTint.R, RenderProxy->GlareTint.G, RenderProxy->GlareTint.B)
+				* RenderProxy->GlareTint.A * RenderProxy->GlareIntensity;
+
+			DrawSplitResolutionPass(GraphBuilder, PassName, PassParameters, VertexShader, PixelShaderPrefilter, ClearBlendState, BloomTexture, Viewport);
+		}
+		else
+		{
+			const FScreenPassTexture& Input = Levels.Last();
+
+			FLensFlareStreakDownPS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareStreakDownPS::FParameters>();
+			PassParameters->Pass.InputTexture = Input.Texture;
+			PassParameters->Pass.RenderTargets[0] = FRenderTargetBinding(Texture, LoadAction);
+			PassParameters->InputSampler = BilinearBorderSampler;
+			PassParameters->StreakAxis = StreakAxis;
+			PassParameters->InputTexelSize = FVector2f(1.0f, 1.0f) / FVector2f(Input.Texture->Desc.Extent);
+
+			DrawSplitResolutionPass(GraphBuilder, PassName, PassParameters, VertexShader, PixelShaderDown, ClearBlendState,
+				FScreenPassTextureSlice(GraphBuilder.CreateSRV(Input.Texture), Input.ViewRect), Viewport);
+		}
+
+		Levels.Emplace(Texture, Viewport);
+	}
+
+	// Back up to the first level, every upsample blends the coarser result into the level of the down chain
+	FScreenPassTexture Output = Levels.Last();
+	for (int32 Level = LevelCount - 2; Level >= 0; --Level)
+	{
+		const FScreenPassTexture& High = Levels[Level];
+		const FString PassName = FString::Printf(TEXT("LensFlareStreak_%i_Up_%ix%i"), Level, High.ViewRect.Width(), High.ViewRect.Height());
+
+		FRDGTextureRef Texture = CreateTarget(GraphBuilder, High.Texture->Desc, *PassName);
+
+		FLensFlareStreakUpPS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareStreakUpPS::FParameters>();
+		PassParameters->Pass.InputTexture = Output.Texture;
+		PassParameters->Pass.RenderTargets[0] = FRenderTargetBinding(Texture, GetTargetLoadAction(Texture, High.ViewRect));
+		PassParameters->HighTexture = High.Texture;
+		PassParameters->InputSampler = BilinearBorderSampler;
+		PassParameters->StreakAxis = StreakAxis;
+		PassParameters->InputTexelSize = FVector2f(1.0f, 1.0f) / FVector2f(Output.Texture->Desc.Extent);
+		PassParameters->InputViewportSize = GetViewportUVSize(Output);
+		PassParameters->HighViewportSize = GetViewportUVSize(High);
+		PassParameters->Stretch = FMath::Clamp(RenderProxy->StreakStretch, 0.0f, 1.0f);
+
+		DrawSplitResolutionPass(GraphBuilder, PassName, PassParameters, VertexShader, PixelShaderUp, ClearBlendState,
+			FScreenPassTextureSlice(GraphBuilder.CreateSRV(Output.Texture), Output.ViewRect), High.ViewRect);
+
+		Output = FScreenPassTexture(Texture, High.ViewRect);
+	}
+
+	return Output;
+}
+
 FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderBlur(FRDGBuilder& GraphBuilder, FScreenPassTexture InputTexture,
-	const FViewInfo& View, int BlurSteps)
+	const FViewInfo& View, int BlurSteps, EBlurMethod Method)
 {
+	if (Method == EBlurMethod::Compute && UE::PixelFormat::HasCapabilities(PF_FloatRGB, EPixelFormatCapabilities::TypedUAVStore))
+	{
+		// The Kawase chain below spreads a pixel like a gaussian with a variance of (4^BlurSteps - 1) / 2 square pixels
+		const float Sigma = FMath::Sqrt((FMath::Pow(4.0f, float(BlurSteps)) - 1.0f) * 0.5f);
+		const int32 Radius = FMath::CeilToInt(3.0f * Sigma);
+		if (Radius <= SeparableBlurMaxRadius)
+		{
+			return AddSeparableBlurPasses(GraphBuilder, View.ShaderMap, InputTexture, Sigma, Radius, UseHalfPrecision(View));
+		}
+	}
+
 	// Shader setup
+	FKawaseBlurDownPS::FPermutationDomain PermutationVector;
+	PermutationVector.Set<FLensFlareHalfPrecisionDim>(UseHalfPrecision(View));
+
 	TShaderMapRef<FCustomScreenPassVS> VertexShader(View.ShaderMap);
-	TShaderMapRef<FKawaseBlurDownPS> PixelShaderDown(View.ShaderMap);
-	TShaderMapRef<FKawaseBlurUpPS> PixelShaderUp(View.ShaderMap);
+	TShaderMapRef<FKawaseBlurDownPS> PixelShaderDown(View.ShaderMap, PermutationVector);
+	TShaderMapRef<FKawaseBlurUpPS> PixelShaderUp(View.ShaderMap, PermutationVector);
 
 	// Data setup
 	FRDGTextureRef PreviousBuffer = InputTexture.Texture;
@@ -1143,6 +3441,7 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderBlur(FRDGBuilder& G
 	// sizes for upscale passes but heh... it works.
 	int32 Divider = 2;
 	TArray<FIntRect> Viewports;
+	TArray<int32> Dividers;
 	for (int32 i = 0; i < ArraySize; i++)
 	{
 		FIntRect NewRect = FIntRect(
@@ -1153,6 +3452,7 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderBlur(FRDGBuilder& G
 			);
 
 		Viewports.Add(NewRect);
+		Dividers.Add(Divider);
 
 		if (i < (BlurSteps - 1))
 		{
@@ -1170,14 +3470,17 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderBlur(FRDGBuilder& G
 		// Build texture
 		FRDGTextureDesc BlurDesc = InputDescription;
 		BlurDesc.Reset();
-		BlurDesc.Extent = Viewports[i].Size();
+		BlurDesc.Extent = GetTargetExtent(InputDescription.Extent, Dividers[i], Viewports[i].Size());
 		BlurDesc.Format = PF_FloatRGB;
 		BlurDesc.NumMips = 1;
 		BlurDesc.ClearValue = FClearValueBinding(FLinearColor::Transparent);
 
+		// The offsets are in UV of the input, which can cover less than all of its texture
+		const FIntRect& InputViewport = i == 0 ? InputTexture.ViewRect : Viewports[i - 1];
+		const FIntPoint InputExtent = PreviousBuffer->Desc.Extent;
 		FVector2f ViewportResolution = FVector2f(
-			Viewports[i].Width(),
-			Viewports[i].Height()
+			float(Viewports[i].Width()) * InputExtent.X / FMath::Max(InputViewport.Width(), 1),
+			float(Viewports[i].Height()) * InputExtent.Y / FMath::Max(InputViewport.Height(), 1)
 			);
 
 		const FString PassName =
@@ -1186,7 +3489,8 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderBlur(FRDGBuilder& G
 			+ ((i < BlurSteps) ? PassDownName : PassUpName)
 			+ FString::Printf(TEXT("_%ix%i"), Viewports[i].Width(), Viewports[i].Height());
 
-		FRDGTextureRef Buffer = GraphBuilder.CreateTexture(BlurDesc, *PassName);
+		FRDGTextureRef Buffer = CreateTarget(GraphBuilder, BlurDesc, *PassName);
+		const ERenderTargetLoadAction LoadAction = GetTargetLoadAction(Buffer, Viewports[i]);
 
 		// Render shader
 		if (i < BlurSteps)
@@ -1194,8 +3498,7 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderBlur(FRDGBuilder& G
 			FKawaseBlurDownPS::FParameters* PassDownParameters = GraphBuilder.AllocParameters<
 				FKawaseBlurDownPS::FParameters>();
 			PassDownParameters->Pass.InputTexture = PreviousBuffer;
-			PassDownParameters->Pass.RenderTargets[0] =
-				FRenderTargetBinding(Buffer, ERenderTargetLoadAction::ENoAction);
+			PassDownParameters->Pass.RenderTargets[0] = FRenderTargetBinding(Buffer, LoadAction);
 			PassDownParameters->InputSampler = BilinearClampSampler;
 			PassDownParameters->BufferSize = ViewportResolution;
 
@@ -1206,7 +3509,7 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderBlur(FRDGBuilder& G
 				VertexShader,
 				PixelShaderDown,
 				ClearBlendState,
-				FScreenPassTextureSlice(GraphBuilder.CreateSRV(PreviousBuffer), i == 0 ? InputTexture.ViewRect : Viewports[i - 1]),
+				FScreenPassTextureSlice(GraphBuilder.CreateSRV(PreviousBuffer), InputViewport),
 				Viewports[i]
 				);
 		}
@@ -1215,7 +3518,7 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderBlur(FRDGBuilder& G
 			FKawaseBlurUpPS::FParameters* PassUpParameters = GraphBuilder.AllocParameters<
 				FKawaseBlurUpPS::FParameters>();
 			PassUpParameters->Pass.InputTexture = PreviousBuffer;
-			PassUpParameters->Pass.RenderTargets[0] = FRenderTargetBinding(Buffer, ERenderTargetLoadAction::ENoAction);
+			PassUpParameters->Pass.RenderTargets[0] = FRenderTargetBinding(Buffer, LoadAction);
 			PassUpParameters->InputSampler = BilinearClampSampler;
 			PassUpParameters->BufferSize = ViewportResolution;
 
@@ -1226,7 +3529,7 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderBlur(FRDGBuilder& G
 				VertexShader,
 				PixelShaderUp,
 				ClearBlendState,
-				FScreenPassTextureSlice(GraphBuilder.CreateSRV(PreviousBuffer), Viewports[i - 1]),
+				FScreenPassTextureSlice(GraphBuilder.CreateSRV(PreviousBuffer), InputViewport),
 				Viewports[i]
 				);
 		}
@@ -1234,13 +3537,16 @@ FScreenPassTexture FCustomLensFlareSceneViewExtension::RenderBlur(FRDGBuilder& G
 		PreviousBuffer = Buffer;
 	}
 
-	return FScreenPassTexture(PreviousBuffer);
+	return FScreenPassTexture(PreviousBuffer, Viewports.Last());
 }
 
 FScreenPassTextureSlice FCustomLensFlareSceneViewExtension::FBloomFlareProcess::RenderBloom(FRDGBuilder& GraphBuilder, const FViewInfo& View, const FScreenPassTextureSlice& SceneColor, int32 PassAmount)
 {
 	check(SceneColor.IsValid());
 
+	// Every downsample needs a mip of its own
+	PassAmount = FMath::Min(PassAmount, int32(FMath::FloorLog2(uint32(SceneColor.ViewRect.Size().GetMax()))) + 1);
+
 	if (PassAmount <= 1)
 	{
 		return {};
@@ -1256,6 +3562,18 @@ FScreenPassTextureSlice FCustomLensFlareSceneViewExtension::FBloomFlareProcess::
 	int32 Divider = 1;
 	FScreenPassTextureSlice PreviousTexture = SceneColor;
 
+	// Each direction of the pyramid is one mipmapped texture. The passes read and write single mips of it,
+	// so any effect can pick the resolution it needs without a copy.
+	// Sized after scene color rather than the view, so the mips keep their size under dynamic resolution.
+	const FIntPoint SceneColorExtent = SceneColor.TextureSRV->GetParent()->Desc.Extent;
+	FRDGTextureDesc Description = SceneColor.TextureSRV->GetParent()->Desc;
+	Description.Reset();
+	Description.Extent = GetTargetExtent(SceneColorExtent, 2, FIntPoint(FMath::Max(Width / 2, 1), FMath::Max(Height / 2, 1)));
+	Description.Format = PF_FloatRGB;
+	Description.NumMips = PassAmount - 1;
+	Description.ClearValue = FClearValueBinding(FLinearColor::Black);
+	FRDGTextureRef DownsampleTexture = CreateTarget(GraphBuilder, Description, TEXT("BloomDownsample"));
+
 	for (int32 i = 0; i < PassAmount; i++)
 	{
 		FIntRect Size{
@@ -1284,12 +3602,15 @@ FScreenPassTextureSlice FCustomLensFlareSceneViewExtension::FBloomFlareProcess::
 		}
 		else
 		{
+			// Threshold once while producing the first reduced mip. The rest of the chain only filters.
 			Texture = RenderDownsample(
 				GraphBuilder,
 				PassName,
 				View,
 				PreviousTexture,
-				Size
+				DownsampleTexture,
+				i - 1,
+				i == 1
 				);
 		}
 
@@ -1313,7 +3634,23 @@ FScreenPassTextureSlice FCustomLensFlareSceneViewExtension::FBloomFlareProcess::
 	// before as the current input (-1).
 	// We also go from end to start of array to
 	// go from small to big texture (going back up the mips)
-	for (int32 i = PassAmount - 2; i >= 0; i--)
+	// A fused mix does the last step into scene color itself.
+	const int32 LastUpsample = bFuseLastUpsample ? 1 : 0;
+
+	// Mip 0 is the last upsample, a full resolution one is written as UAV when tiles are skipped
+	FRDGTextureRef UpsampleTexture = nullptr;
+	if (PassAmount - 2 >= LastUpsample)
+	{
+		Description.Extent = GetTargetExtent(SceneColorExtent, 1 << LastUpsample, MipMapsUpsample[LastUpsample].ViewRect.Size());
+		Description.NumMips = PassAmount - 1 - LastUpsample;
+		if (LastUpsample == 0 && bTileClassification)
+		{
+			Description.Flags |= TexCreate_UAV;
+		}
+		UpsampleTexture = CreateTarget(GraphBuilder, Description, TEXT("BloomUpsample"));
+	}
+
+	for (int32 i = PassAmount - 2; i >= LastUpsample; i--)
 	{
 		FIntRect CurrentSize = MipMapsUpsample[i].ViewRect;
 
@@ -1324,45 +3661,86 @@ FScreenPassTextureSlice FCustomLensFlareSceneViewExtension::FBloomFlareProcess::
 			+ "x"
 			+ FString::FromInt(CurrentSize.Height());
 
-		FScreenPassTextureSlice ResultTexture = RenderUpsampleCombine(
-			GraphBuilder,
-			PassName,
-			View,
-			MipMapsUpsample[i], // Current texture
-			MipMapsUpsample[i + 1], // Previous texture,
-			Radius
-			);
+		FScreenPassTextureSlice ResultTexture;
+
+		// The last upsample is full resolution and is the only one worth skipping tiles in
+		if (i == 0 && bTileClassification)
+		{
+			ResultTexture = RenderUpsampleCombineTiled(
+				GraphBuilder,
+				PassName,
+				View,
+				MipMapsUpsample[i], // Current texture
+				MipMapsUpsample[i + 1], // Previous texture,
+				UpsampleTexture,
+				i - LastUpsample,
+				Radius
+				);
+		}
+		else
+		{
+			ResultTexture = RenderUpsampleCombine(
+				GraphBuilder,
+				PassName,
+				View,
+				MipMapsUpsample[i], // Current texture
+				MipMapsUpsample[i + 1], // Previous texture,
+				UpsampleTexture,
+				i - LastUpsample,
+				Radius
+				);
+		}
 
 		MipMapsUpsample[i] = ResultTexture;
 	}
 
-	return MipMapsUpsample[0];
+	return MipMapsUpsample[LastUpsample];
 }
 
-FScreenPassTextureSlice FCustomLensFlareSceneViewExtension::FBloomFlareProcess::RenderDownsample(FRDGBuilder& GraphBuilder, const FString& PassName, const FViewInfo& View, FScreenPassTextureSlice InputTexture, const FIntRect& Viewport)
+FScreenPassTextureSlice FCustomLensFlareSceneViewExtension::FBloomFlareProcess::GetBloomMip(int32 MipLevel) const
 {
-	const FCustomLensFlareSceneViewExtensionData::FPerViewExtensionData* PerViewExtensionData = GetPerViewExtensionData(View);
-	// Build texture
-	FRDGTextureDesc Description = InputTexture.TextureSRV->GetParent()->Desc;
-	Description.Reset();
-	Description.Extent = Viewport.Size();
-	Description.Format = PF_FloatRGB;
-	Description.ClearValue = FClearValueBinding(FLinearColor::Black);
-	FRDGTextureRef TargetTexture = GraphBuilder.CreateTexture(Description, *PassName);
+	if (MipMapsUpsample.IsEmpty())
+		return {};
+
+	// The smallest entry is the last downsample that the upsamples start from
+	const int32 FirstMip = bFuseLastUpsample ? 1 : 0;
+	return MipMapsUpsample[FMath::Clamp(FirstMip + MipLevel, FirstMip, MipMapsUpsample.Num() - 1)];
+}
+
+FScreenPassTextureSlice FCustomLensFlareSceneViewExtension::FBloomFlareProcess::FindGhostSourceMip(int32 MaxWidth) const
+{
+	// Mip 0 is scene color itself and isn't thresholded
+	for (int32 MipIndex = 1; MipIndex < MipMapsDownsample.Num(); ++MipIndex)
+	{
+		if (MipMapsDownsample[MipIndex].ViewRect.Width() <= MaxWidth)
+			return MipMapsDownsample[MipIndex];
+	}
+
+	return MipMapsDownsample.Num() > 1 ? MipMapsDownsample.Last() : FScreenPassTextureSlice();
+}
+
+FScreenPassTextureSlice FCustomLensFlareSceneViewExtension::FBloomFlareProcess::RenderDownsample(FRDGBuilder& GraphBuilder, const FString& PassName, const FViewInfo& View, FScreenPassTextureSlice InputTexture, FRDGTextureRef TargetTexture, int32 MipLevel, bool bPrefilter)
+{
+	const FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy* RenderProxy = GetPerViewRenderProxy(View);
+	// The mip can be larger than the view needs, see r.LensFlare.StableExtents
+	const FIntRect Viewport(0, 0, FMath::Max(InputTexture.ViewRect.Width() / 2, 1), FMath::Max(InputTexture.ViewRect.Height() / 2, 1));
+	check(Viewport.Width() <= GetMipSize(TargetTexture, MipLevel).X && Viewport.Height() <= GetMipSize(TargetTexture, MipLevel).Y);
 
 	// Render shader
 	TShaderMapRef<FCustomScreenPassVS> VertexShader(View.ShaderMap);
-	TShaderMapRef<FDownsamplePS> PixelShader(View.ShaderMap);
+	TShaderMapRef<FDownsamplePS> PixelShader(View.ShaderMap, FDownsamplePS::GetPermutationVector(bPrefilter, bHalfPrecision));
 
 	FDownsamplePS::FParameters* PassParameters = GraphBuilder.AllocParameters<FDownsamplePS::FParameters>();
 
 	PassParameters->InputTexture = InputTexture.TextureSRV;
-	PassParameters->RenderTargets[0] = FRenderTargetBinding(TargetTexture, ERenderTargetLoadAction::ENoAction);
+	PassParameters->RenderTargets[0] = FRenderTargetBinding(TargetTexture, GetTargetLoadAction(TargetTexture, Viewport, MipLevel), MipLevel);
 	PassParameters->InputSampler = OwningExtension.BilinearBorderSampler;
-	FIntVector ParentPixelSize = InputTexture.TextureSRV->GetParent()->Desc.GetSize();
-	PassParameters->InputSizeAndInvInputSize = SizeToSizeAndInvSize(ParentPixelSize);
+	PassParameters->InputSizeAndInvInputSize = SizeToSizeAndInvSize(GetSliceViewport(InputTexture).Extent);
+	PassParameters->Input = GetScreenPassTextureViewportParameters(GetSliceViewport(InputTexture));
 	PassParameters->ThresholdLevel = View.FinalPostProcessSettings.BloomThreshold;
-	PassParameters->ThresholdRange = PerViewExtensionData->ThresholdRange;
+	PassParameters->ThresholdRange = RenderProxy->ThresholdRange;
+	PassParameters->EyeAdaptationBuffer = ExposureBuffer;
+	PassParameters->ExposureScale = ExposureScale;
 
 	DrawSplitResolutionPass(
 		GraphBuilder,
@@ -1375,34 +3753,30 @@ FScreenPassTextureSlice FCustomLensFlareSceneViewExtension::FBloomFlareProcess::
 		Viewport
 		);
 
-	FScreenPassTextureSlice TargetTextureSlice(GraphBuilder.CreateSRV(FRDGTextureSRVDesc(TargetTexture)), FIntRect(FIntPoint::ZeroValue, Viewport.Size()));
+	FScreenPassTextureSlice TargetTextureSlice(GraphBuilder.CreateSRV(FRDGTextureSRVDesc::CreateForMipLevel(TargetTexture, MipLevel)), Viewport);
 	return TargetTextureSlice;
 }
 
-FScreenPassTextureSlice FCustomLensFlareSceneViewExtension::FBloomFlareProcess::RenderUpsampleCombine(FRDGBuilder& GraphBuilder, const FString& PassName, const FViewInfo& View, const FScreenPassTextureSlice& InputTexture, const FScreenPassTextureSlice& PreviousTexture, float Radius)
+FScreenPassTextureSlice FCustomLensFlareSceneViewExtension::FBloomFlareProcess::RenderUpsampleCombine(FRDGBuilder& GraphBuilder, const FString& PassName, const FViewInfo& View, const FScreenPassTextureSlice& InputTexture, const FScreenPassTextureSlice& PreviousTexture, FRDGTextureRef TargetTexture, int32 MipLevel, float Radius)
 {
-	// Build texture
-	FRDGTextureDesc Description = InputTexture.TextureSRV->GetParent()->Desc;
-	Description.Reset();
-	Description.Extent = InputTexture.ViewRect.Size();
-	Description.Format = PF_FloatRGB;
-	Description.ClearValue = FClearValueBinding(FLinearColor::Black);
-	FRDGTextureRef TargetTexture = GraphBuilder.CreateTexture(Description, *PassName);
+	// Same size as the downsample that is combined in, at the origin
+	const FIntRect Viewport(FIntPoint::ZeroValue, InputTexture.ViewRect.Size());
+
+	FUpsampleCombinePS::FPermutationDomain PermutationVector;
+	PermutationVector.Set<FLensFlareHalfPrecisionDim>(bHalfPrecision);
 
 	TShaderMapRef<FCustomScreenPassVS> VertexShader(View.ShaderMap);
-	TShaderMapRef<FUpsampleCombinePS> PixelShader(View.ShaderMap);
+	TShaderMapRef<FUpsampleCombinePS> PixelShader(View.ShaderMap, PermutationVector);
 
 	FUpsampleCombinePS::FParameters* PassParameters = GraphBuilder.AllocParameters<FUpsampleCombinePS::FParameters>();
 
-	PassParameters->InputTexture = InputTexture.TextureSRV;
-	PassParameters->RenderTargets[0] = FRenderTargetBinding(TargetTexture, ERenderTargetLoadAction::ENoAction);
-	PassParameters->InputSampler = OwningExtension.BilinearClampSampler;
-	FIntVector InputTextureSize = InputTexture.TextureSRV->GetParent()->Desc.GetSize();
-	PassParameters->InputSizeAndInvInputSize = ViewToUVScaleAndPixelSize(InputTexture.ViewRect, {InputTextureSize.X, InputTextureSize.Y});
-	PassParameters->PreviousTexture = PreviousTexture.TextureSRV;
-	FIntVector PreviousTextureSize = PreviousTexture.TextureSRV->GetParent()->Desc.GetSize();
-	PassParameters->PreviousSizeAndInvInputSize = ViewToUVScaleAndPixelSize(PreviousTexture.ViewRect, {PreviousTextureSize.X, PreviousTextureSize.Y});
-	PassParameters->Radius = Radius;
+	PassParameters->RenderTargets[0] = FRenderTargetBinding(TargetTexture, GetTargetLoadAction(TargetTexture, Viewport, MipLevel), MipLevel);
+	PassParameters->Upsample.InputTexture = InputTexture.TextureSRV;
+	PassParameters->Upsample.InputSampler = OwningExtension.BilinearClampSampler;
+	PassParameters->Upsample.Input = GetScreenPassTextureViewportParameters(GetSliceViewport(InputTexture));
+	PassParameters->Upsample.PreviousTexture = PreviousTexture.TextureSRV;
+	PassParameters->Upsample.Previous = GetScreenPassTextureViewportParameters(GetSliceViewport(PreviousTexture));
+	PassParameters->Upsample.Radius = Radius;
 
 	DrawSplitResolutionPass(
 		GraphBuilder,
@@ -1412,9 +3786,118 @@ FScreenPassTextureSlice FCustomLensFlareSceneViewExtension::FBloomFlareProcess::
 		PixelShader,
 		OwningExtension.ClearBlendState,
 		InputTexture,
-		InputTexture.ViewRect
+		Viewport
 		);
 
-	FScreenPassTextureSlice TargetTextureSlice(GraphBuilder.CreateSRV(FRDGTextureSRVDesc(TargetTexture)), FIntRect(FIntPoint::ZeroValue, InputTexture.ViewRect.Size()));
+	FScreenPassTextureSlice TargetTextureSlice(GraphBuilder.CreateSRV(FRDGTextureSRVDesc::CreateForMipLevel(TargetTexture, MipLevel)), Viewport);
+	return TargetTextureSlice;
+}
+
+FScreenPassTextureSlice FCustomLensFlareSceneViewExtension::FBloomFlareProcess::RenderUpsampleCombineTiled(FRDGBuilder& GraphBuilder, const FString& PassName, const FViewInfo& View, const FScreenPassTextureSlice& InputTexture, const FScreenPassTextureSlice& PreviousTexture, FRDGTextureRef TargetTexture, int32 MipLevel, float Radius)
+{
+	const FIntPoint OutputSize = InputTexture.ViewRect.Size();
+
+	FRDGTextureUAVRef TargetUAV = GraphBuilder.CreateUAV(FRDGTextureUAVDesc(TargetTexture, MipLevel));
+	AddClearUAVPass(GraphBuilder, TargetUAV, FLinearColor::Black);
+
+	// Flares and glare come after the bloom, so only the bloom itself decides here
+	FRDGBufferRef TileList = nullptr;
+	FRDGBufferRef DispatchArgs = nullptr;
+	ClassifyTiles(GraphBuilder, View, OutputSize, UpsampleTileSize, FScreenPassTexture(), FScreenPassTexture(), 0.0f, TileList, DispatchArgs);
+
+	FUpsampleCombineCS::FPermutationDomain PermutationVector;
+	PermutationVector.Set<FLensFlareHalfPrecisionDim>(bHalfPrecision);
+
+	FUpsampleCombineCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FUpsampleCombineCS::FParameters>();
+	PassParameters->Upsample.InputTexture = InputTexture.TextureSRV;
+	PassParameters->Upsample.InputSampler = OwningExtension.BilinearClampSampler;
+	PassParameters->Upsample.Input = GetScreenPassTextureViewportParameters(GetSliceViewport(InputTexture));
+	PassParameters->Upsample.PreviousTexture = PreviousTexture.TextureSRV;
+	PassParameters->Upsample.Previous = GetScreenPassTextureViewportParameters(GetSliceViewport(PreviousTexture));
+	PassParameters->Upsample.Radius = Radius;
+	PassParameters->TileList = GraphBuilder.CreateSRV(TileList, PF_R32_UINT);
+	PassParameters->OutputSize = FUintVector2(OutputSize.X, OutputSize.Y);
+	PassParameters->RWOutput = TargetUAV;
+	PassParameters->IndirectDispatchArgs = DispatchArgs;
+
+	TShaderMapRef<FUpsampleCombineCS> ComputeShader(View.ShaderMap, PermutationVector);
+	FCustomLensFlarePSOPrecache::ValidatePrecached(ComputeShader.GetComputeShader(), TEXT("UpsampleCombineTiled"));
+
+	FComputeShaderUtils::AddPass(
+		GraphBuilder,
+		RDG_EVENT_NAME("%s (Tiled)", *PassName),
+		ComputeShader,
+		PassParameters,
+		DispatchArgs,
+		0);
+
+	FScreenPassTextureSlice TargetTextureSlice(GraphBuilder.CreateSRV(FRDGTextureSRVDesc::CreateForMipLevel(TargetTexture, MipLevel)), FIntRect(FIntPoint::ZeroValue, OutputSize));
 	return TargetTextureSlice;
 }
+
+void FCustomLensFlareSceneViewExtension::FBloomFlareProcess::ClassifyTiles(FRDGBuilder& GraphBuilder, const FViewInfo& View, FIntPoint OutputSize, int32 TileSize, const FScreenPassTexture& FlareTexture, const FScreenPassTexture& GlareTexture, float FlareWeight, FRDGBufferRef& OutTileList, FRDGBufferRef& OutDispatchArgs) const
+{
+	const FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy* RenderProxy = GetPerViewRenderProxy(View);
+	const FIntPoint TileCount = FIntPoint::DivideAndRoundUp(OutputSize, TileSize);
+
+	FRDGTextureRef BlackDummy = GraphBuilder.RegisterExternalTexture(GSystemTextures.BlackDummy, TEXT("BlackDummy"));
+
+	OutTileList = GraphBuilder.CreateBuffer(
+		FRDGBufferDesc::CreateBufferDesc(sizeof(uint32), TileCount.X * TileCount.Y),
+		TEXT("LensFlareTileList"));
+	FRDGBufferRef TileCountBuffer = GraphBuilder.CreateBuffer(
+		FRDGBufferDesc::CreateBufferDesc(sizeof(uint32), 1),
+		TEXT("LensFlareTileCount"));
+
+	FRDGBufferUAVRef TileCountUAV = GraphBuilder.CreateUAV(TileCountBuffer, PF_R32_UINT);
+	AddClearUAVPass(GraphBuilder, TileCountUAV, 0u);
+
+	// Whatever ends up in a tile goes through these weights before it reaches the screen
+	const float BloomIntensity = RenderProxy->Intensity * View.FinalPostProcessSettings.BloomIntensity;
+	const float Radius = CVarBloomRadius.GetValueOnRenderThread();
+
+	FLensFlareClassifyTilesCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FLensFlareClassifyTilesCS::FParameters>();
+	PassParameters->TileCount = FUintVector2(TileCount.X, TileCount.Y);
+	PassParameters->TileUVSize = FVector2f(float(TileSize) / OutputSize.X, float(TileSize) / OutputSize.Y);
+	PassParameters->InputSampler = OwningExtension.BilinearClampSampler;
+	PassParameters->BloomTexture = GraphBuilder.CreateSRV(FRDGTextureSRVDesc(BlackDummy));
+	PassParameters->BloomViewportSize = FVector2f(1.0f, 1.0f);
+	PassParameters->BloomWeight = 0.0f;
+	PassParameters->SceneColorTexture = PassParameters->BloomTexture;
+	PassParameters->SceneColor = GetScreenPassTextureViewportParameters(FScreenPassTextureViewport(BlackDummy));
+	PassParameters->SceneColorWeight = 0.0f;
+	PassParameters->FlareTexture = FlareTexture.IsValid() ? FlareTexture.Texture : BlackDummy;
+	PassParameters->GlareTexture = GlareTexture.IsValid() ? GlareTexture.Texture : BlackDummy;
+	PassParameters->FlareViewportSize = FlareTexture.IsValid() ? GetViewportUVSize(FlareTexture) : FVector2f(1.0f, 1.0f);
+	PassParameters->GlareViewportSize = GlareTexture.IsValid() ? GetViewportUVSize(GlareTexture) : FVector2f(1.0f, 1.0f);
+	PassParameters->FlareWeight = FlareWeight;
+	PassParameters->EnergyThreshold = FMath::Max(CVarLensFlareTileClassificationThreshold.GetValueOnRenderThread(), 0.0f);
+	PassParameters->RWTileList = GraphBuilder.CreateUAV(OutTileList, PF_R32_UINT);
+	PassParameters->RWTileCount = TileCountUAV;
+
+	if (MipMapsUpsample.Num() > 1)
+	{
+		// 1/8 resolution or the smallest mip. A 32 pixel tile is then covered by the 4x4 taps of the classification.
+		const FScreenPassTextureSlice& BloomMip = MipMapsUpsample[FMath::Min(3, MipMapsUpsample.Num() - 1)];
+		PassParameters->BloomTexture = BloomMip.TextureSRV;
+		PassParameters->BloomViewportSize = GetViewportUVSize(BloomMip);
+		PassParameters->BloomWeight = BloomIntensity;
+
+		// The last upsample keeps this much of the unthresholded scene color
+		PassParameters->SceneColorTexture = MipMapsDownsample[0].TextureSRV;
+		PassParameters->SceneColor = GetScreenPassTextureViewportParameters(GetSliceViewport(MipMapsDownsample[0]));
+		PassParameters->SceneColorWeight = (1.0f - Radius) * BloomIntensity;
+	}
+
+	TShaderMapRef<FLensFlareClassifyTilesCS> ComputeShader(View.ShaderMap);
+	FCustomLensFlarePSOPrecache::ValidatePrecached(ComputeShader.GetComputeShader(), TEXT("LensFlareClassifyTiles"));
+
+	FComputeShaderUtils::AddPass(
+		GraphBuilder,
+		RDG_EVENT_NAME("LensFlareClassifyTiles %dx%d", TileCount.X, TileCount.Y),
+		ComputeShader,
+		PassParameters,
+		FComputeShaderUtils::GetGroupCount(TileCount, FIntPoint(8, 8)));
+
+	OutDispatchArgs = AddBuildTileDispatchArgsPass(GraphBuilder, View.ShaderMap, TileCountBuffer);
+}
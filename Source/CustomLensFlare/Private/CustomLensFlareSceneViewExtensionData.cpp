@@ -3,19 +3,100 @@
 
 #include "CustomLensFlareSceneViewExtensionData.h"
 
-TStrongObjectPtr<UCustomLensFlareConfig> FCustomLensFlareSceneViewExtensionData::BaseConfig;
+#include "CustomLensFlare.h"
+#include "CustomLensFlareSceneViewExtension.h"
+#include "TextureResource.h"
+
 FCustomLensFlareSceneViewExtensionData::FCustomLensFlareSceneViewExtensionData()
 {
-	if (!BaseConfig.IsValid())
+	// The extension loads the base config asynchronously. Until it has arrived views start from the neutral look.
+	// Capturing the state here keeps it fixed for the lifetime of this family, no matter what is swapped in later.
+	if (const TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtension = FCustomLensFlareModule::GetSceneViewExtension())
 	{
-		FString ConfigPath;
-		if (GConfig->GetString(TEXT("CustomLensFlareSceneViewExtension"), TEXT("ConfigPath"), ConfigPath, GEngineIni))
-		{
-			UCustomLensFlareConfig* LoadedConfig = LoadObject<UCustomLensFlareConfig>(nullptr, *ConfigPath);
-			check(LoadedConfig);
-			BaseConfig = TStrongObjectPtr(LoadedConfig);
-		}
+		BaseConfig = SceneViewExtension->GetConfig();
+		Pipeline = SceneViewExtension->GetPipeline();
+		ConfigGeneration = SceneViewExtension->GetConfigGeneration();
+	}
+}
+
+FCustomLensFlareSceneViewExtensionData::FPerViewExtensionData FCustomLensFlareSceneViewExtensionData::FPerViewExtensionData::MakeNeutral()
+{
+	FPerViewExtensionData Neutral;
+	Neutral.GhostIntensity = 0.0f;
+	Neutral.HaloIntensity = 0.0f;
+	Neutral.GlareIntensity = 0.0f;
+	Neutral.FlareIntensity = 0.0f;
+	return Neutral;
+}
+
+float& FCustomLensFlareSceneViewExtensionData::FPerViewExtensionData::GetParameter(ECustomLensFlareParameter Parameter)
+{
+	switch (Parameter)
+	{
+	case ECustomLensFlareParameter::Intensity: return Intensity;
+	case ECustomLensFlareParameter::ThresholdRange: return ThresholdRange;
+	case ECustomLensFlareParameter::GhostIntensity: return GhostIntensity;
+	case ECustomLensFlareParameter::GhostChromaShift: return GhostChromaShift;
+	case ECustomLensFlareParameter::GhostSpriteSize: return GhostSpriteSize;
+	case ECustomLensFlareParameter::HaloIntensity: return HaloIntensity;
+	case ECustomLensFlareParameter::HaloWidth: return HaloWidth;
+	case ECustomLensFlareParameter::HaloMask: return HaloMask;
+	case ECustomLensFlareParameter::HaloCompression: return HaloCompression;
+	case ECustomLensFlareParameter::HaloChromaShift: return HaloChromaShift;
+	case ECustomLensFlareParameter::GlareIntensity: return GlareIntensity;
+	case ECustomLensFlareParameter::GlareDivider: return GlareDivider;
+	case ECustomLensFlareParameter::FlareIntensity: return FlareIntensity;
+	}
+
+	checkNoEntry();
+	return Intensity;
+}
+
+FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy::FPerViewRenderProxy(const FPerViewExtensionData& InData)
+	: FPerViewExtensionData(InData)
+{
+	GradientResource = Gradient ? Gradient->GetResource() : nullptr;
+	GlareLineMaskResource = GlareLineMask ? GlareLineMask->GetResource() : nullptr;
+	GhostSpriteTextureResource = GhostSpriteTexture ? GhostSpriteTexture->GetResource() : nullptr;
+
+	Gradient = nullptr;
+	GlareLineMask = nullptr;
+	GhostSpriteTexture = nullptr;
+}
+
+uint32 FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy::GetHash() const
+{
+	uint32 Hash = GetTypeHash(Intensity);
+	Hash = HashCombine(Hash, GetTypeHash(Tint));
+	Hash = HashCombine(Hash, GetTypeHash(ThresholdLevel));
+	Hash = HashCombine(Hash, GetTypeHash(ThresholdRange));
+	Hash = HashCombine(Hash, GetTypeHash(GhostIntensity));
+	Hash = HashCombine(Hash, GetTypeHash(GhostChromaShift));
+	for (const FLensFlareGhostSettings& Ghost : Ghosts)
+	{
+		Hash = HashCombine(Hash, HashCombine(GetTypeHash(Ghost.Color), GetTypeHash(Ghost.Scale)));
 	}
+	Hash = HashCombine(Hash, GetTypeHash(uint8(GhostMode)));
+	Hash = HashCombine(Hash, GetTypeHash(GhostSpriteSize));
+	Hash = HashCombine(Hash, GetTypeHash(HaloIntensity));
+	Hash = HashCombine(Hash, GetTypeHash(HaloWidth));
+	Hash = HashCombine(Hash, GetTypeHash(HaloMask));
+	Hash = HashCombine(Hash, GetTypeHash(HaloCompression));
+	Hash = HashCombine(Hash, GetTypeHash(HaloChromaShift));
+	Hash = HashCombine(Hash, GetTypeHash(uint8(GlareMode)));
+	Hash = HashCombine(Hash, GetTypeHash(GlareIntensity));
+	Hash = HashCombine(Hash, GetTypeHash(GlareDivider));
+	Hash = HashCombine(Hash, GetTypeHash(GlareScale));
+	Hash = HashCombine(Hash, GetTypeHash(GlareAngles));
+	Hash = HashCombine(Hash, GetTypeHash(GlareTint));
+	Hash = HashCombine(Hash, GetTypeHash(uint8(StreakAxis)));
+	Hash = HashCombine(Hash, GetTypeHash(StreakStretch));
+	Hash = HashCombine(Hash, GetTypeHash(FlareTint));
+	Hash = HashCombine(Hash, GetTypeHash(FlareIntensity));
+	Hash = HashCombine(Hash, PointerHash(GradientResource));
+	Hash = HashCombine(Hash, PointerHash(GlareLineMaskResource));
+	Hash = HashCombine(Hash, PointerHash(GhostSpriteTextureResource));
+	return Hash;
 }
 
 const TCHAR* FCustomLensFlareSceneViewExtensionData::GSubclassIdentifier = TEXT("CustomLensFlareSceneViewExtensionData");
@@ -30,8 +111,15 @@ FCustomLensFlareSceneViewExtensionData::FPerViewExtensionData* FCustomLensFlareS
 	FPerViewExtensionData* PerViewExtensionData = PerViewData.Find(SceneView.State);
 	if (!PerViewExtensionData)
 	{
-		PerViewExtensionData = &PerViewData.Add(SceneView.State);
-		BaseConfig->OverrideBlendableSettings(SceneView, 1.0f);
+		if (BaseConfig)
+		{
+			PerViewExtensionData = &PerViewData.Add(SceneView.State);
+			BaseConfig->OverrideBlendableSettings(SceneView, 1.0f);
+		}
+		else
+		{
+			PerViewExtensionData = &PerViewData.Add(SceneView.State, FPerViewExtensionData::MakeNeutral());
+		}
 	}
 	return PerViewExtensionData;
 }
@@ -40,3 +128,31 @@ const FCustomLensFlareSceneViewExtensionData::FPerViewExtensionData* FCustomLens
 {
 	return PerViewData.Find(SceneView.State);
 }
+
+void FCustomLensFlareSceneViewExtensionData::FinalizeRenderProxies(const FSceneViewFamily& ViewFamily, TConstArrayView<FParameterOverride> ParameterOverrides)
+{
+	check(IsInGameThread());
+
+	RenderProxies.Reset();
+	for (const FSceneView* View : ViewFamily.Views)
+	{
+		if (const FPerViewExtensionData* ViewData = PerViewData.Find(View->State))
+		{
+			FPerViewRenderProxy& RenderProxy = RenderProxies.Add(View->State, FPerViewRenderProxy(*ViewData));
+
+			for (const FParameterOverride& ParameterOverride : ParameterOverrides)
+			{
+				if (ParameterOverride.PlayerIndex != INDEX_NONE && ParameterOverride.PlayerIndex != View->PlayerIndex)
+					continue;
+
+				float& Value = RenderProxy.GetParameter(ParameterOverride.Parameter);
+				Value = ParameterOverride.Mode == ECustomLensFlareOverrideMode::Multiply ? Value * ParameterOverride.Value : ParameterOverride.Value;
+			}
+		}
+	}
+}
+
+const FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy* FCustomLensFlareSceneViewExtensionData::GetRenderProxy(const FSceneView& SceneView) const
+{
+	return RenderProxies.Find(SceneView.State);
+}
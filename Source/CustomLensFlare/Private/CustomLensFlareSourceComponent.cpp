@@ -0,0 +1,31 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#include "CustomLensFlareSourceComponent.h"
+
+#include "CustomLensFlare.h"
+#include "CustomLensFlareSceneViewExtension.h"
+
+UCustomLensFlareSourceComponent::UCustomLensFlareSourceComponent()
+{
+	PrimaryComponentTick.bCanEverTick = false;
+}
+
+void UCustomLensFlareSourceComponent::OnRegister()
+{
+	Super::OnRegister();
+
+	if (const TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtension = FCustomLensFlareModule::GetSceneViewExtension())
+	{
+		SceneViewExtension->RegisterFlareSource(this);
+	}
+}
+
+void UCustomLensFlareSourceComponent::OnUnregister()
+{
+	if (const TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtension = FCustomLensFlareModule::GetSceneViewExtension())
+	{
+		SceneViewExtension->UnregisterFlareSource(this);
+	}
+
+	Super::OnUnregister();
+}
@@ -17,6 +17,11 @@ public:
 
 	void SetupCustomLensFlares();
 	void DestroyCustomLensFlares();
+
+	static FCustomLensFlareModule* Get();
+
+	/** The active extension or null if the module is not loaded or lens flares are disabled */
+	static TSharedPtr<FCustomLensFlareSceneViewExtension> GetSceneViewExtension();
 	
 	TSharedPtr<FCustomLensFlareSceneViewExtension> SceneViewExtensionInstance;
 };
@@ -0,0 +1,54 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CustomLensFlareConfig.h"
+#include "Kismet/BlueprintFunctionLibrary.h"
+#include "CustomLensFlareBlueprintLibrary.generated.h"
+
+/**
+ * Runtime control over the base look of the custom lens flares.
+ * All functions do nothing while lens flares are disabled.
+ */
+UCLASS()
+class CUSTOMLENSFLARE_API UCustomLensFlareBlueprintLibrary : public UBlueprintFunctionLibrary
+{
+	GENERATED_BODY()
+
+public:
+	/** Swaps the base config that is blended in first for every view. The config has to be loaded already. */
+	UFUNCTION(BlueprintCallable, Category = "Custom Lens Flare")
+	static void SetLensFlareBaseConfig(UCustomLensFlareConfig* Config);
+
+	/** Loads the config in the background and swaps to it once it has arrived. */
+	UFUNCTION(BlueprintCallable, Category = "Custom Lens Flare")
+	static void RequestLensFlareBaseConfig(TSoftObjectPtr<UCustomLensFlareConfig> Config);
+
+	/** Goes back to the base config set in the ini. */
+	UFUNCTION(BlueprintCallable, Category = "Custom Lens Flare")
+	static void ResetLensFlareBaseConfig();
+
+	UFUNCTION(BlueprintPure, Category = "Custom Lens Flare")
+	static UCustomLensFlareConfig* GetLensFlareBaseConfig();
+
+	UFUNCTION(BlueprintCallable, Category = "Custom Lens Flare")
+	static void SetLensFlarePipeline(ECustomLensFlarePipeline Pipeline);
+
+	UFUNCTION(BlueprintPure, Category = "Custom Lens Flare")
+	static ECustomLensFlarePipeline GetLensFlarePipeline();
+
+	/**
+	 * Overrides a parameter of the views of a player after the configs have been blended, until it is cleared.
+	 * Much cheaper than a blendable for values that change every frame. A PlayerIndex of -1 applies to all views.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Custom Lens Flare")
+	static void SetLensFlareParameterOverride(int32 PlayerIndex, ECustomLensFlareParameter Parameter, ECustomLensFlareOverrideMode Mode, float Value);
+
+	UFUNCTION(BlueprintCallable, Category = "Custom Lens Flare")
+	static void ClearLensFlareParameterOverride(int32 PlayerIndex, ECustomLensFlareParameter Parameter);
+
+	/** Clears every override of the player. -1 only clears the ones for all views. */
+	UFUNCTION(BlueprintCallable, Category = "Custom Lens Flare")
+	static void ClearLensFlareParameterOverrides(int32 PlayerIndex);
+};
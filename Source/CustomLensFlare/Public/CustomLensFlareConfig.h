@@ -6,6 +6,81 @@
 #include "UObject/Object.h"
 #include "CustomLensFlareConfig.generated.h"
 
+/** Which parts of the lens flare pipeline are rendered. Selected at runtime through FCustomLensFlareSceneViewExtension. */
+UENUM(BlueprintType)
+enum class ECustomLensFlarePipeline : uint8
+{
+	/** Bloom, ghosts, halo and glare */
+	Full,
+	/** Bloom, ghosts and halo */
+	NoGlare,
+	/** Only the custom bloom */
+	BloomOnly,
+	/**
+	 * Bloom plus flares drawn as a few sprites per light instead of from the image. For low end hardware.
+	 * Lights are the dominant directional light and every UCustomLensFlareSourceComponent.
+	 */
+	Analytic,
+};
+
+/** How the ghosts are produced */
+UENUM(BlueprintType)
+enum class ECustomLensFlareGhostMode : uint8
+{
+	/** Every ghost resamples the whole flare buffer. Handles any shape of bright area. */
+	ScreenSpace,
+	/** Bright spots are extracted and every ghost is drawn as one sprite per spot. Much cheaper for a few compact lights. */
+	Sprites,
+};
+
+/** How the glare is produced */
+UENUM(BlueprintType)
+enum class ECustomLensFlareGlareMode : uint8
+{
+	/** Every bright tile draws a star of three line quads. Cost grows with the number of bright tiles and the quad size. */
+	Quads,
+	/** Streaks along one axis from a chain of 1D blurs of the bloom. Cost only depends on the resolution. */
+	Streaks,
+};
+
+/** Direction of the streak glare */
+UENUM(BlueprintType)
+enum class ECustomLensFlareStreakAxis : uint8
+{
+	/** Anamorphic streaks */
+	Horizontal,
+	Vertical,
+};
+
+/** Scalar parameters gameplay can override per view without going through blendables, see FCustomLensFlareSceneViewExtension::SetParameterOverride() */
+UENUM(BlueprintType)
+enum class ECustomLensFlareParameter : uint8
+{
+	Intensity,
+	// No ThresholdLevel, the prefilter takes the bloom threshold of the view
+	ThresholdRange,
+	GhostIntensity,
+	GhostChromaShift,
+	GhostSpriteSize,
+	HaloIntensity,
+	HaloWidth,
+	HaloMask,
+	HaloCompression,
+	HaloChromaShift,
+	GlareIntensity,
+	GlareDivider,
+	FlareIntensity,
+};
+
+UENUM(BlueprintType)
+enum class ECustomLensFlareOverrideMode : uint8
+{
+	/** The blended value is multiplied by the override */
+	Multiply,
+	/** The override replaces the blended value */
+	Absolute,
+};
+
 // This custom struct is used to more easily
 // setup and organize the settings for the Ghosts
 USTRUCT(BlueprintType)
@@ -52,29 +127,56 @@ public:
 	UPROPERTY(EditAnywhere, Category="Ghosts", meta=(UIMin = "0.0", UIMax = "1.0"))
 	float GhostChromaShift = 0.015f;
 
+	/** Any number of ghosts. Ghosts with negligible alpha or scale are skipped, the rest are drawn brightest first. */
 	UPROPERTY(EditAnywhere, Category="Ghosts")
-	FLensFlareGhostSettings Ghost1 = {FLinearColor(1.0f, 0.8f, 0.4f, 1.0f), -1.5};
+	TArray<FLensFlareGhostSettings> Ghosts = {
+		{FLinearColor(1.0f, 0.8f, 0.4f, 1.0f), -1.5},
+		{FLinearColor(1.0f, 1.0f, 0.6f, 1.0f), 2.5},
+		{FLinearColor(0.8f, 0.8f, 1.0f, 1.0f), -5.0},
+		{FLinearColor(0.5f, 1.0f, 0.4f, 1.0f), 10.0},
+		{FLinearColor(0.5f, 0.8f, 1.0f, 1.0f), 0.7},
+		{FLinearColor(0.9f, 1.0f, 0.8f, 1.0f), -0.4},
+		{FLinearColor(1.0f, 0.8f, 0.4f, 1.0f), -0.2},
+		{FLinearColor(0.9f, 0.7f, 0.7f, 1.0f), -0.1},
+	};
 
 	UPROPERTY(EditAnywhere, Category="Ghosts")
+	ECustomLensFlareGhostMode GhostMode = ECustomLensFlareGhostMode::ScreenSpace;
+
+	/** Shape of the ghost sprites, multiplied with the ghost color. A soft disc is used if none is set. */
+	UPROPERTY(EditAnywhere, Category="Ghosts", meta=(EditCondition = "GhostMode == ECustomLensFlareGhostMode::Sprites"))
+	TObjectPtr<UTexture2D> GhostSpriteTexture = nullptr;
+
+	/** Sprite size relative to the size of the bright spot it is reflected from */
+	UPROPERTY(EditAnywhere, Category="Ghosts", meta=(EditCondition = "GhostMode == ECustomLensFlareGhostMode::Sprites", UIMin = "0.1", UIMax = "10.0"))
+	float GhostSpriteSize = 2.0f;
+
+#if WITH_EDITORONLY_DATA
+	// The fixed ghosts from before Ghosts was an array. Only kept to load old assets, moved into Ghosts in PostLoad().
+	UPROPERTY()
+	FLensFlareGhostSettings Ghost1 = {FLinearColor(1.0f, 0.8f, 0.4f, 1.0f), -1.5};
+
+	UPROPERTY()
 	FLensFlareGhostSettings Ghost2 = {FLinearColor(1.0f, 1.0f, 0.6f, 1.0f), 2.5};
 
-	UPROPERTY(EditAnywhere, Category="Ghosts")
+	UPROPERTY()
 	FLensFlareGhostSettings Ghost3 = {FLinearColor(0.8f, 0.8f, 1.0f, 1.0f), -5.0};
 
-	UPROPERTY(EditAnywhere, Category="Ghosts")
+	UPROPERTY()
 	FLensFlareGhostSettings Ghost4 = {FLinearColor(0.5f, 1.0f, 0.4f, 1.0f), 10.0};
 
-	UPROPERTY(EditAnywhere, Category="Ghosts")
+	UPROPERTY()
 	FLensFlareGhostSettings Ghost5 = {FLinearColor(0.5f, 0.8f, 1.0f, 1.0f), 0.7};
 
-	UPROPERTY(EditAnywhere, Category="Ghosts")
+	UPROPERTY()
 	FLensFlareGhostSettings Ghost6 = {FLinearColor(0.9f, 1.0f, 0.8f, 1.0f), -0.4};
 
-	UPROPERTY(EditAnywhere, Category="Ghosts")
+	UPROPERTY()
 	FLensFlareGhostSettings Ghost7 = {FLinearColor(1.0f, 0.8f, 0.4f, 1.0f), -0.2};
 
-	UPROPERTY(EditAnywhere, Category="Ghosts")
+	UPROPERTY()
 	FLensFlareGhostSettings Ghost8 = {FLinearColor(0.9f, 0.7f, 0.7f, 1.0f), -0.1};
+#endif
 
 
 	UPROPERTY(EditAnywhere, Category="Halo", meta=(UIMin = "0.0", UIMax = "1.0"))
@@ -93,24 +195,35 @@ public:
 	float HaloChromaShift = 0.015f;
 
 
+	UPROPERTY(EditAnywhere, Category="Glare")
+	ECustomLensFlareGlareMode GlareMode = ECustomLensFlareGlareMode::Quads;
+
+	/** Streaks spread the light instead of adding to it, so they need a much higher intensity than the quads for the same look */
 	UPROPERTY(EditAnywhere, Category="Glare", meta=(UIMin = "0", UIMax = "10"))
 	float GlareIntensity = 0.02f;
 
-	UPROPERTY(EditAnywhere, Category="Glare", meta=(UIMin = "0.01", UIMax = "200"))
+	UPROPERTY(EditAnywhere, Category="Glare", meta=(EditCondition = "GlareMode == ECustomLensFlareGlareMode::Quads", UIMin = "0.01", UIMax = "200"))
 	float GlareDivider = 60.0f;
 
-	UPROPERTY(EditAnywhere, Category="Glare", meta=(UIMin = "0.0", UIMax = "10.0"))
+	UPROPERTY(EditAnywhere, Category="Glare", meta=(EditCondition = "GlareMode == ECustomLensFlareGlareMode::Quads", UIMin = "0.0", UIMax = "10.0"))
 	FVector GlareScale = FVector(1.0f, 1.0f, 1.0f);
 
-	UPROPERTY(EditAnywhere, Category="Glare", meta=(UIMin = "0.0", UIMax = "10.0"))
+	UPROPERTY(EditAnywhere, Category="Glare", meta=(EditCondition = "GlareMode == ECustomLensFlareGlareMode::Quads", UIMin = "0.0", UIMax = "10.0"))
 	FVector GlareAngles = FVector(1.047197f, 1.570796f, 2.617994f);
 
 	UPROPERTY(EditAnywhere, Category="Glare")
 	FLinearColor GlareTint = FLinearColor(1.0f, 1.0f, 1.0f, 1.0f);
 
-	UPROPERTY(EditAnywhere, Category="Glare")
+	UPROPERTY(EditAnywhere, Category="Glare", meta=(EditCondition = "GlareMode == ECustomLensFlareGlareMode::Quads"))
 	TObjectPtr<UTexture2D> GlareLineMask = nullptr;
 
+	UPROPERTY(EditAnywhere, Category="Glare", meta=(EditCondition = "GlareMode == ECustomLensFlareGlareMode::Streaks"))
+	ECustomLensFlareStreakAxis StreakAxis = ECustomLensFlareStreakAxis::Horizontal;
+
+	/** How much every level of the streak chain keeps of the coarser one. Longer streaks towards 1, at the same cost. */
+	UPROPERTY(EditAnywhere, Category="Glare", meta=(EditCondition = "GlareMode == ECustomLensFlareGlareMode::Streaks", UIMin = "0.0", UIMax = "1.0", ClampMin = "0.0", ClampMax = "1.0"))
+	float StreakStretch = 0.75f;
+
 	UPROPERTY(EditAnywhere, Category="Flare")
 	FLinearColor FlareTint = FLinearColor(1.0f, 0.85f, 0.7f, 1.0f);
 
@@ -118,4 +231,23 @@ public:
 	float FlareIntensity = 1.0;
 
 	virtual void OverrideBlendableSettings(class FSceneView& View, float Weight) const override;
+
+	// - UObject
+	virtual void Serialize(FArchive& Ar) override;
+	virtual void PostLoad() override;
+	// --
+
+#if WITH_EDITOR
+	// - UObject
+	virtual void PostEditChangeProperty(struct FPropertyChangedEvent& PropertyChangedEvent) override;
+	// --
+
+	/** Uses this config as the base config of all views until the preview is reset or another config is set. */
+	UFUNCTION(CallInEditor, Category="Preview")
+	void PreviewAsBaseConfig();
+
+	/** Goes back to the base config set in the ini. */
+	UFUNCTION(CallInEditor, Category="Preview")
+	void ResetBaseConfigPreview();
+#endif
 };
@@ -4,23 +4,33 @@
 
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
+#include "Engine/BlendableInterface.h"
 #include "CustomLensFlarePostProcessComponent.generated.h"
 
 
+class UCurveFloat;
 class UCustomLensFlareConfig;
 
 /**
  * While this component is active it will blend in its lens flare config.
+ * The component itself is the blendable of the owning volume and applies its weight when the views are set up,
+ * so changing the weight or fading it doesn't touch the post process settings and the component never ticks.
  */
 UCLASS(ClassGroup=(Custom), meta=(BlueprintSpawnableComponent))
-class CUSTOMLENSFLARE_API UCustomLensFlarePostProcessComponent : public UActorComponent
+class CUSTOMLENSFLARE_API UCustomLensFlarePostProcessComponent : public UActorComponent, public IBlendableInterface
 {
 	GENERATED_BODY()
 
 public:
 	UCustomLensFlarePostProcessComponent();
 
+	// - UObject
+	virtual void Serialize(FArchive& Ar) override;
+	virtual void PostLoad() override;
+	// --
+
 	// - UActorComponent
+	virtual void OnRegister() override;
 	virtual void Activate(bool bReset = false) override;
 	virtual void Deactivate() override;
 #if WITH_EDITOR
@@ -28,10 +38,34 @@ public:
 #endif
 	// --
 
+	// - IBlendableInterface
+	virtual void OverrideBlendableSettings(class FSceneView& View, float InWeight) const override;
+	// --
+
+	/** Sets the weight right away and stops a running fade */
 	UFUNCTION(BlueprintCallable)
 	void SetWeight(float NewWeight);
+
+	/**
+	 * Fades from the current weight to TargetWeight over Duration seconds of world time.
+	 * The weight is evaluated while blending, so nothing has to be called while the fade runs.
+	 * Curve maps the elapsed fraction of the duration to the fraction of the fade, linear without one.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Custom Lens Flare")
+	void FadeToWeight(float TargetWeight, float Duration, UCurveFloat* Curve = nullptr);
+
+	/** The weight at this point in time, somewhere between the start and Weight while fading */
+	UFUNCTION(BlueprintPure, Category = "Custom Lens Flare")
+	float GetCurrentWeight() const;
+
+	UFUNCTION(BlueprintPure, Category = "Custom Lens Flare")
+	bool IsFading() const;
+
 protected:
-	void RemoveBlendable(UCustomLensFlareConfig* ConfigToRemove) const;
+	/** Adds this component to the blendables of the owning volume or post process component, unless it is there already */
+	void AddBlendable();
+	/** Removes the entry again if AddBlendable() put it there, entries placed by hand stay */
+	void RemoveBlendable();
 
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Custom Lens Flare")
 	TObjectPtr<UCustomLensFlareConfig> CustomLensFlareConfig;
@@ -39,11 +73,31 @@ protected:
 	/**
 	 * Additional weight to be applied to the influence.
 	 * Will be multiplied by the post process volumes overall weight before being used to blend in the config.
+	 * While fading this is the weight the fade ends at.
 	 */
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, BlueprintSetter=SetWeight, Category = "Custom Lens Flare")
 	float Weight = 1.0f;
 
-#if WITH_EDITORONLY_DATA
-	TWeakObjectPtr<UCustomLensFlareConfig> LastUsedConfig;
-#endif
+private:
+	/** Settings of the owning volume or post process component */
+	struct FPostProcessSettings* GetOwnerSettings() const;
+
+	float GetWeightAt(double WorldTime) const;
+
+	double GetWorldTime() const;
+
+	// The running fade goes from FadeStartWeight to Weight. Not running if FadeDuration is 0.
+	float FadeStartWeight = 0.0f;
+	double FadeStartTime = 0.0;
+	float FadeDuration = 0.0f;
+
+	UPROPERTY(Transient)
+	TObjectPtr<UCurveFloat> FadeCurve;
+
+	// Whether the entry in the blendables of the owner is ours to remove. Saved along with the entry.
+	UPROPERTY()
+	bool bAddedBlendable = false;
+
+	// Saved before the component was the blendable itself, the owner may still hold the config, see OnRegister()
+	bool bRemoveLegacyConfigBlendable = false;
 };
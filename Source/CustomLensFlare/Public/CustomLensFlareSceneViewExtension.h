@@ -4,11 +4,15 @@
 
 #include "CoreMinimal.h"
 #include "ScreenPass.h"
+#include "Engine/StreamableManager.h"
 #include "Runtime/Engine/Public/SceneViewExtension.h"
 #include "CustomLensFlareConfig.h"
 #include "CustomLensFlareSceneViewExtensionData.h"
 
 struct FLensFlareInputs;
+class FCustomLensFlareLUTCache;
+class FCustomLensFlareFrameCache;
+class UCustomLensFlareSourceComponent;
 
 /**
  * 
@@ -28,27 +32,138 @@ public:
 
 	void Initialize();
 
+	/** The base config that is blended in first for every view. Null while it is still loading. Game thread only. */
+	UCustomLensFlareConfig* GetConfig() const { return Config.Get(); }
+
+	/**
+	 * Runtime switching of the base config and the pipeline. Game thread only.
+	 * The state is captured into the extension data of each view family, so frames that are already in flight
+	 * finish with the previous state and the render thread never needs to synchronize with a swap.
+	 */
+
+	/** Swaps the base config. Pass a config that is already loaded, otherwise use RequestBaseConfig(). */
+	void SetBaseConfig(UCustomLensFlareConfig* NewConfig);
+
+	/** Streams the config in and swaps to it once it is loaded. The current config stays active until then. */
+	void RequestBaseConfig(const FSoftObjectPath& ConfigPath);
+
+	/** Goes back to the config set in the ini. */
+	void ResetBaseConfig();
+
+	/** Called when a config has been edited so derived render data is rebuilt if it is the active one. */
+	void NotifyConfigChanged(const UCustomLensFlareConfig* ChangedConfig);
+
+	void SetPipeline(ECustomLensFlarePipeline NewPipeline);
+	ECustomLensFlarePipeline GetPipeline() const { return Pipeline; }
+
+	/** Incremented on every swap or edit of the base config */
+	uint32 GetConfigGeneration() const { return ConfigGeneration; }
+
+	/** Lights for the Analytic pipeline. Game thread only. */
+	void RegisterFlareSource(const UCustomLensFlareSourceComponent* FlareSource);
+	void UnregisterFlareSource(const UCustomLensFlareSourceComponent* FlareSource);
+
+	/**
+	 * Overrides a parameter of the views of PlayerIndex, or of all views with INDEX_NONE, after blending. Game thread only.
+	 * Meant for gameplay that modulates a few values every frame, e.g. weather or damage effects, which would otherwise
+	 * need a blendable that lerps every parameter for every view. Stays in effect until it is cleared or set again.
+	 * Overrides of the same parameter apply in the order they were first set.
+	 */
+	void SetParameterOverride(int32 PlayerIndex, ECustomLensFlareParameter Parameter, ECustomLensFlareOverrideMode Mode, float Value);
+	void ClearParameterOverride(int32 PlayerIndex, ECustomLensFlareParameter Parameter);
+	/** Clears every override of PlayerIndex. INDEX_NONE only clears the ones for all views. */
+	void ClearParameterOverrides(int32 PlayerIndex);
+
 private:
-	FScreenPassTexture HandleBloomFlaresHook(FRDGBuilder& GraphBuilder,const FViewInfo& View, FScreenPassTextureSlice SceneColor, const class FTextureDownsampleChain& DownsampleChain);
+	void OnConfigLoaded();
+	void BindBloomFlaresHook();
+
+	FScreenPassTexture HandleBloomFlaresHook(FRDGBuilder& GraphBuilder,const FViewInfo& View, FScreenPassTextureSlice SceneColor, const class FTextureDownsampleChain& DownsampleChain, FRDGBufferRef EyeAdaptationBuffer);
+	FScreenPassTexture HandleLensFlaresLayerHook(FRDGBuilder& GraphBuilder, const FViewInfo& View, FScreenPassTexture Bloom, FRDGBufferRef EyeAdaptationBuffer);
+	FScreenPassTexture HandleMobileBloomFlaresHook(FRDGBuilder& GraphBuilder, const FViewInfo& View, FScreenPassTextureSlice SceneColor, FRDGBufferRef EyeAdaptationBuffer);
+
+	/**
+	 * Shared by both hooks. Without EngineBloom the bloom is rendered from SceneColor.
+	 * With it, SceneColor is the engine bloom as well and only the flares and glare are rendered and added to it.
+	 */
+	FScreenPassTexture RenderBloomFlares(FRDGBuilder& GraphBuilder, const FViewInfo& View, FScreenPassTextureSlice SceneColor, FScreenPassTexture EngineBloom, FRDGBufferRef EyeAdaptationBuffer);
 	void InitStates();
-	static const FCustomLensFlareSceneViewExtensionData::FPerViewExtensionData* GetPerViewExtensionData(const FSceneView& View);
+	static const FCustomLensFlareSceneViewExtensionData::FPerViewRenderProxy* GetPerViewRenderProxy(const FSceneView& View);
 
-	FScreenPassTexture RenderThreshold(FRDGBuilder& GraphBuilder,
-		FScreenPassTexture InputTexture,
-		const FViewInfo& View);
 	FScreenPassTexture RenderFlare(FRDGBuilder& GraphBuilder,
 		FScreenPassTextureSlice& BloomTexture,
+		const FScreenPassTextureSlice& GhostSourceTexture,
+		const FViewInfo& View);
+	void RenderGhostSprites(FRDGBuilder& GraphBuilder,
+		const FScreenPassTextureSlice& SourceTexture,
+		FRDGBufferSRVRef Ghosts,
+		uint32 GhostCount,
+		FRDGTextureRef OutputTexture,
+		const FIntRect& Viewport,
+		const FViewInfo& View);
+	void DrawGhostSprites(FRDGBuilder& GraphBuilder,
+		FRDGBufferRef SourcesBuffer,
+		FRDGBufferRef SourceCountBuffer,
+		uint32 MaxSources,
+		const FVector2f& SourceInvSize,
+		FRDGBufferSRVRef Ghosts,
+		uint32 GhostCount,
+		FRDGTextureRef OutputTexture,
+		const FIntRect& Viewport,
+		const FViewInfo& View);
+	FScreenPassTextureSlice RenderFlareSource(FRDGBuilder& GraphBuilder,
+		const FScreenPassTextureSlice& EngineBloom,
+		const FViewInfo& View);
+	FScreenPassTexture RenderAnalyticFlare(FRDGBuilder& GraphBuilder,
 		const FViewInfo& View);
 	FScreenPassTexture RenderGlare(FRDGBuilder& GraphBuilder,
 		FScreenPassTextureSlice& BloomTexture,
+		FRDGBufferSRVRef ExposureBuffer,
+		float ExposureScale,
+		const FViewInfo& View,
+		const FScreenPassTexture& CompositeTarget); // If valid, the glare is finished and added to it instead
+	FScreenPassTexture RenderStreaks(FRDGBuilder& GraphBuilder,
+		const FScreenPassTextureSlice& BloomTexture,
 		const FViewInfo& View);
+	enum class EBlurMethod : uint8
+	{
+		// Dual Kawase chain of BlurSteps raster passes down and as many back up
+		Kawase,
+		// Separable gaussian with the same spread in two compute passes. Falls back to Kawase where that isn't possible.
+		Compute
+	};
 	FScreenPassTexture RenderBlur(FRDGBuilder& GraphBuilder,
 		FScreenPassTexture InputTexture,
 		const FViewInfo& View,
-		int BlurSteps);
+		int BlurSteps,
+		EBlurMethod Method);
 
 	TStrongObjectPtr<UCustomLensFlareConfig> Config;
 
+	// Loads the base config and the textures it references without blocking the game thread
+	FStreamableManager StreamableManager;
+	TSharedPtr<FStreamableHandle> ConfigLoadHandle;
+	FSoftObjectPath IniConfigPath;
+	bool bHasBaseConfig = false;
+	bool bHookBound = false;
+
+	ECustomLensFlarePipeline Pipeline = ECustomLensFlarePipeline::Full;
+	uint32 ConfigGeneration = 0;
+
+	TArray<TWeakObjectPtr<const UCustomLensFlareSourceComponent>> FlareSources;
+
+	// Applied to the render proxies of every family, see SetParameterOverride()
+	TArray<FCustomLensFlareSceneViewExtensionData::FParameterOverride> ParameterOverrides;
+
+	// Baked halo and ghost lookup textures shared by all views. Render thread only.
+	TUniquePtr<FCustomLensFlareLUTCache> LUTCache;
+
+	// Output of views that don't change from one frame to the next. Render thread only.
+	TUniquePtr<FCustomLensFlareFrameCache> FrameCache;
+
+	// Exposure of one for views without eye adaptation, uploaded once. Render thread only.
+	TRefCountPtr<FRDGPooledBuffer> NoExposureBuffer;
+
 
 	// Cached blending and sampling states
 	// which are re-used across render passes
@@ -74,7 +189,9 @@ private:
 			const FString& PassName,
 			const FViewInfo& View,
 			FScreenPassTextureSlice InputTexture,
-			const FIntRect& Viewport
+			FRDGTextureRef TargetTexture,
+			int32 MipLevel,
+			bool bPrefilter
 		);
 
 		FScreenPassTextureSlice RenderUpsampleCombine(
@@ -83,10 +200,61 @@ private:
 			const FViewInfo& View,
 			const FScreenPassTextureSlice& InputTexture,
 			const FScreenPassTextureSlice& PreviousTexture,
+			FRDGTextureRef TargetTexture,
+			int32 MipLevel,
 			float Radius
 		);
 
+		/** Same as RenderUpsampleCombine() but only for the tiles that have any energy. The others are black. */
+		FScreenPassTextureSlice RenderUpsampleCombineTiled(
+			FRDGBuilder& GraphBuilder,
+			const FString& PassName,
+			const FViewInfo& View,
+			const FScreenPassTextureSlice& InputTexture,
+			const FScreenPassTextureSlice& PreviousTexture,
+			FRDGTextureRef TargetTexture,
+			int32 MipLevel,
+			float Radius
+		);
+
+		/**
+		 * Lists the tiles of an OutputSize target at the origin that bloom, flare or glare contribute to,
+		 * and the indirect arguments to dispatch one group per listed tile.
+		 */
+		void ClassifyTiles(
+			FRDGBuilder& GraphBuilder,
+			const FViewInfo& View,
+			FIntPoint OutputSize,
+			int32 TileSize,
+			const FScreenPassTexture& FlareTexture,
+			const FScreenPassTexture& GlareTexture,
+			float FlareWeight,
+			FRDGBufferRef& OutTileList,
+			FRDGBufferRef& OutDispatchArgs
+		) const;
+
+		/** The bloom MipLevel steps below what RenderBloom() returned, clamped to the smallest one. Invalid without a bloom. */
+		FScreenPassTextureSlice GetBloomMip(int32 MipLevel) const;
+
+		/** Thresholded downsample that sprite ghosts search for bright spots in. Invalid if the chain has no reduced mip. */
+		FScreenPassTextureSlice FindGhostSourceMip(int32 MaxWidth) const;
+
 		FCustomLensFlareSceneViewExtension& OwningExtension;
+
+		// Makes the threshold relative to the exposure of the view, see r.LensFlare.Threshold.ExposureRelative
+		FRDGBufferSRVRef ExposureBuffer = nullptr;
+		float ExposureScale = 1.0f;
+
+		// The mix and the last upsample skip empty screen tiles, see r.LensFlare.TileClassification
+		bool bTileClassification = false;
+
+		// RenderBloom() stops at half resolution and the mix does the last upsample, see r.LensFlare.FuseBloomUpsample
+		bool bFuseLastUpsample = false;
+
+		// Colors in 16 bit, see r.LensFlare.HalfPrecision
+		bool bHalfPrecision = false;
+
+		// Entry 0 is scene color, the others are single mip views of the BloomDownsample and BloomUpsample textures
 		TArray< FScreenPassTextureSlice > MipMapsDownsample;
 		TArray< FScreenPassTextureSlice > MipMapsUpsample;
 	};
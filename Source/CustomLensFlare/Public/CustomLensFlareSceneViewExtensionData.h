@@ -36,21 +36,14 @@ public:
 
 		float GhostChromaShift = 0.015f;
 
-		FLensFlareGhostSettings Ghost1 = {FLinearColor(1.0f, 0.8f, 0.4f, 1.0f), -1.5};
+		/** Blended ghosts, not culled yet. Inline for the common ghost counts so copying into the render proxy doesn't allocate. */
+		TArray<FLensFlareGhostSettings, TInlineAllocator<8>> Ghosts;
 
-		FLensFlareGhostSettings Ghost2 = {FLinearColor(1.0f, 1.0f, 0.6f, 1.0f), 2.5};
+		ECustomLensFlareGhostMode GhostMode = ECustomLensFlareGhostMode::ScreenSpace;
 
-		FLensFlareGhostSettings Ghost3 = {FLinearColor(0.8f, 0.8f, 1.0f, 1.0f), -5.0};
+		TObjectPtr<UTexture2D> GhostSpriteTexture = nullptr;
 
-		FLensFlareGhostSettings Ghost4 = {FLinearColor(0.5f, 1.0f, 0.4f, 1.0f), 10.0};
-
-		FLensFlareGhostSettings Ghost5 = {FLinearColor(0.5f, 0.8f, 1.0f, 1.0f), 0.7};
-
-		FLensFlareGhostSettings Ghost6 = {FLinearColor(0.9f, 1.0f, 0.8f, 1.0f), -0.4};
-
-		FLensFlareGhostSettings Ghost7 = {FLinearColor(1.0f, 0.8f, 0.4f, 1.0f), -0.2};
-
-		FLensFlareGhostSettings Ghost8 = {FLinearColor(0.9f, 0.7f, 0.7f, 1.0f), -0.1};
+		float GhostSpriteSize = 2.0f;
 
 		float HaloIntensity = 1.0f;
 
@@ -62,6 +55,8 @@ public:
 
 		float HaloChromaShift = 0.015f;
 
+		ECustomLensFlareGlareMode GlareMode = ECustomLensFlareGlareMode::Quads;
+
 		float GlareIntensity = 0.02f;
 
 		float GlareDivider = 60.0f;
@@ -74,16 +69,88 @@ public:
 
 		TObjectPtr<UTexture2D> GlareLineMask = nullptr;
 
+		ECustomLensFlareStreakAxis StreakAxis = ECustomLensFlareStreakAxis::Horizontal;
+
+		float StreakStretch = 0.75f;
+
 		FLinearColor FlareTint = FLinearColor(1.0f, 0.85f, 0.7f, 1.0f);
 
 		float FlareIntensity = 1.0;
+
+		/** Values views start from while the base config is still loading. Renders bloom only. */
+		static FPerViewExtensionData MakeNeutral();
+
+		float& GetParameter(ECustomLensFlareParameter Parameter);
+	};
+
+	/** A parameter gameplay overrides on top of the blended values */
+	struct FParameterOverride
+	{
+		/** Views of this player, INDEX_NONE for all views */
+		int32 PlayerIndex = INDEX_NONE;
+		ECustomLensFlareParameter Parameter = ECustomLensFlareParameter::Intensity;
+		ECustomLensFlareOverrideMode Mode = ECustomLensFlareOverrideMode::Multiply;
+		float Value = 1.0f;
+	};
+
+	/**
+	 * Immutable copy of the blended FPerViewExtensionData that is handed to the render thread.
+	 * Created on the game thread in FinalizeRenderProxies() so the render thread never has to touch the config or its textures.
+	 * The UObject members of the base are cleared, use the resources instead.
+	 */
+	struct FPerViewRenderProxy : public FPerViewExtensionData
+	{
+		explicit FPerViewRenderProxy(const FPerViewExtensionData& InData);
+
+		/** Changes with anything that affects the rendered image, for caches of rendered results */
+		uint32 GetHash() const;
+
+		FTextureResource* GradientResource = nullptr;
+
+		FTextureResource* GlareLineMaskResource = nullptr;
+
+		FTextureResource* GhostSpriteTextureResource = nullptr;
+	};
+
+	/** A light that casts a flare in the Analytic pipeline */
+	struct FFlareSource
+	{
+		FVector Position = FVector::ZeroVector;
+		FLinearColor Color = FLinearColor::White;
 	};
 
 	FPerViewExtensionData* GetOrCreateViewExtensionData(FSceneView& SceneView) const;;
 	const FPerViewExtensionData* GetViewExtensionData(const FSceneView& SceneView) const;;
 
+	/**
+	 * Snapshots the blended data of all views with the overrides that apply to them on top, in order.
+	 * Game thread only, called once blending is done.
+	 */
+	void FinalizeRenderProxies(const FSceneViewFamily& ViewFamily, TConstArrayView<FParameterOverride> ParameterOverrides = {});
+
+	/** Render thread access to the snapshot taken by FinalizeRenderProxies() */
+	const FPerViewRenderProxy* GetRenderProxy(const FSceneView& SceneView) const;
+
+	ECustomLensFlarePipeline GetPipeline() const { return Pipeline; }
+
+	/** Game thread only, before the family is rendered */
+	void SetFlareSources(TArray<FFlareSource>&& InFlareSources) { FlareSources = MoveTemp(InFlareSources); }
+	const TArray<FFlareSource>& GetFlareSources() const { return FlareSources; }
+
+	/** Changes whenever the base config was swapped or edited. Lets render side caches notice that they are stale. */
+	uint32 GetConfigGeneration() const { return ConfigGeneration; }
+
 private:
 	mutable TMap<void*, FPerViewExtensionData> PerViewData;
 
-	static TStrongObjectPtr<UCustomLensFlareConfig> BaseConfig;
+	TMap<void*, FPerViewRenderProxy> RenderProxies;
+
+	/** Config that is blended in first for every view. Owned by FCustomLensFlareSceneViewExtension, may be null while loading. */
+	const UCustomLensFlareConfig* BaseConfig = nullptr;
+
+	ECustomLensFlarePipeline Pipeline = ECustomLensFlarePipeline::Full;
+
+	uint32 ConfigGeneration = 0;
+
+	TArray<FFlareSource> FlareSources;
 };
@@ -0,0 +1,33 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/SceneComponent.h"
+#include "CustomLensFlareSourceComponent.generated.h"
+
+/**
+ * Marks a position, usually a light, that casts a flare in the Analytic lens flare pipeline.
+ * The dominant directional light casts one on its own, see r.LensFlare.Analytic.DirectionalLight.
+ */
+UCLASS(ClassGroup=(Custom), meta=(BlueprintSpawnableComponent))
+class CUSTOMLENSFLARE_API UCustomLensFlareSourceComponent : public USceneComponent
+{
+	GENERATED_BODY()
+
+public:
+	UCustomLensFlareSourceComponent();
+
+	// - UActorComponent
+	virtual void OnRegister() override;
+	virtual void OnUnregister() override;
+	// --
+
+	FLinearColor GetFlareColor() const { return Color * Intensity; }
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom Lens Flare")
+	FLinearColor Color = FLinearColor::White;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom Lens Flare", meta=(UIMin = "0.0", UIMax = "10.0"))
+	float Intensity = 1.0f;
+};
@@ -0,0 +1,530 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#include "CustomLensFlareBlendBenchmarkCommandlet.h"
+
+#include "CustomLensFlareConfig.h"
+#include "CustomLensFlarePostProcessComponent.h"
+#include "CustomLensFlareSceneViewExtensionData.h"
+#include "SceneView.h"
+#include "Dom/JsonObject.h"
+#include "Engine/Engine.h"
+#include "Engine/PostProcessVolume.h"
+#include "Engine/World.h"
+#include "HAL/MemoryBase.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+#include "UObject/UnrealType.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogCustomLensFlareBenchmark, Log, All);
+
+namespace
+{
+	// Frames that run before the measured ones, so containers have grown to their working size
+	constexpr int32 WarmupFrames = 10;
+
+	// Differences below this are noise, no matter the tolerance
+	constexpr double RegressionNoiseUs = 1.0;
+
+	const FIntRect BenchmarkViewRect(0, 0, 1920, 1080);
+
+	/**
+	 * Forwards to the allocator it replaces and counts what the game thread allocates.
+	 * Other threads may still hold the pointer at any time, so once installed it stays for the rest of the process.
+	 */
+	class FCountingMalloc final : public FMalloc
+	{
+	public:
+		explicit FCountingMalloc(FMalloc* InInner)
+			: Inner(InInner)
+		{
+		}
+
+		virtual void* Malloc(SIZE_T Size, uint32 Alignment) override
+		{
+			Count();
+			return Inner->Malloc(Size, Alignment);
+		}
+
+		virtual void* TryMalloc(SIZE_T Size, uint32 Alignment) override
+		{
+			Count();
+			return Inner->TryMalloc(Size, Alignment);
+		}
+
+		virtual void* Realloc(void* Original, SIZE_T Size, uint32 Alignment) override
+		{
+			if (Size > 0)
+			{
+				Count();
+			}
+			return Inner->Realloc(Original, Size, Alignment);
+		}
+
+		virtual void* TryRealloc(void* Original, SIZE_T Size, uint32 Alignment) override
+		{
+			if (Size > 0)
+			{
+				Count();
+			}
+			return Inner->TryRealloc(Original, Size, Alignment);
+		}
+
+		virtual void Free(void* Original) override { Inner->Free(Original); }
+		virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override { return Inner->QuantizeSize(Count, Alignment); }
+		virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override { return Inner->GetAllocationSize(Original, SizeOut); }
+		virtual void Trim(bool bTrimThreadCaches) override { Inner->Trim(bTrimThreadCaches); }
+		virtual void SetupTLSCachesOnCurrentThread() override { Inner->SetupTLSCachesOnCurrentThread(); }
+		virtual void ClearAndDisableTLSCachesOnCurrentThread() override { Inner->ClearAndDisableTLSCachesOnCurrentThread(); }
+		virtual bool IsInternallyThreadSafe() const override { return Inner->IsInternallyThreadSafe(); }
+		virtual bool ValidateHeap() override { return Inner->ValidateHeap(); }
+		virtual const TCHAR* GetDescriptiveName() override { return Inner->GetDescriptiveName(); }
+
+		uint64 GetGameThreadAllocations() const { return GameThreadAllocations; }
+
+	private:
+		void Count()
+		{
+			if (IsInGameThread())
+			{
+				++GameThreadAllocations;
+			}
+		}
+
+		FMalloc* Inner;
+		uint64 GameThreadAllocations = 0;
+	};
+
+	/** Installed by Main() before the first case and never removed */
+	FCountingMalloc* GAllocationCounter = nullptr;
+
+	enum class EPhase : uint8
+	{
+		SetWeight,
+		GetOrCreateViewExtensionData,
+		OverrideBlendableSettings,
+		FinalizeRenderProxies,
+		Total,
+		Num
+	};
+
+	const TCHAR* GetPhaseName(EPhase Phase)
+	{
+		switch (Phase)
+		{
+		case EPhase::SetWeight: return TEXT("SetWeight");
+		case EPhase::GetOrCreateViewExtensionData: return TEXT("GetOrCreateViewExtensionData");
+		case EPhase::OverrideBlendableSettings: return TEXT("OverrideBlendableSettings");
+		case EPhase::FinalizeRenderProxies: return TEXT("FinalizeRenderProxies");
+		case EPhase::Total: return TEXT("Total");
+		default: return TEXT("Unknown");
+		}
+	}
+
+	struct FPhaseResult
+	{
+		double MeanUs = 0.0;
+		double MedianUs = 0.0;
+		double P95Us = 0.0;
+		double AllocationsPerFrame = 0.0;
+	};
+
+	struct FCaseResult
+	{
+		int32 Volumes = 0;
+		int32 Configs = 0;
+		int32 Views = 0;
+		FPhaseResult Phases[int32(EPhase::Num)];
+	};
+
+	/** Per frame samples of one phase */
+	struct FPhaseSamples
+	{
+		TArray<double> TimesUs;
+		uint64 Allocations = 0;
+
+		FPhaseResult Summarize() const
+		{
+			FPhaseResult Result;
+			if (TimesUs.IsEmpty())
+				return Result;
+
+			TArray<double> Sorted = TimesUs;
+			Sorted.Sort();
+
+			double Sum = 0.0;
+			for (double TimeUs : Sorted)
+			{
+				Sum += TimeUs;
+			}
+
+			Result.MeanUs = Sum / Sorted.Num();
+			Result.MedianUs = Sorted[Sorted.Num() / 2];
+			Result.P95Us = Sorted[FMath::Min(FMath::FloorToInt32(Sorted.Num() * 0.95), Sorted.Num() - 1)];
+			Result.AllocationsPerFrame = double(Allocations) / Sorted.Num();
+			return Result;
+		}
+	};
+
+	/** Times a phase and counts its allocations into the samples, unless they are null during warmup */
+	class FScopedPhase
+	{
+	public:
+		FScopedPhase(FPhaseSamples* InSamples, double& InAccumulatedUs)
+			: Samples(InSamples)
+			, AccumulatedUs(InAccumulatedUs)
+			, StartCycles(FPlatformTime::Cycles64())
+			, StartAllocations(GAllocationCounter->GetGameThreadAllocations())
+		{
+		}
+
+		~FScopedPhase()
+		{
+			const double ElapsedUs = FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - StartCycles) * 1000.0;
+			AccumulatedUs += ElapsedUs;
+			if (Samples)
+			{
+				Samples->Allocations += GAllocationCounter->GetGameThreadAllocations() - StartAllocations;
+			}
+		}
+
+	private:
+		FPhaseSamples* Samples;
+		double& AccumulatedUs;
+		uint64 StartCycles;
+		uint64 StartAllocations;
+	};
+
+	TArray<int32> ParseCounts(const FString& Params, const TCHAR* Name, TArray<int32> Default)
+	{
+		FString Value;
+		if (!FParse::Value(*Params, Name, Value, false))
+			return Default;
+
+		TArray<FString> Entries;
+		Value.ParseIntoArray(Entries, TEXT(","));
+
+		TArray<int32> Counts;
+		for (const FString& Entry : Entries)
+		{
+			Counts.Add(FMath::Max(FCString::Atoi(*Entry), 1));
+		}
+		return Counts.IsEmpty() ? Default : Counts;
+	}
+
+	UCustomLensFlareConfig* CreateBenchmarkConfig(int32 Index)
+	{
+		UCustomLensFlareConfig* Config = NewObject<UCustomLensFlareConfig>(GetTransientPackage());
+
+		// Different values and ghost counts, so blending has to grow and fade the ghost arrays like in real levels
+		const float Variation = float(Index % 7) / 7.0f;
+		Config->Intensity = 0.5f + Variation;
+		Config->ThresholdLevel = 0.5f + Variation;
+		Config->HaloIntensity = Variation;
+		Config->GlareIntensity = 0.01f + 0.02f * Variation;
+		Config->Ghosts.SetNum(2 + Index % 8);
+		for (int32 GhostIndex = 0; GhostIndex < Config->Ghosts.Num(); ++GhostIndex)
+		{
+			Config->Ghosts[GhostIndex].Color = FLinearColor(1.0f, 1.0f - Variation, Variation, 1.0f);
+			Config->Ghosts[GhostIndex].Scale = 0.1f + GhostIndex * 0.2f;
+		}
+		return Config;
+	}
+
+	FCaseResult RunCase(UWorld* World, int32 NumVolumes, int32 NumConfigs, int32 NumViews, int32 NumFrames)
+	{
+		TArray<UCustomLensFlareConfig*> Configs;
+		for (int32 ConfigIndex = 0; ConfigIndex < NumConfigs; ++ConfigIndex)
+		{
+			Configs.Add(CreateBenchmarkConfig(ConfigIndex));
+		}
+
+		// The config of the component isn't settable from code, it is meant to be picked in the editor
+		FObjectPropertyBase* ConfigProperty = FindFProperty<FObjectPropertyBase>(UCustomLensFlarePostProcessComponent::StaticClass(), TEXT("CustomLensFlareConfig"));
+		check(ConfigProperty);
+
+		TArray<APostProcessVolume*> Volumes;
+		TArray<UCustomLensFlarePostProcessComponent*> Components;
+		for (int32 VolumeIndex = 0; VolumeIndex < NumVolumes; ++VolumeIndex)
+		{
+			APostProcessVolume* Volume = World->SpawnActor<APostProcessVolume>();
+			Volume->bUnbound = true;
+			Volume->Priority = float(VolumeIndex);
+
+			UCustomLensFlarePostProcessComponent* Component = NewObject<UCustomLensFlarePostProcessComponent>(Volume);
+			ConfigProperty->SetObjectPropertyValue_InContainer(Component, Configs[VolumeIndex % NumConfigs]);
+			Component->RegisterComponent();
+			// Adds it to the blendables of the volume, in case auto activation didn't
+			Component->Activate(true);
+
+			Volumes.Add(Volume);
+			Components.Add(Component);
+		}
+
+		// Distinct states, the blended data is kept per view state
+		TArray<FSceneViewStateReference> ViewStates;
+		ViewStates.SetNum(NumViews);
+		for (FSceneViewStateReference& ViewState : ViewStates)
+		{
+			ViewState.Allocate(World->GetFeatureLevel());
+		}
+
+		FPhaseSamples Samples[int32(EPhase::Num)];
+		for (int32 Frame = -WarmupFrames; Frame < NumFrames; ++Frame)
+		{
+			const bool bMeasure = Frame >= 0;
+			double PhaseUs[int32(EPhase::Num)] = {};
+			auto GetSamples = [&Samples, bMeasure](EPhase Phase) { return bMeasure ? &Samples[int32(Phase)] : nullptr; };
+
+			// Gameplay fading the volumes in and out
+			{
+				FScopedPhase Phase(GetSamples(EPhase::SetWeight), PhaseUs[int32(EPhase::SetWeight)]);
+				for (int32 ComponentIndex = 0; ComponentIndex < Components.Num(); ++ComponentIndex)
+				{
+					Components[ComponentIndex]->SetWeight(0.5f + 0.5f * FMath::Sin(float(Frame + ComponentIndex) * 0.1f));
+				}
+			}
+
+			// A new family every frame like the renderer creates, set up outside the measurement
+			FSceneViewFamilyContext ViewFamily(FSceneViewFamily::ConstructionValues(nullptr, World->Scene, FEngineShowFlags(ESFIM_Game)));
+			for (FSceneViewStateReference& ViewState : ViewStates)
+			{
+				FSceneViewInitOptions ViewInitOptions;
+				ViewInitOptions.ViewFamily = &ViewFamily;
+				ViewInitOptions.SetViewRectangle(BenchmarkViewRect);
+				ViewInitOptions.ViewOrigin = FVector::ZeroVector;
+				ViewInitOptions.ViewRotationMatrix = FMatrix::Identity;
+				ViewInitOptions.ProjectionMatrix = FReversedZPerspectiveMatrix(UE_HALF_PI * 0.5f, BenchmarkViewRect.Width(), BenchmarkViewRect.Height(), 10.0f);
+				ViewInitOptions.SceneViewStateInterface = ViewState.GetReference();
+				ViewFamily.Views.Add(new FSceneView(ViewInitOptions));
+			}
+
+			// What FSceneView::OverridePostProcessSettings() does for the blendables of every volume
+			for (const FSceneView* ConstView : ViewFamily.Views)
+			{
+				FSceneView& View = *const_cast<FSceneView*>(ConstView);
+				{
+					FScopedPhase Phase(GetSamples(EPhase::GetOrCreateViewExtensionData), PhaseUs[int32(EPhase::GetOrCreateViewExtensionData)]);
+					ViewFamily.GetOrCreateExtentionData<FCustomLensFlareSceneViewExtensionData>()->GetOrCreateViewExtensionData(View);
+				}
+
+				FScopedPhase Phase(GetSamples(EPhase::OverrideBlendableSettings), PhaseUs[int32(EPhase::OverrideBlendableSettings)]);
+				for (const APostProcessVolume* Volume : Volumes)
+				{
+					for (const FWeightedBlendable& Blendable : Volume->Settings.WeightedBlendables.Array)
+					{
+						IBlendableInterface* BlendableInterface = Cast<IBlendableInterface>(Blendable.Object);
+						if (BlendableInterface && Blendable.Weight > 0.0f)
+						{
+							BlendableInterface->OverrideBlendableSettings(View, Blendable.Weight * Volume->BlendWeight);
+						}
+					}
+				}
+			}
+
+			{
+				FScopedPhase Phase(GetSamples(EPhase::FinalizeRenderProxies), PhaseUs[int32(EPhase::FinalizeRenderProxies)]);
+				ViewFamily.GetOrCreateExtentionData<FCustomLensFlareSceneViewExtensionData>()->FinalizeRenderProxies(ViewFamily);
+			}
+
+			if (bMeasure)
+			{
+				double TotalUs = 0.0;
+				for (int32 PhaseIndex = 0; PhaseIndex < int32(EPhase::Total); ++PhaseIndex)
+				{
+					Samples[PhaseIndex].TimesUs.Add(PhaseUs[PhaseIndex]);
+					TotalUs += PhaseUs[PhaseIndex];
+				}
+				Samples[int32(EPhase::Total)].TimesUs.Add(TotalUs);
+			}
+		}
+
+		FCaseResult Result;
+		Result.Volumes = NumVolumes;
+		Result.Configs = NumConfigs;
+		Result.Views = NumViews;
+		uint64 TotalAllocations = 0;
+		for (int32 PhaseIndex = 0; PhaseIndex < int32(EPhase::Total); ++PhaseIndex)
+		{
+			TotalAllocations += Samples[PhaseIndex].Allocations;
+		}
+		Samples[int32(EPhase::Total)].Allocations = TotalAllocations;
+		for (int32 PhaseIndex = 0; PhaseIndex < int32(EPhase::Num); ++PhaseIndex)
+		{
+			Result.Phases[PhaseIndex] = Samples[PhaseIndex].Summarize();
+		}
+
+		for (FSceneViewStateReference& ViewState : ViewStates)
+		{
+			ViewState.Destroy();
+		}
+		for (APostProcessVolume* Volume : Volumes)
+		{
+			Volume->Destroy();
+		}
+		CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+
+		return Result;
+	}
+
+	TSharedRef<FJsonObject> ToJson(const FCaseResult& Case)
+	{
+		TSharedRef<FJsonObject> Json = MakeShared<FJsonObject>();
+		Json->SetNumberField(TEXT("Volumes"), Case.Volumes);
+		Json->SetNumberField(TEXT("Configs"), Case.Configs);
+		Json->SetNumberField(TEXT("Views"), Case.Views);
+
+		TArray<TSharedPtr<FJsonValue>> Phases;
+		for (int32 PhaseIndex = 0; PhaseIndex < int32(EPhase::Num); ++PhaseIndex)
+		{
+			const FPhaseResult& Phase = Case.Phases[PhaseIndex];
+			TSharedRef<FJsonObject> PhaseJson = MakeShared<FJsonObject>();
+			PhaseJson->SetStringField(TEXT("Phase"), GetPhaseName(EPhase(PhaseIndex)));
+			PhaseJson->SetNumberField(TEXT("MeanUs"), Phase.MeanUs);
+			PhaseJson->SetNumberField(TEXT("MedianUs"), Phase.MedianUs);
+			PhaseJson->SetNumberField(TEXT("P95Us"), Phase.P95Us);
+			PhaseJson->SetNumberField(TEXT("AllocationsPerFrame"), Phase.AllocationsPerFrame);
+			Phases.Add(MakeShared<FJsonValueObject>(PhaseJson));
+		}
+		Json->SetArrayField(TEXT("Phases"), Phases);
+		return Json;
+	}
+
+	/** Logs every phase that got slower than in the baseline. Returns the number of them. */
+	int32 CompareToBaseline(const TArray<FCaseResult>& Results, const FString& BaselinePath, double Tolerance)
+	{
+		FString BaselineText;
+		TSharedPtr<FJsonObject> Baseline;
+		if (!FFileHelper::LoadFileToString(BaselineText, *BaselinePath)
+			|| !FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(BaselineText), Baseline)
+			|| !Baseline.IsValid())
+		{
+			UE_LOG(LogCustomLensFlareBenchmark, Error, TEXT("Can't read the baseline %s"), *BaselinePath);
+			return 1;
+		}
+
+		int32 Regressions = 0;
+		for (const TSharedPtr<FJsonValue>& CaseValue : Baseline->GetArrayField(TEXT("Cases")))
+		{
+			const TSharedPtr<FJsonObject> BaselineCase = CaseValue->AsObject();
+			const FCaseResult* Case = Results.FindByPredicate([&BaselineCase](const FCaseResult& Candidate)
+			{
+				return Candidate.Volumes == BaselineCase->GetIntegerField(TEXT("Volumes"))
+					&& Candidate.Configs == BaselineCase->GetIntegerField(TEXT("Configs"))
+					&& Candidate.Views == BaselineCase->GetIntegerField(TEXT("Views"));
+			});
+			if (!Case)
+				continue;
+
+			for (const TSharedPtr<FJsonValue>& PhaseValue : BaselineCase->GetArrayField(TEXT("Phases")))
+			{
+				const TSharedPtr<FJsonObject> BaselinePhase = PhaseValue->AsObject();
+				const FString PhaseName = BaselinePhase->GetStringField(TEXT("Phase"));
+				for (int32 PhaseIndex = 0; PhaseIndex < int32(EPhase::Num); ++PhaseIndex)
+				{
+					if (PhaseName != GetPhaseName(EPhase(PhaseIndex)))
+						continue;
+
+					const double BaselineUs = BaselinePhase->GetNumberField(TEXT("MeanUs"));
+					const double MeanUs = Case->Phases[PhaseIndex].MeanUs;
+					if (MeanUs > BaselineUs * (1.0 + Tolerance) && MeanUs - BaselineUs > RegressionNoiseUs)
+					{
+						UE_LOG(LogCustomLensFlareBenchmark, Error, TEXT("%s with %d volumes, %d configs, %d views: %.2f us, baseline %.2f us"),
+							*PhaseName, Case->Volumes, Case->Configs, Case->Views, MeanUs, BaselineUs);
+						++Regressions;
+					}
+				}
+			}
+		}
+		return Regressions;
+	}
+}
+
+UCustomLensFlareBlendBenchmarkCommandlet::UCustomLensFlareBlendBenchmarkCommandlet()
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UCustomLensFlareBlendBenchmarkCommandlet::Main(const FString& Params)
+{
+	const TArray<int32> VolumeCounts = ParseCounts(Params, TEXT("Volumes="), { 1, 10, 100, 500 });
+	const TArray<int32> ConfigCounts = ParseCounts(Params, TEXT("Configs="), { 1, 4, 16 });
+	const TArray<int32> ViewCounts = ParseCounts(Params, TEXT("Views="), { 1, 2, 4, 8 });
+
+	int32 NumFrames = 200;
+	FParse::Value(*Params, TEXT("Frames="), NumFrames);
+	NumFrames = FMath::Max(NumFrames, 1);
+
+	FString OutputPath = FPaths::ProjectSavedDir() / TEXT("LensFlareBenchmarks") / TEXT("BlendBenchmark");
+	FParse::Value(*Params, TEXT("Output="), OutputPath);
+
+	// Swapped in once while nothing else runs yet and leaked on purpose, other threads keep calling into it
+	if (!GAllocationCounter)
+	{
+		GAllocationCounter = new FCountingMalloc(GMalloc);
+		GMalloc = GAllocationCounter;
+	}
+
+	UWorld* World = UWorld::CreateWorld(EWorldType::Game, false, TEXT("LensFlareBlendBenchmark"));
+	FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+	WorldContext.SetCurrentWorld(World);
+
+	TArray<FCaseResult> Results;
+	for (int32 NumVolumes : VolumeCounts)
+	{
+		for (int32 NumConfigs : ConfigCounts)
+		{
+			for (int32 NumViews : ViewCounts)
+			{
+				const FCaseResult& Case = Results.Add_GetRef(RunCase(World, NumVolumes, NumConfigs, NumViews, NumFrames));
+				const FPhaseResult& Total = Case.Phases[int32(EPhase::Total)];
+				UE_LOG(LogCustomLensFlareBenchmark, Display, TEXT("%4d volumes %3d configs %d views: %9.2f us mean, %9.2f us p95, %7.1f allocations per frame"),
+					NumVolumes, NumConfigs, NumViews, Total.MeanUs, Total.P95Us, Total.AllocationsPerFrame);
+			}
+		}
+	}
+
+	GEngine->DestroyWorldContext(World);
+	World->DestroyWorld(false);
+
+	FString Csv = TEXT("Volumes,Configs,Views,Phase,MeanUs,MedianUs,P95Us,AllocationsPerFrame\n");
+	TArray<TSharedPtr<FJsonValue>> Cases;
+	for (const FCaseResult& Case : Results)
+	{
+		for (int32 PhaseIndex = 0; PhaseIndex < int32(EPhase::Num); ++PhaseIndex)
+		{
+			const FPhaseResult& Phase = Case.Phases[PhaseIndex];
+			Csv += FString::Printf(TEXT("%d,%d,%d,%s,%.3f,%.3f,%.3f,%.2f\n"),
+				Case.Volumes, Case.Configs, Case.Views, GetPhaseName(EPhase(PhaseIndex)), Phase.MeanUs, Phase.MedianUs, Phase.P95Us, Phase.AllocationsPerFrame);
+		}
+		Cases.Add(MakeShared<FJsonValueObject>(ToJson(Case)));
+	}
+
+	TSharedRef<FJsonObject> Json = MakeShared<FJsonObject>();
+	Json->SetNumberField(TEXT("Frames"), NumFrames);
+	Json->SetArrayField(TEXT("Cases"), Cases);
+	FString JsonText;
+	FJsonSerializer::Serialize(Json, TJsonWriterFactory<>::Create(&JsonText));
+
+	if (!FFileHelper::SaveStringToFile(Csv, *(OutputPath + TEXT(".csv"))) || !FFileHelper::SaveStringToFile(JsonText, *(OutputPath + TEXT(".json"))))
+	{
+		UE_LOG(LogCustomLensFlareBenchmark, Error, TEXT("Failed to write %s.csv/.json"), *OutputPath);
+		return 1;
+	}
+	UE_LOG(LogCustomLensFlareBenchmark, Display, TEXT("Wrote %s.csv and %s.json"), *OutputPath, *OutputPath);
+
+	FString BaselinePath;
+	if (FParse::Value(*Params, TEXT("Baseline="), BaselinePath))
+	{
+		double Tolerance = 0.25;
+		FParse::Value(*Params, TEXT("Tolerance="), Tolerance);
+		if (CompareToBaseline(Results, BaselinePath, Tolerance) > 0)
+			return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,33 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "CustomLensFlareBlendBenchmarkCommandlet.generated.h"
+
+/**
+ * Measures the game thread cost of blending lens flare configs for every combination of volume, config and view counts.
+ * Each volume carries a UCustomLensFlarePostProcessComponent; every frame all their weights change through SetWeight(),
+ * every view blends all volumes through OverrideBlendableSettings() and the render proxies are taken.
+ *
+ * UnrealEditor-Cmd <Project> -run=CustomLensFlareBlendBenchmark -nullrhi
+ *   -Volumes=1,10,100,500  -Configs=1,4,16  -Views=1,2,4,8  -Frames=200
+ *   -Output=<path without extension, default Saved/LensFlareBenchmarks/BlendBenchmark>
+ *   -Baseline=<json of an earlier run>  -Tolerance=0.25
+ *
+ * Writes the mean, median and 95th percentile time and the game thread allocations per frame of every phase as CSV and JSON.
+ * With a baseline, returns 1 if any mean is more than Tolerance slower than in the baseline.
+ */
+UCLASS()
+class UCustomLensFlareBlendBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UCustomLensFlareBlendBenchmarkCommandlet();
+
+	// - UCommandlet
+	virtual int32 Main(const FString& Params) override;
+	// --
+};
@@ -0,0 +1,6 @@
+﻿// Copyright Manuel Wagner (singinwhale.com). All Rights Reserved.
+
+#include "Modules/ModuleManager.h"
+
+// Editor only tools, nothing to set up
+IMPLEMENT_MODULE(FDefaultModuleImpl, CustomLensFlareEditor)